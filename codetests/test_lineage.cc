@@ -0,0 +1,129 @@
+#include "../catch.hpp"
+
+#include "../lineage.hh"
+
+/// Stores a piece for each local particle in section sec (transition numbers which identify the piece)
+static void lineage_store_all(LineageTree &lineage, const unsigned int sec, const unsigned int pmin, const unsigned int N)
+{
+	Tensor transnum(3,2,2,1);
+	for(auto p = pmin; p < pmin+N; p++){
+		for(auto i = 0u; i < transnum.nelement(); i++) transnum.data()[i] = 100*sec + p + 1;
+		lineage.store(sec,p,transnum,1,3);
+	}
+}
+
+/// Checks that piece p in section sec is stored and decodes to the values set by lineage_store_all
+static bool lineage_stored(const LineageTree &lineage, const unsigned int sec, const unsigned int p)
+{
+	const auto &cod = lineage.piece(sec,p);
+	if(cod.size() == 0) return false;
+
+	vector <double> x(2*2*2*1);
+	auto nw = compact_decode(cod.data(),cod.size(),x.data(),x.size());
+	REQUIRE(nw == cod.size());
+	for(auto val : x) REQUIRE(val == 100*sec + p + 1);
+	return true;
+}
+
+const char* tag_lineage = "[lineage]";
+TEST_CASE("Pruning removes pieces with no children",
+					tag_lineage) {
+	LineageTree lineage;
+	lineage.initialise(3,4,0,4);
+	vector < vector <unsigned int> > backpart(4,vector <unsigned int> (4,0));
+
+	lineage_store_all(lineage,0,0,4);
+	backpart[1] = {0,0,1,1};
+	lineage.prune(0,backpart);
+
+	CHECK(lineage_stored(lineage,0,0) == true);
+	CHECK(lineage_stored(lineage,0,1) == true);
+	CHECK(lineage_stored(lineage,0,2) == false);
+	CHECK(lineage_stored(lineage,0,3) == false);
+}
+TEST_CASE("Pruning removes ancestors whose children have all been removed",
+					tag_lineage) {
+	LineageTree lineage;
+	lineage.initialise(3,4,0,4);
+	vector < vector <unsigned int> > backpart(4,vector <unsigned int> (4,0));
+
+	lineage_store_all(lineage,0,0,4);
+	backpart[1] = {0,0,1,1};
+	lineage.prune(0,backpart);
+
+	lineage_store_all(lineage,1,0,4);                   // Only descendants of particle 0 survive
+	backpart[2] = {0,0,0,0};
+	lineage.prune(1,backpart);
+
+	CHECK(lineage_stored(lineage,1,0) == true);
+	for(auto p = 1u; p < 4; p++) CHECK(lineage_stored(lineage,1,p) == false);
+	CHECK(lineage_stored(lineage,0,0) == true);         // The ancestor of 1,0 (its other child 1,1 has gone)
+	for(auto p = 1u; p < 4; p++) CHECK(lineage_stored(lineage,0,p) == false);
+
+	lineage_store_all(lineage,2,0,4);
+	backpart[3] = {1,2,3,3};                            // All pieces in section 2 survive except 2,0
+	lineage.prune(2,backpart);
+
+	CHECK(lineage_stored(lineage,2,0) == false);
+	for(auto p = 1u; p < 4; p++) CHECK(lineage_stored(lineage,2,p) == true);
+	CHECK(lineage_stored(lineage,1,0) == true);
+	CHECK(lineage_stored(lineage,0,0) == true);
+}
+TEST_CASE("Pruning removes a whole lineage when its last descendant goes",
+					tag_lineage) {
+	LineageTree lineage;
+	lineage.initialise(3,3,0,3);
+	vector < vector <unsigned int> > backpart(4,vector <unsigned int> (3,0));
+
+	lineage_store_all(lineage,0,0,3);
+	backpart[1] = {0,1,2};
+	lineage.prune(0,backpart);
+	for(auto p = 0u; p < 3; p++) CHECK(lineage_stored(lineage,0,p) == true);
+
+	lineage_store_all(lineage,1,0,3);
+	backpart[2] = {0,1,1};
+	lineage.prune(1,backpart);
+	CHECK(lineage_stored(lineage,1,2) == false);
+	CHECK(lineage_stored(lineage,0,2) == false);
+
+	lineage_store_all(lineage,2,0,3);
+	backpart[3] = {0,0,0};
+	lineage.prune(2,backpart);                          // 2,1 and 2,2 (both children of 1,1) have no children
+	CHECK(lineage_stored(lineage,2,1) == false);        // so the lineage through 0,1 and 1,1 goes
+	CHECK(lineage_stored(lineage,2,2) == false);
+	CHECK(lineage_stored(lineage,1,1) == false);
+	CHECK(lineage_stored(lineage,0,1) == false);
+	CHECK(lineage_stored(lineage,2,0) == true);
+	CHECK(lineage_stored(lineage,1,0) == true);
+	CHECK(lineage_stored(lineage,0,0) == true);
+}
+TEST_CASE("Pruning on one core tracks the children of particles stored on other cores",
+					tag_lineage) {
+	LineageTree lineage;
+	lineage.initialise(2,4,2,2);                        // This core stores particles 2 and 3
+	vector < vector <unsigned int> > backpart(3,vector <unsigned int> (4,0));
+
+	lineage_store_all(lineage,0,2,2);
+	backpart[1] = {0,3,3,1};
+	lineage.prune(0,backpart);
+	CHECK(lineage_stored(lineage,0,2) == false);
+	CHECK(lineage_stored(lineage,0,3) == true);
+
+	lineage_store_all(lineage,1,2,2);
+	backpart[2] = {0,0,0,3};                            // 1,1 and 1,2 go, so 0,3 is left with no children
+	lineage.prune(1,backpart);
+	CHECK(lineage_stored(lineage,1,2) == false);
+	CHECK(lineage_stored(lineage,1,3) == true);
+	CHECK(lineage_stored(lineage,0,3) == false);
+}
+TEST_CASE("Reinitialising the tree clears all pieces",
+					tag_lineage) {
+	LineageTree lineage;
+	lineage.initialise(2,2,0,2);
+	lineage_store_all(lineage,0,0,2);
+	CHECK(lineage_stored(lineage,0,0) == true);
+
+	lineage.initialise(2,2,0,2);
+	CHECK(lineage_stored(lineage,0,0) == false);
+	CHECK(lineage_stored(lineage,0,1) == false);
+}
@@ -0,0 +1,223 @@
+#include <cmath>
+
+#include "../catch.hpp"
+
+#include "../resample.hh"
+#include "../utils.hh"
+
+static vector <double> test_weights(const unsigned int n)
+{
+	vector <double> w(n);
+	for(auto i = 0u; i < n; i++) w[i] = (i%5 == 0 ? 0 : 0.1 + (i*37)%11);
+	return w;
+}
+
+static unsigned int total(const vector <unsigned int> &num)
+{
+	auto sum = 0u; for(auto val : num) sum += val;
+	return sum;
+}
+
+/// Checks anc is a valid ancestor vector for num (each particle appears num[i] times and copied particles keep their state)
+static void check_ancestor(const vector <unsigned int> &num, const vector <unsigned int> &anc)
+{
+	REQUIRE(anc.size() == num.size());
+	vector <unsigned int> count(num.size(),0);
+	for(auto i = 0u; i < anc.size(); i++){
+		REQUIRE(anc[i] < num.size());
+		count[anc[i]]++;
+		if(num[i] > 0) REQUIRE(anc[i] == i);
+	}
+	REQUIRE(count == num);
+}
+
+/// Calculates the counts as resample_number_distributed does, with the particles split into blocks of the given sizes
+static vector <unsigned int> resample_blocks(const vector <double> &w, const vector <unsigned int> &nblock, const unsigned int nsamp, const ResampleType type, const double u, const unsigned long step)
+{
+	auto wtot = 0.0; for(auto val : w) wtot += val;
+	auto fac = nsamp/wtot;
+
+	vector <unsigned int> num;
+	auto i = 0u;
+	auto woff = 0.0;
+	auto below_start = 0u;                            // The maximum of below_end on previous blocks (MPI_Exscan)
+	for(auto b = 0u; b < nblock.size(); b++){
+		vector <double> wb(w.begin()+i,w.begin()+i+nblock[b]);
+		auto wloc = 0.0; for(auto val : wb) wloc += val;
+
+		unsigned int below_end = 0;
+		if(wb.size() > 0) below_end = resample_below((woff+wloc)*fac,nsamp,type,u,step);
+		if(b == nblock.size()-1) below_end = nsamp;
+
+		auto numb = resample_number_block(wb,woff*fac,fac,nsamp,type,u,step,below_start,below_end);
+		num.insert(num.end(),numb.begin(),numb.end());
+
+		if(below_end > below_start) below_start = below_end;
+		woff += wloc;
+		i += nblock[b];
+	}
+
+	return num;
+}
+
+const char* tag_resample = "[resample]";
+TEST_CASE("Resampled numbers sum to nsamp for every scheme",
+					tag_resample) {
+	sran(0);
+	auto w = test_weights(100);
+	for(auto type : {MULTINOMIAL_RESAMPLE, SYSTEMATIC_RESAMPLE, STRATIFIED_RESAMPLE, RESIDUAL_RESAMPLE}){
+		for(auto nsamp : {1u, 7u, 100u, 1000u}){
+			auto num = resample_number(w,nsamp,type);
+			REQUIRE(num.size() == w.size());
+			REQUIRE(total(num) == nsamp);
+			for(auto i = 0u; i < w.size(); i++){ if(w[i] == 0) REQUIRE(num[i] == 0);}
+		}
+	}
+}
+TEST_CASE("Resampled numbers have expectation nsamp*w_i/wtot for every scheme",
+					tag_resample) {
+	sran(1);
+	auto w = test_weights(20);
+	auto wtot = 0.0; for(auto val : w) wtot += val;
+	auto nsamp = 20u, nrep = 20000u;
+
+	for(auto type : {MULTINOMIAL_RESAMPLE, SYSTEMATIC_RESAMPLE, STRATIFIED_RESAMPLE, RESIDUAL_RESAMPLE}){
+		vector <double> av(w.size(),0);
+		for(auto rep = 0u; rep < nrep; rep++){
+			auto num = resample_number(w,nsamp,type);
+			for(auto i = 0u; i < w.size(); i++) av[i] += num[i];
+		}
+		for(auto i = 0u; i < w.size(); i++){
+			auto expect = nsamp*w[i]/wtot;
+			CHECK(av[i]/nrep == Approx(expect).margin(0.05));
+		}
+	}
+}
+TEST_CASE("Systematic resampling never differs from the expectation by one or more",
+					tag_resample) {
+	auto w = test_weights(50);
+	auto wtot = 0.0; for(auto val : w) wtot += val;
+	for(auto u : {0.001, 0.3, 0.5, 0.999}){
+		auto num = resample_systematic(w,50,u);
+		REQUIRE(total(num) == 50);
+		for(auto i = 0u; i < w.size(); i++) REQUIRE(fabs(num[i]-50*w[i]/wtot) < 1);
+	}
+}
+TEST_CASE("resample_ancestor gives a valid ancestor vector",
+					tag_resample) {
+	sran(2);
+	auto w = test_weights(64);
+	for(auto type : {MULTINOMIAL_RESAMPLE, SYSTEMATIC_RESAMPLE, STRATIFIED_RESAMPLE, RESIDUAL_RESAMPLE}){
+		auto num = resample_number(w,64,type);
+		check_ancestor(num,resample_ancestor(num));
+	}
+
+	vector <unsigned int> all_one(10,1);
+	auto anc = resample_ancestor(all_one);
+	for(auto i = 0u; i < 10; i++) REQUIRE(anc[i] == i);
+}
+TEST_CASE("resample_ancestor_blocks gives a valid ancestor vector and moves the fewest particles between blocks",
+					tag_resample) {
+	sran(3);
+	auto w = test_weights(64);
+	for(auto nblock : {1u, 2u, 4u, 8u, 64u}){
+		for(auto type : {MULTINOMIAL_RESAMPLE, SYSTEMATIC_RESAMPLE, STRATIFIED_RESAMPLE, RESIDUAL_RESAMPLE}){
+			auto num = resample_number(w,64,type);
+			auto anc = resample_ancestor_blocks(num,nblock);
+			check_ancestor(num,anc);
+
+			auto nb = 64/nblock;
+			auto nmove = 0u, nsurplus = 0u;
+			for(auto b = 0u; b < nblock; b++){
+				auto ncopy = 0u; for(auto i = b*nb; i < (b+1)*nb; i++) ncopy += num[i];
+				if(ncopy > nb) nsurplus += ncopy-nb;
+			}
+			for(auto i = 0u; i < 64; i++){ if(anc[i]/nb != i/nb) nmove++;}
+			REQUIRE(nmove == nsurplus);
+		}
+	}
+}
+TEST_CASE("Distributed systematic resampling matches the serial numbers for the same u",
+					tag_resample) {
+	auto w = test_weights(60);
+	vector < vector <unsigned int> > splits = {{60}, {30,30}, {15,15,15,15}, {1,20,0,39}, {59,1}, {0,60,0}};
+	for(auto nsamp : {60u, 13u, 200u}){
+		for(auto u : {0.01, 0.37, 0.82}){
+			auto serial = resample_systematic(w,nsamp,u);
+			for(const auto &split : splits){
+				auto num = resample_blocks(w,split,nsamp,SYSTEMATIC_RESAMPLE,u,0);
+				REQUIRE(num == serial);
+			}
+		}
+	}
+}
+TEST_CASE("Distributed stratified resampling does not depend on how particles are split",
+					tag_resample) {
+	sran(4);
+	auto w = test_weights(60);
+	auto wtot = 0.0; for(auto val : w) wtot += val;
+	vector < vector <unsigned int> > splits = {{30,30}, {15,15,15,15}, {1,20,0,39}, {0,60,0}};
+
+	auto nsamp = 60u, nrep = 5000u;
+	vector <double> av(w.size(),0);
+	for(auto step = 0u; step < nrep; step++){
+		auto serial = resample_blocks(w,{60},nsamp,STRATIFIED_RESAMPLE,0,step);
+		REQUIRE(total(serial) == nsamp);
+		for(const auto &split : splits){
+			auto num = resample_blocks(w,split,nsamp,STRATIFIED_RESAMPLE,0,step);
+			REQUIRE(num == serial);
+		}
+		for(auto i = 0u; i < w.size(); i++) av[i] += serial[i];
+	}
+	for(auto i = 0u; i < w.size(); i++) CHECK(av[i]/nrep == Approx(nsamp*w[i]/wtot).margin(0.05));
+}
+
+/// A particle filter for a linear Gaussian model driven by the normals z (for the particles) and zres (for resampling)
+/// Resampling orders particles by their state, as PMCMC does for the correlated pseudo-marginal method
+static double toy_filter(const vector <double> &y, const double a, const vector < vector <double> > &z, const vector <double> &zres)
+{
+	auto N = z[0].size();
+	vector <double> x(N,0), xnew(N), w(N);
+	auto logL = 0.0;
+	for(auto t = 0u; t < y.size(); t++){
+		for(auto p = 0u; p < N; p++){ x[p] = a*x[p] + z[t][p]; w[p] = exp(-0.5*(y[t]-x[p])*(y[t]-x[p]));}
+		auto wtot = 0.0; for(auto val : w) wtot += val;
+		logL += log(wtot/N);
+
+		auto anc = resample_ancestor(resample_sorted(x,w,N,0.5*erfc(-zres[t]*M_SQRT1_2)));
+		for(auto p = 0u; p < N; p++) xnew[p] = x[anc[p]];
+		x.swap(xnew);
+	}
+	return logL;
+}
+
+/// The variance in the difference of log-likelihoods when the normals undergo a Crank-Nicolson move with correlation rho
+static double toy_var_ratio(const vector <double> &y, const double rho, const unsigned int nrep)
+{
+	auto T = (unsigned int) y.size(), N = 50u;
+
+	auto sum = 0.0, sum2 = 0.0;
+	for(auto rep = 0u; rep < nrep; rep++){
+		vector < vector <double> > z(T,vector <double> (N)), zp(T,vector <double> (N));
+		vector <double> zres(T), zresp(T);
+		for(auto t = 0u; t < T; t++){
+			for(auto p = 0u; p < N; p++){ z[t][p] = normal_sample(0,1); zp[t][p] = rho*z[t][p] + sqrt(1-rho*rho)*normal_sample(0,1);}
+			zres[t] = normal_sample(0,1); zresp[t] = rho*zres[t] + sqrt(1-rho*rho)*normal_sample(0,1);
+		}
+		auto d = toy_filter(y,0.8,zp,zresp) - toy_filter(y,0.8,z,zres);
+		sum += d; sum2 += d*d;
+	}
+	return sum2/nrep - (sum/nrep)*(sum/nrep);
+}
+
+TEST_CASE("Resampling sorted by state reduces the variance of the log-likelihood ratio for correlated normals",
+					tag_resample) {
+	sran(5);
+	vector <double> y(20);
+	auto x = 0.0; for(auto t = 0u; t < y.size(); t++){ x = 0.8*x + normal_sample(0,1); y[t] = x + normal_sample(0,1);}
+
+	auto var0 = toy_var_ratio(y,0,400);
+	auto var_rho = toy_var_ratio(y,0.99,400);
+	INFO("Variance for rho=0: " << var0 << "  rho=0.99: " << var_rho);
+	REQUIRE(var_rho < 0.5*var0);
+}
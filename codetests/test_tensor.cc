@@ -0,0 +1,227 @@
+#include <cmath>
+#include <limits>
+
+#include "../catch.hpp"
+
+#include "../tensor.hh"
+
+static vector <double> round_trip(const vector <double> &x)
+{
+	vector <uint16_t> code;
+	compact_encode(x.data(),x.size(),code);
+	vector <double> y(x.size(),-1);
+	auto nw = compact_decode(code.data(),code.size(),y.data(),y.size());
+	REQUIRE(nw == code.size());
+	return y;
+}
+
+const char* tag_tensor = "[tensor]";
+TEST_CASE("Compact encoding round trips small integers and zeros",
+					tag_tensor) {
+	vector <double> x = {0, 1, 2, 0, 0, 0, 7, 32767, 0};
+	auto y = round_trip(x);
+	REQUIRE(y == x);
+}
+TEST_CASE("Compact encoding stores small integers in one word each",
+					tag_tensor) {
+	vector <double> x = {1, 2, 3, 0, 0, 0, 0, 4};
+	vector <uint16_t> code;
+	compact_encode(x.data(),x.size(),code);
+	REQUIRE(code.size() == 5);
+}
+TEST_CASE("Compact encoding splits zero runs longer than 16383",
+					tag_tensor) {
+	vector <double> x(40000,0.0);
+	x[20000] = 5;
+	auto y = round_trip(x);
+	REQUIRE(y == x);
+
+	vector <double> z(40000,0.0);
+	y = round_trip(z);
+	REQUIRE(y == z);
+
+	vector <double> w(16383,0.0); w.push_back(1); w.resize(2*16383+1,0.0);
+	y = round_trip(w);
+	REQUIRE(y == w);
+}
+TEST_CASE("Compact encoding stores values at or above 2^15 in full",
+					tag_tensor) {
+	vector <double> x = {32767, 32768, 32769, 65535, 65536, 1e9, 0, 32768};
+	auto y = round_trip(x);
+	REQUIRE(y == x);
+}
+TEST_CASE("Compact encoding stores non-integer, negative and special values in full",
+					tag_tensor) {
+	vector <double> x = {0.5, -1, -32768, 1e-300, 3.25, std::numeric_limits<double>::infinity(), 0, 2.0/3.0};
+	auto y = round_trip(x);
+	REQUIRE(y == x);
+
+	vector <double> n = {1, std::numeric_limits<double>::quiet_NaN(), 0, 0};
+	y = round_trip(n);
+	CHECK(y[0] == 1);
+	CHECK(std::isnan(y[1]));
+	CHECK(y[2] == 0);
+	CHECK(y[3] == 0);
+}
+TEST_CASE("Concatenated compact encodings decode in sequence",
+					tag_tensor) {
+	vector <double> a = {0, 0, 3, 1e9};
+	vector <double> b(20000,0.0); b[1] = 0.25;
+	vector <double> c = {32768, 0};
+
+	vector <uint16_t> code;
+	compact_encode(a.data(),a.size(),code);
+	compact_encode(b.data(),b.size(),code);
+	compact_encode(c.data(),c.size(),code);
+
+	vector <double> ya(a.size()), yb(b.size()), yc(c.size());
+	size_t w = 0;
+	w += compact_decode(code.data()+w,code.size()-w,ya.data(),ya.size());
+	w += compact_decode(code.data()+w,code.size()-w,yb.data(),yb.size());
+	w += compact_decode(code.data()+w,code.size()-w,yc.data(),yc.size());
+	REQUIRE(w == code.size());
+	REQUIRE(ya == a);
+	REQUIRE(yb == b);
+	REQUIRE(yc == c);
+}
+TEST_CASE("CompactTensor round trips a tensor and its shape",
+					tag_tensor) {
+	Tensor ten(3,2,4,5,AREA_MAJOR);
+	auto num = ten.nelement();
+	for(auto i = 0u; i < num; i++) ten.data()[i] = (i%7 == 0 ? i*1000.5 : (i%3 == 0 ? i : 0));
+
+	CompactTensor ct;
+	REQUIRE(ct.empty());
+	ct.encode(ten);
+	REQUIRE(!ct.empty());
+
+	Tensor out;
+	ct.decode(out);
+	REQUIRE(out.same_shape(ten));
+	REQUIRE(out.order() == AREA_MAJOR);
+	for(auto i = 0u; i < num; i++) REQUIRE(out.data()[i] == ten.data()[i]);
+}
+TEST_CASE("Packed words round trip through a buffer of doubles",
+					tag_tensor) {
+	for(auto nw : {0u, 1u, 3u, 4u, 5u, 9u}){
+		vector <uint16_t> code;
+		for(auto j = 0u; j < nw; j++) code.push_back(uint16_t(0xffff - 1234*j));
+
+		vector <double> buffer = {7.5};
+		auto nd = compact_pack_words(code,buffer);
+		REQUIRE(nd == 1+(nw+3)/4);
+		REQUIRE(buffer.size() == 1+nd);
+
+		vector <uint16_t> out;
+		auto nd2 = compact_unpack_words(buffer.data()+1,buffer.size()-1,out);
+		REQUIRE(nd2 == nd);
+		REQUIRE(out == code);
+	}
+}
+TEST_CASE("Packed compact tensors decode after concatenation in one buffer",
+					tag_tensor) {
+	vector <double> a(50000,0.0); a[100] = 1e9; a[40000] = 2;
+	vector <double> b = {0.5, 32768, 0, 1};
+
+	vector <uint16_t> ca, cb;
+	compact_encode(a.data(),a.size(),ca);
+	compact_encode(b.data(),b.size(),cb);
+
+	vector <double> buffer;
+	compact_pack_words(ca,buffer);
+	compact_pack_words(cb,buffer);
+
+	vector <uint16_t> ua, ub;
+	size_t k = 0;
+	k += compact_unpack_words(buffer.data()+k,buffer.size()-k,ua);
+	k += compact_unpack_words(buffer.data()+k,buffer.size()-k,ub);
+	REQUIRE(k == buffer.size());
+
+	vector <double> ya(a.size()), yb(b.size());
+	compact_decode(ua.data(),ua.size(),ya.data(),ya.size());
+	compact_decode(ub.data(),ub.size(),yb.data(),yb.size());
+	REQUIRE(ya == a);
+	REQUIRE(yb == b);
+}
+
+static double slide_value(const unsigned int i0, const unsigned int i1, const unsigned int i2, const unsigned int i3)
+{
+	return 1000*i0 + 100*i1 + 10*i2 + i3;
+}
+
+/// Sets the elements of a tensor window (starting at its first stored index) to slide_value
+static void slide_fill(Tensor &ten)
+{
+	for(auto i0 = ten.first(); i0 < ten.first()+ten.size(0); i0++){
+		for(auto i1 = 0u; i1 < ten.size(1); i1++){
+			for(auto i2 = 0u; i2 < ten.size(2); i2++){
+				for(auto i3 = 0u; i3 < ten.size(3); i3++) ten(i0,i1,i2,i3) = slide_value(i0,i1,i2,i3);
+			}
+		}
+	}
+}
+
+/// Checks the elements for first indices from i0_start to i0_end (which must lie in the window) are unchanged
+static void slide_check(const Tensor &ten, const unsigned int i0_start, const unsigned int i0_end)
+{
+	for(auto i0 = i0_start; i0 < i0_end; i0++){
+		for(auto i1 = 0u; i1 < ten.size(1); i1++){
+			for(auto i2 = 0u; i2 < ten.size(2); i2++){
+				for(auto i3 = 0u; i3 < ten.size(3); i3++){
+					REQUIRE(ten(i0,i1,i2,i3) == slide_value(i0,i1,i2,i3));
+					REQUIRE(ten[i0][i1][i2][i3] == slide_value(i0,i1,i2,i3));
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("Sliding a tensor window forward keeps the overlapping elements",
+					tag_tensor) {
+	Tensor ten(5,2,3,2);
+	REQUIRE(ten.first() == 0);
+	slide_fill(ten);
+
+	ten.slide(2);
+	REQUIRE(ten.first() == 2);
+	slide_check(ten,2,5);
+
+	ten.slide(3);
+	slide_check(ten,3,5);
+
+	ten.slide(3);                                       // Sliding to the same position changes nothing
+	slide_check(ten,3,5);
+
+	ten.slide(20);                                      // No overlap
+	REQUIRE(ten.first() == 20);
+	slide_fill(ten);
+	slide_check(ten,20,25);
+}
+TEST_CASE("Sliding a tensor window backward keeps the overlapping elements",
+					tag_tensor) {
+	Tensor ten(5,2,3,2);
+	ten.slide(10);
+	slide_fill(ten);
+
+	ten.slide(8);
+	REQUIRE(ten.first() == 8);
+	slide_check(ten,10,13);
+
+	ten.slide(7);
+	slide_check(ten,10,12);
+
+	ten.slide(0);                                       // No overlap
+	REQUIRE(ten.first() == 0);
+	slide_fill(ten);
+	slide_check(ten,0,5);
+}
+TEST_CASE("Sliding a tensor forward and back restores the overlapping elements",
+					tag_tensor) {
+	Tensor ten(4,3,1,5);
+	ten.slide(6);
+	slide_fill(ten);
+
+	ten.slide(7);
+	ten.slide(6);
+	slide_check(ten,7,10);
+}
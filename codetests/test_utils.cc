@@ -4,6 +4,7 @@
 #include <iomanip>
 
 #include "../utils.hh"
+#include "../rng.hh"
 
 #include "../consts.hh"
 
@@ -14,22 +15,99 @@ using namespace std;
 //////////////////////////////////
 
 const char* tag_random = "[random]";
-TEST_CASE("ran after seed set to 0 returns result expected for std::mt19937",
+
+// Known-answer vectors for Philox4x32-10 published with Random123 (Salmon et al. 2011)
+TEST_CASE("philox4x32_10 with zero counter and key returns the known answer",
 					tag_random) {
-	sran(0);
-	double r = ran();
+	uint32_t ctr[4] = {0,0,0,0}, key[2] = {0,0}, out[4];
+	philox4x32_10(ctr,key,out);
+	
+	CHECK(out[0] == 0x6627e8d5);
+	CHECK(out[1] == 0xe169c58d);
+	CHECK(out[2] == 0xbc57ac4c);
+	REQUIRE(out[3] == 0x9b00dbd8);
+}
+
+TEST_CASE("philox4x32_10 with all bits set returns the known answer",
+					tag_random) {
+	uint32_t ctr[4] = {0xffffffff,0xffffffff,0xffffffff,0xffffffff}, key[2] = {0xffffffff,0xffffffff}, out[4];
+	philox4x32_10(ctr,key,out);
+	
+	CHECK(out[0] == 0x408f276d);
+	CHECK(out[1] == 0x41c83b0e);
+	CHECK(out[2] == 0xa20bc7c6);
+	REQUIRE(out[3] == 0x6d5451fd);
+}
+
+TEST_CASE("philox4x32_10 with the digits of pi returns the known answer",
+					tag_random) {
+	uint32_t ctr[4] = {0x243f6a88,0x85a308d3,0x13198a2e,0x03707344}, key[2] = {0xa4093822,0x299f31d0}, out[4];
+	philox4x32_10(ctr,key,out);
 	
-//	cout << "r == " << std::setprecision(19) << r << endl;
+	CHECK(out[0] == 0xd16cfe09);
+	CHECK(out[1] == 0x94fdcceb);
+	CHECK(out[2] == 0x5001e420);
+	REQUIRE(out[3] == 0x24126ea1);
+}
+
+TEST_CASE("RngStream draws the blocks for successive counters",
+					tag_random) {
+	RngStream rs;
+	rs.set(0,0,0,0);
 	
-	REQUIRE(r == 0.5928446159645536229);
+	vector <uint32_t> draw; for(auto i = 0u; i < 8; i++) draw.push_back(rs());
+	
+	uint32_t ctr[4] = {0,0,0,0}, key[2] = {0,0}, out[4];
+	for(auto b = 0u; b < 2; b++){
+		ctr[0] = b;
+		philox4x32_10(ctr,key,out);
+		for(auto i = 0u; i < 4; i++) CHECK(draw[4*b+i] == out[3-i]);  // The block is used from the end
+	}
 }
 
-TEST_CASE("normal after seed set to 0 returns result expected for std::mt19937",
+TEST_CASE("ran is reproducible after the seed is reset and lies in (0,1)",
 					tag_random) {
 	sran(0);
-	double r = normal_sample(1.,1.);
+	vector <double> r1; for(auto i = 0u; i < 100; i++) r1.push_back(ran());
+	sran(0);
+	for(auto i = 0u; i < 100; i++){
+		double r = ran();
+		CHECK(r == r1[i]);
+		CHECK(r > 0); CHECK(r < 1);
+	}
+}
+
+TEST_CASE("ran_stream is reproducible for a fixed step, run, particle, sett and area",
+					tag_random) {
+	sran(0);
+	ran_stream_seed(3);
+	
+	ran_stream(7,1,2,3,4);
+	vector <double> r1; for(auto i = 0u; i < 10; i++) r1.push_back(ran());
+	ran_stream_default();
+	
+	for(auto i = 0u; i < 5; i++) ran();                              // Draws on the default stream have no effect 
+	
+	ran_stream(7,1,2,3,4);
+	for(auto i = 0u; i < 10; i++) CHECK(ran() == r1[i]);
+	
+	ran_stream(7,1,2,3,5);                                           // A different area gives a different stream
+	REQUIRE(ran() != r1[0]);
+	ran_stream_default();
+}
+
+TEST_CASE("ran_stream returns to the outer stream without disturbing it",
+					tag_random) {
+	ran_stream_seed(3);
 	
-	REQUIRE(r == Approx(1.5708607051));
+	ran_stream_outer(11,0,5);
+	vector <double> r1; for(auto i = 0u; i < 6; i++) r1.push_back(ran());
+	
+	ran_stream_outer(11,0,5);
+	for(auto i = 0u; i < 3; i++) CHECK(ran() == r1[i]);
+	ran_stream(11,0,5,0,0); ran(); ran_stream_default();
+	for(auto i = 3u; i < 6; i++) CHECK(ran() == r1[i]);
+	ran_stream_outer_end();
 }
 
 TEST_CASE("gammasamp with invalid bounds throws",
@@ -44,36 +122,41 @@ TEST_CASE("gammasamp with invalid bounds throws",
 	CHECK_NOTHROW(r = gamma_sample(1.,0.));
 }
 
-TEST_CASE("gammasamp after seed set to 0 returns result expected for small a with std::mt19937",
+TEST_CASE("poisson_sample has the correct mean and variance",
 					tag_random) {
-	sran(0);
-	double r = gamma_sample(0.5,1.);
-	
-	REQUIRE(r == Approx(0.5648378411));
+	sran(1);
+	const auto nsamp = 200000u;
+	for(auto lam : {0.01, 0.5, 5.0, 20.0, 1000.0}){
+		auto sum = 0.0, sum2 = 0.0;
+		for(auto i = 0u; i < nsamp; i++){ double k = poisson_sample(lam); sum += k; sum2 += k*k;}
+		auto mean = sum/nsamp, var = sum2/nsamp - mean*mean;
+		
+		CHECK(mean == Approx(lam).margin(5*sqrt(lam/nsamp)));
+		CHECK(var == Approx(lam).epsilon(0.05).margin(0.001));
+	}
 }
 
-TEST_CASE("gammasamp after seed set to 0 returns result expected for large a with std::mt19937",
+TEST_CASE("binomial_sample has the correct mean and variance",
 					tag_random) {
-	sran(0);
-
-	// Loop sizes are chosen to exercise all code branches
-	// Would be easier to ensure using a mock RNG
-	REQUIRE(gamma_sample(2.,1.) == Approx(2.5176090456));
-	for (int i=0; i<11; ++i) {
-		(void) gamma_sample(2.,1.);
-	}
-	REQUIRE(gamma_sample(2.,1.) == Approx(0.482169407));
-	for (int i=0; i<53; ++i) {
-		(void) gamma_sample(2.,1.);
+	sran(1);
+	const auto nsamp = 200000u;
+	for(auto p : {0.01, 0.3, 0.9, 0.999, 1.0}){
+		for(auto n : {10u, 1000u}){
+			auto sum = 0.0, sum2 = 0.0;
+			for(auto i = 0u; i < nsamp; i++){ double k = binomial_sample(p,n); sum += k; sum2 += k*k;}
+			auto mean = sum/nsamp, var = sum2/nsamp - mean*mean;
+			auto var_exp = n*p*(1-p);
+			
+			CHECK(mean == Approx(n*p).margin(5*sqrt(var_exp/nsamp)+1e-9));
+			CHECK(var == Approx(var_exp).epsilon(0.05).margin(0.001));
+		}
 	}
-	REQUIRE(gamma_sample(2.,1.) == Approx(1.4667583414));
 }
-TEST_CASE("gammasamp after seed set to 0 returns result expected for a at boundary with std::mt19937",
-					tag_random) {
-	sran(0);
-	double r = gamma_sample(1.,1.);
-	
-	REQUIRE(r == Approx(1.2498384326));
+
+// Hidden by default (run with the tag "[benchmark]") because it takes a minute
+TEST_CASE("sampler_benchmark reports samples per second against the standard library",
+					"[.][benchmark]") {
+	sampler_benchmark();
 }
 
 //////////////////////////////////
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <algorithm> 
 #include <sstream> 
+#include <cmath>
 
 using namespace std;
 
@@ -30,22 +31,26 @@ void ABC::run()
 	for(auto ru = 0u; ru < nrun; ru++){ ntr[ru] = 0; nac[ru] = 0;}
 	
 	timer[TIME_ALG].start();
-	do{	
-		for(auto ru = 0u; ru < nrun; ru++){
-			do{
-				auto param = model.sample_from_prior();        // Samples parameters from the prior
-
-				state.simulate(param);                         // Simulates a state
+	if(GRmax != UNSET){                                  // Convergence is checked collectively
+		do{	
+			sample_round();
+		}while(!terminate());                              // Terminates when sufficient samples are generated
+	}
+	else{                                                // Rounds are handed out to cores from a work queue
+		unsigned long nround;
+		if(cutoff != UNSET) nround = Ntot;
+		else nround = (unsigned long)(ceil(Ntot/cutoff_frac-TINY));
+		
+		mpi.workqueue_start(nround);
+		do{
+			auto nbatch = mpi.workqueue_next();
+			if(nbatch == 0) break;
+			
+			for(auto b = 0u; b < nbatch; b++) sample_round();
 			
-				ntr[ru]++;
-				if(cutoff == UNSET || state.EF < cutoff){      // Stores the state if the error function is below the cutoff    
-					particle_store.push_back(state.create_particle(ru));
-					nac[ru]++; 
-					break;
-				}
-			}while(true);
-		}	
-	}while(!terminate());                                // Terminates when sufficient samples are generated
+			output.print_percentage(mpi.workqueue_ndone(),nround,percentage);
+		}while(true);
+	}
 	
 	if(cutoff_frac != UNSET) implement_cutoff_frac();    // Implements the acceptance rate to give cut-off
 
@@ -57,31 +62,40 @@ void ABC::run()
 }
 
 
-/// Determines when to terminate the algorithm
+/// Generates an accepted sample for each of the runs
+void ABC::sample_round()
+{
+	for(auto ru = 0u; ru < nrun; ru++){
+		do{
+			auto param = model.sample_from_prior();          // Samples parameters from the prior
+
+			state.simulate(param);                           // Simulates a state
+			
+			mpi.workqueue_poll();                            // Allows core 0 to hand out work to other cores
+			
+			ntr[ru]++;
+			if(cutoff == UNSET || state.EF < cutoff){        // Stores the state if the error function is below the cutoff    
+				particle_store.push_back(state.create_particle(ru,false));
+				particle_store.back().compact();             // Reduces the memory used to store the particle
+				nac[ru]++; 
+				break;
+			}
+		}while(true);
+	}	
+}
+
+
+/// Determines when to terminate the algorithm (based on the Gelman-Rubin statistic)
 bool ABC::terminate()
 {
 	bool term = false;
 
 	auto samptot = mpi.sum(long(particle_store.size()));
-	if(GRmax != UNSET){
-		auto psamp_tot = mpi.gather_psamp(particle_store);
-		if(mpi.core == 0){
-			auto GR = output.get_Gelman_Rubin_statistic(psamp_tot);
-			if(vec_max(GR) < GRmax && samptot >= nrun*20) term = true; 
-			cout << "Number of samples: " << samptot << "    Largest GR value:" << vec_max(GR) << "     GRmax: " << GRmax << endl;
-		}
-	}
-	else{
-		if(mpi.core == 0){
-			if(cutoff != UNSET){ 
-				if(samptot >= nrun*Ntot) term = true;
-				output.print_percentage(samptot,nrun*Ntot,percentage);
-			}
-			else{
-				if(samptot >= nrun*Ntot/cutoff_frac) term = true;
-				output.print_percentage(samptot*cutoff_frac,nrun*Ntot,percentage);
-			}
-		}
+	auto psamp_tot = mpi.gather_psamp(particle_store);
+	if(mpi.core == 0){
+		auto GR = output.get_Gelman_Rubin_statistic(psamp_tot);
+		if(vec_max(GR) < GRmax && samptot >= nrun*20) term = true; 
+		cout << "Number of samples: " << samptot << "    Largest GR value:" << vec_max(GR) << "     GRmax: " << GRmax << endl;
 	}
 	
 	mpi.bcast(term);
@@ -13,6 +13,7 @@ public:
 	void run();
 
 private:
+	void sample_round();
 	void implement_cutoff_frac();
 	bool terminate();
 	void diagnostic() const;
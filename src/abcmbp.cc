@@ -32,7 +32,7 @@ void ABCMBP::run()
 	for(auto g = 0u; g < G; g++){
 		timer[TIME_ALG].start();
 		
-		Generation gen; gen.time = clock();
+		Generation gen; gen.time = wall_clock();
 		
 		if(g == 0){                                             // For the initial generation sample states from the prior
 			gen.EFcut = LARGE; 
@@ -81,10 +81,11 @@ void ABCMBP::run()
 /// Stores a sample from each of the particles 
 void ABCMBP::store_sample(Generation &gen)
 {
-	for(const auto &pa : part){
+	for(auto &pa : part){
 		gen.param_samp.push_back(pa.create_param_samp());
-		state.initialise_from_particle(pa);
+		state.adopt_particle(pa);                               // The particle is lent to the state (avoiding copies)
 		gen.EF_datatable.push_back(obsmodel.get_EF_datatable(&state));
+		state.release_particle(pa);
 	}
 }
 
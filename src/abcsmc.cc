@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <sstream> 
+#include <cmath>
 
 using namespace std;
 
@@ -9,6 +10,7 @@ using namespace std;
 #include "timers.hh"
 #include "output.hh"
 #include "mpi.hh"
+#include "resample.hh"
 
 
 ABCSMC::ABCSMC(const Details &details, const Data &data, const Model &model, Inputs &inputs, const Output &output, const ObservationModel &obsmodel, Mpi &mpi) : state(details,data,model,obsmodel), details(details), model(model), output(output), obsmodel(obsmodel), mpi(mpi)
@@ -18,6 +20,7 @@ ABCSMC::ABCSMC(const Details &details, const Data &data, const Model &model, Inp
 	inputs.find_generation_or_cutoff_final(G,cutoff_final);
 	inputs.find_cutoff_frac(cutoff_frac);
 	inputs.find_propsize(propsize);
+	inputs.find_resample(resample);
 }
 
 
@@ -34,17 +37,19 @@ void ABCSMC::run()
 		particle_store.clear();
 		
 		Generation gen;
-		gen.time = clock();
+		gen.time = wall_clock();
 		if(g == 0){                                                        // For the initial generation sample states
-			do{          
+			generate_samples(gen,[&](){
 				for(auto ru = 0u; ru < nrun; ru++){
 					auto param = model.sample_from_prior();                      // Samples parameters from the prior
 						
 					state.simulate(param);                                       // Simulates the state
 				
+					mpi.workqueue_poll();                                        // Allows core 0 to hand out work
+					
 					store_sample(gen,g,ru,1);                                    // Stores the sample   
 				}
-			}while(!terminate(gen));
+			});
 		}
 		else{                                                              // Subsequent generations sample from particles
 			Generation &gen_last = generation[g-1];
@@ -56,7 +61,7 @@ void ABCSMC::run()
 			auto ntr = 0u, nac = 0u;
 			vector <double> wtot(nrun), wcut(nrun);                          // Sets up quantities for estimating model evidence
       for(auto ru = 0u; ru < nrun; ru++){ wtot[ru] = 0; wcut[ru] = 0;}      
-			do{
+			generate_samples(gen,[&](){
 				for(auto ru = 0u; ru < nrun; ru++){
 					do{
 						ntr++;
@@ -69,6 +74,8 @@ void ABCSMC::run()
 						if(model.inbounds(param_prop) == true){                    // Checks if parameters within bounds
 							state.simulate(param_prop);                              // Simulates a new state
 
+							mpi.workqueue_poll();                                    // Allows core 0 to hand out work
+
 							auto w = calculate_particle_weight(param_prop,gen_last,ru,mvn); // Calculates the weight for the sample
 	
 							wtot[ru] += w;
@@ -80,7 +87,7 @@ void ABCSMC::run()
 						}
 					}while(true);			
 				}
-			}while(!terminate(gen));
+			});
 			
 			for(auto ru = 0u; ru < nrun; ru++) gen.model_evidence.push_back(log(mpi.get_ratio(wcut[ru],wtot[ru])));
 			acrate = mpi.get_acrate(nac,ntr);
@@ -98,7 +105,7 @@ void ABCSMC::run()
 		
 		print_generation(generation,acrate);                               // Outputs statistics about generation
 		
-		auto time_av = mpi.average(timer[TIME_TOTAL].val+clock());
+		auto time_av = mpi.average(timer[TIME_TOTAL].val+wall_clock());
 		if(false && mpi.core == 0) cout <<  "Total time: " << prec(double(time_av)/(60.0*CLOCKS_PER_SEC),3) << " minutes." << endl;
 
 		if(gen.EFcut == cutoff_final) break;                               // Terminates if final EF is reached
@@ -110,6 +117,26 @@ void ABCSMC::run()
 }
 
 
+/// Repeatedly performs rounds (each generating a sample for every run) until sufficient samples exist
+void ABCSMC::generate_samples(Generation &gen, const function<void()> &round)
+{
+	if(GRmax != UNSET){                                                  // Convergence is checked collectively
+		do{
+			round();
+		}while(!terminate(gen));
+	}
+	else{                                                                // Rounds are handed out from a work queue
+		mpi.workqueue_start((unsigned long)(ceil(Ntot/cutoff_frac-TINY)));
+		do{
+			auto nbatch = mpi.workqueue_next();
+			if(nbatch == 0) break;
+			
+			for(auto b = 0u; b < nbatch; b++) round();
+		}while(true);
+	}
+}
+
+
 /// Stores parameter and state sample 
 void ABCSMC::store_sample(Generation &gen, const unsigned int g, const unsigned int run, const double w)
 {
@@ -117,7 +144,8 @@ void ABCSMC::store_sample(Generation &gen, const unsigned int g, const unsigned
 	gen.EF_datatable.push_back(obsmodel.get_EF_datatable(&state));
 	gen.w.push_back(w);
 	if(g == G-1 || cutoff_final != UNSET){                               // In last generation stores particles for plotting  
-		particle_store.push_back(state.create_particle(run));   
+		particle_store.push_back(state.create_particle(run,false));   
+		particle_store.back().compact();                                   // Reduces the memory used to store the particle
 	}
 }
 
@@ -160,25 +188,18 @@ void ABCSMC::implement_cutoff_frac(Generation &gen)
 }
 
 
-/// Determines when to terminate the algorithm
+/// Determines when to terminate the algorithm (based on the Gelman-Rubin statistic)
 bool ABCSMC::terminate(const Generation &gen) const
 {
 	bool term = false;
 	auto samptot = mpi.sum(long(gen.w.size()));
 	
-	if(GRmax != UNSET){
-		auto psamp_tot = mpi.gather_psamp(gen.param_samp);
-		auto w_tot = mpi.gather(gen.w);
-		if(mpi.core == 0){
-			auto GR = output.get_Gelman_Rubin_statistic(psamp_tot,w_tot,nrun);
-			if(vec_max(GR) < GRmax && samptot >= nrun*20) term = true; 
-			cout << "Number of samples: " << samptot << "    Largest GR value:" << vec_max(GR) << "     GRmax: " << GRmax << endl;
-		}
-	}
-	else{
-		if(mpi.core == 0){
-			if(samptot >= nrun*Ntot/cutoff_frac) term = true;
-		}
+	auto psamp_tot = mpi.gather_psamp(gen.param_samp);
+	auto w_tot = mpi.gather(gen.w);
+	if(mpi.core == 0){
+		auto GR = output.get_Gelman_Rubin_statistic(psamp_tot,w_tot,nrun);
+		if(vec_max(GR) < GRmax && samptot >= nrun*20) term = true; 
+		cout << "Number of samples: " << samptot << "    Largest GR value:" << vec_max(GR) << "     GRmax: " << GRmax << endl;
 	}
 	mpi.bcast(term);
 	
@@ -209,7 +230,7 @@ unsigned int ABCSMC::particle_sampler(const unsigned int run) const
 {
 	auto NN = wsum[run].size();
 	double z = ran()*wsum[run][NN-1]; 
-	auto p = 0u; while(p < NN && z > wsum[run][p]) p++;
+	auto p = (unsigned int)(lower_bound(wsum[run].begin(),wsum[run].end(),z)-wsum[run].begin()); // Binary search
 	if(p == NN) emsgEC("ABCSMC",2);
 	
 	return p;
@@ -269,10 +290,19 @@ void ABCSMC::results()
 	if(mpi.core == 0){                      
 		const Generation &gen_last = generation[generation.size()-1];
 		
-		setup_particle_sampler(gen_last);
-		for(auto i = 0u; i < particle.size(); i++){
-			auto p = particle_sampler(i%nrun);
-			particle_plot.push_back(particle[p]);
+		auto NN = gen_last.w.size();
+		if(particle.size() != NN) emsgEC("ABCSMC",3);
+		
+		vector <double> w(NN);
+		for(auto ru = 0u; ru < nrun; ru++){
+			for(auto i = 0u; i < NN; i++){ if(gen_last.param_samp[i].run == ru) w[i] = gen_last.w[i]; else w[i] = 0;}
+			
+			auto nsamp = 0u; for(auto i = 0u; i < NN; i++){ if(i%nrun == ru) nsamp++;}
+			
+			auto num = resample_number(w,nsamp,resample);
+			for(auto i = 0u; i < NN; i++){
+				for(auto k = 0u; k < num[i]; k++) particle_plot.push_back(particle[i]);
+			}
 		}
 	}
 
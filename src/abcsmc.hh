@@ -8,6 +8,8 @@
 #include "model.hh"
 #include "obsmodel.hh"
 
+#include <functional>
+
 class ABCSMC
 {
 public:	
@@ -24,6 +26,7 @@ private:
 	bool terminate(const Generation &gen) const;
 	void print_generation(const vector <Generation> &generation, const double acrate) const;
 	void implement_cutoff_frac(Generation &gen);
+	void generate_samples(Generation &gen, const function<void()> &round);
 	void store_sample(Generation &gen, const unsigned int g, const unsigned int run, const double w);
 	void print_model_evidence();
 	void results();
@@ -44,6 +47,8 @@ private:
 	double propsize;                         // The size of the MVN proposals
 	
 	vector <vector <double> > wsum;	         // Used to sample particles
+
+	ResampleType resample;                   // The scheme used to resample particles for output
 		
 	State state;                             // Stores the state of the system
 		
@@ -41,6 +41,8 @@ enum Dir { X,Y};                                       // Different directions a
 
 enum Timers { TIME_TOTAL, TIME_SELF, TIME_MBP, TIME_MBPINIT, TIME_TRANSNUM, TIME_UPDATEPOP, TIME_UPDATEIMAP, TIME_OBSMODEL, TIME_ALG, TIME_MCMCPROP, TIME_WAIT, TIME_GEN, TIME_FIXEDTREE, TIME_SLICETIME, TIME_MEANTIME, TIME_NEIGHBOUR, TIME_JOINT, TIME_COVAR_AREA, TIME_SIGMA, TIME_MVN, TIME_RESULTS, TIME_OBSPROB, TIME_PMCMCLIKE, TIME_BOOTSTRAP, TIME_SIMULATE, TIME_PMCMCSWAP, TIME_STATESAMPLE, TIME_SETPARAM, TIME_TRANSMEAN, TIME_INITFROMPART, TIME_SWAP, TIME_CREATEN, TIME_BETA_FROM_R, TIMERMAX};
 
+enum Counters { COUNT_RRATIO_HIT, COUNT_RRATIO_MISS, COUNTERMAX};   // Counts events reported with the timers
+
 enum GraphType { GRAPH_TIMESERIES, GRAPH_MARGINAL };
 	
 enum ParamType { DISTVAL_PARAM, BRANCHPROB_PARAM,               // Different types of parameters 
@@ -86,6 +88,8 @@ enum MbpSimType { ALL_MBP, FIXEDTREE, SLICETIME};                // Different MB
 								
 enum InfUpdate { INF_UPDATE, INF_DIF_UPDATE};                    // Different ways to update infectivity map								
 
+enum TensorOrder { TIME_MAJOR, AREA_MAJOR};                      // Whether the sett or area axis is outermost in a Tensor
+
 enum PriorType { FIXED_PRIOR, UNIFORM_PRIOR, EXP_PRIOR,          // Different types of prior
 								 NORMAL_PRIOR, DIRICHLET_PRIOR, DIRICHLET_ALPHA_PRIOR, DIRICHLET_FLAT_PRIOR,
 								 MDIRICHLET_PRIOR}; 
@@ -119,6 +123,9 @@ enum ModificationType { CF_TRANS_RATE, CF_EFOI,                  // DIfferent ty
 
 enum ParamUpdate { NO_UPDATE, SLOW_UPDATE, FAST_UPDATE};         // Whether to update parameters with MH
 
+enum ResampleType { MULTINOMIAL_RESAMPLE, SYSTEMATIC_RESAMPLE,   // Different schemes for resampling particles
+                    STRATIFIED_RESAMPLE, RESIDUAL_RESAMPLE};
+
 enum StateUncertainty{ CI, CURVES};                         // Determines how state uncertainty plotted
 
 const double fac_up_invT = 1.05, fac_down_invT = 0.9;            // These are used to dynamically change invT
@@ -143,6 +150,13 @@ const unsigned int initial_sample_try = 10000;                   // The number o
 const unsigned int spline_sample_try = 100000;                   // The number of tries to generate parameters before fail
 const unsigned int sample_try = 10000;                           // The number of tries to generate spline before fail
 const unsigned int initialise_param_samp = 100;                  // Number of random parameter samples to initialise param_samp
+const unsigned int ladder_adapt_period = 50;                      // The number of MC3 samples between adaptations of the temperature ladder
+const unsigned int particle_tune_pilot = 32;                     // The pilot number of particles used when tuning the number for PMCMC
+const unsigned int particle_tune_nrep = 20;                      // The number of likelihood estimates used to estimate the variance
+const unsigned int particle_tune_max = 100000;                   // The maximum number of particles selected by tuning
+
+const unsigned long R_ratio_cache_max = 4000000;                 // The maximum memory (in bytes) used by the NGM ratio cache
+const unsigned long R_ratio_cache_entry = 96;                    // The approximate memory overhead of each cache entry (bytes)
 
 const double map_ratio = 1.22;                                   // The ratio of the map (used when plotting
 
@@ -107,6 +107,15 @@ Details::Details(Inputs &inputs)
 	}
 	else obs_section = false;
 	
+	nthread = inputs.find_positive_integer("nthread",1);              // Threads used to split areas within each core
+	
+	auto warm = inputs.find_string("warm_particles","false");        // Determines if particles keep their derived state
+	if(warm == "true") warm_particles = true;
+	else{
+		if(warm != "false") emsgroot("'warm_particles' must be 'true' or 'false'");
+		warm_particles = false;
+	}
+	
 	inputs.find_mcmc_update(mcmc_update);
 }
 
@@ -41,6 +41,9 @@ struct Details                                                     // Provides d
 		
 	bool stochastic;                                                 // Determines if simulations are stochastic or not
 	
+	unsigned int nthread;                                            // The number of threads used on each core
+	bool warm_particles;                                             // Set if particles keep their derived state (pop, Imap, transmean)
+	
 	MCMCUpdate mcmc_update;                                          // Stores information about the mcmc updates
 	
 	bool obs_section;                                                // Set to true if observation are in sections (PMCMC)
@@ -1707,9 +1707,14 @@ void Inputs::find_nparticle(unsigned int &npart, unsigned int &Ntot, unsigned in
 
 
 /// Finds the number of particles
-void Inputs::find_nparticle_pmcmc(unsigned int &npart, unsigned int &N, const unsigned int ncore)
+void Inputs::find_nparticle_pmcmc(unsigned int &npart, unsigned int &N, const unsigned int ncore, bool &npart_tune)
 {
-	npart = find_positive_integer("nparticle",UNSET);          // Sets the total number of mcmc particles
+	npart_tune = false;
+	if(find_string("nparticle","") == "auto"){                 // The number of particles is tuned before the run
+		npart_tune = true;
+		npart = ncore*((particle_tune_pilot+ncore-1)/ncore);     // Pilot number of particles
+	}
+	else npart = find_positive_integer("nparticle",UNSET);     // Sets the total number of mcmc particles
 	if(npart == UNSET) emsgroot("'nparticle' must be set");
 
 	if(npart%ncore != 0) emsgroot("'nparticle' must be a multiple of the number of cores");
@@ -1883,6 +1888,23 @@ void Inputs::find_plot_param_values(bool &plot_param_values)
 	if(get_siminf() == SIMULATE) plot_param_values = true;
 }
 
+/// Finds the scheme used to resample particles
+void Inputs::find_resample(ResampleType &resample)
+{
+	auto resample_str = find_string("resample","multinomial");
+	if(resample_str == "multinomial") resample = MULTINOMIAL_RESAMPLE;
+	else{
+		if(resample_str == "systematic") resample = SYSTEMATIC_RESAMPLE;
+		else{
+			if(resample_str == "stratified") resample = STRATIFIED_RESAMPLE;
+			else{
+				if(resample_str == "residual") resample = RESIDUAL_RESAMPLE;
+				else emsgroot("'resample' must be 'multinomial', 'systematic', 'stratified' or 'residual'");
+			}
+		}
+	}
+}
+
 /// Finds any modifications made to the model
 void Inputs::find_modification(const Details &details, vector <Modification> &modification)
 {
@@ -53,7 +53,7 @@ class Inputs
 		void find_nrun(unsigned int &nrun);
 		void find_stateuncer(StateUncertainty &stateuncer);
 		void find_nparticle(unsigned int &npart, unsigned int &Ntot, unsigned int &N, const unsigned int nrun, const unsigned int ncore);
-		void find_nparticle_pmcmc(unsigned int &npart, unsigned int &N, const unsigned int ncore);
+		void find_nparticle_pmcmc(unsigned int &npart, unsigned int &N, const unsigned int ncore, bool &npart_tune);
 		void find_nchain(unsigned int &nchain, unsigned int &Ntot, unsigned int &N, const unsigned int nrun, const unsigned int ncore);
 		void find_nsample(unsigned int &nsample);
 		void find_GRmax_nupdate(double &GRmax, const unsigned int nrun, unsigned int &nupdate);
@@ -71,6 +71,7 @@ class Inputs
 		void find_modification(const Details &details, vector <Modification> &modification);
 		void find_mcmc_update(MCMCUpdate &mcmc_update);
 		void find_area_plot(AreaPlot &area_plot);
+		void find_resample(ResampleType &resample);
 		vector <vector <unsigned int > > find_demo_ref(const string dep_str, const vector <DemographicCategory> &democat, vector <unsigned int> &dep_order) const;
 		Mode mode();
 		SimInf get_siminf();
@@ -134,6 +135,10 @@ const vector<string> definedparams = {                                // A list
 		"invT_power",
 		"inputfile",
 		"level_effect",//
+		"loglike_var",
+		"mc3_ladder",
+		"mc3_swap",
+		"mc3_swap_scheme",
 		"mcmc_update",
 		"mode",
 		"modification",
@@ -148,12 +153,14 @@ const vector<string> definedparams = {                                // A list
 		"nsimulation",
 		"nsim_per_sample",
 		"nthin",
+		"nthread",
 		"nupdate",
 		"obs_spline",
 		"outputdir",
 		"output_prop",
 		"quench_factor",
 		"plot_param_values",
+		"pmcmc_correlation",
 		"propsize",
 		"prediction_end",
 		"prediction_start",
@@ -161,6 +168,7 @@ const vector<string> definedparams = {                                // A list
 		"prob_reach",
 		"prop_size",
 		"region_effect",
+		"resample",
 		"R_spline", 
 		"seed",
 		"start",
@@ -173,7 +181,8 @@ const vector<string> definedparams = {                                // A list
 		"time_format",
 		"time_labels",
 		"trans",//
-		"tv_covars"//
+		"tv_covars",//
+		"warm_particles"
 	};
 	
 #endif
@@ -0,0 +1,72 @@
+/// Implements the ancestral tree used to reconstruct particle trajectories
+
+using namespace std;
+
+#include "lineage.hh"
+#include "utils.hh"
+
+/// Initialises an empty tree for nsec sections (the particles pmin to pmin+N-1 are stored on this core)
+void LineageTree::initialise(const unsigned int nsec, const unsigned int Ntot_, const unsigned int pmin_, const unsigned int N_)
+{
+	Ntot = Ntot_; pmin = pmin_; N = N_;
+	
+	nchild.resize(nsec);
+	for(auto &nc : nchild) nc.assign(Ntot,0);
+	
+	code.resize(nsec);
+	for(auto &co : code){
+		co.resize(N);
+		for(auto &cod : co) vector <uint16_t> ().swap(cod);
+	}
+}
+
+
+/// Stores the transition numbers for time divisions ti to tf from local particle p in section sec
+/// The slabs are contiguous, so they are encoded together (the pieces from a lineage can simply be joined)
+void LineageTree::store(const unsigned int sec, const unsigned int p, const Tensor &transnum, const unsigned int ti, const unsigned int tf)
+{
+	if(p < pmin || p >= pmin+N || transnum.order() != TIME_MAJOR) emsgEC("Lineage",1);
+	
+	auto &cod = code[sec][p-pmin];
+	cod.clear();
+	auto nslab = size_t(transnum.size(1))*transnum.size(2)*transnum.size(3);
+	compact_encode(transnum[ti].p,(tf-ti)*nslab,cod);
+	cod.shrink_to_fit();
+}
+
+
+/// After resampling at the end of section sec, removes nodes which have no surviving descendants
+void LineageTree::prune(const unsigned int sec, const vector < vector <unsigned int> > &backpart)
+{
+	auto &nc = nchild[sec];
+	for(auto p = 0u; p < Ntot; p++) nc[p] = 0;
+	for(auto pp : backpart[sec+1]) nc[pp]++;
+	
+	for(auto p = 0u; p < Ntot; p++){
+		if(nc[p] == 0) remove(sec,p,backpart);
+	}
+}
+
+
+/// Removes a node, along with any ancestors left without surviving children 
+void LineageTree::remove(unsigned int sec, unsigned int p, const vector < vector <unsigned int> > &backpart)
+{
+	while(true){
+		if(p >= pmin && p < pmin+N) vector <uint16_t> ().swap(code[sec][p-pmin]);
+		if(sec == 0) return;
+		
+		p = backpart[sec][p]; sec--;
+		if(nchild[sec][p] == 0) emsgEC("Lineage",2);
+		nchild[sec][p]--;
+		if(nchild[sec][p] > 0) return;
+	}
+}
+
+
+/// The encoded transition numbers for local particle p in section sec
+const vector <uint16_t> &LineageTree::piece(const unsigned int sec, const unsigned int p) const
+{
+	if(p < pmin || p >= pmin+N) emsgEC("Lineage",3);
+	return code[sec][p-pmin];
+}
+
@@ -0,0 +1,34 @@
+/// Stores the ancestry of particles during particle filtering (PMCMC)
+/// Each particle keeps only the transition numbers for the current observation section. The pieces from earlier 
+/// sections are stored in a compact encoding in a tree, from which pieces with no surviving descendants are removed.
+
+#ifndef BEEPMBP__LINEAGE_HH
+#define BEEPMBP__LINEAGE_HH
+
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+#include "tensor.hh"
+
+class LineageTree
+{
+	public:
+		void initialise(const unsigned int nsec, const unsigned int Ntot_, const unsigned int pmin_, const unsigned int N_);
+		void store(const unsigned int sec, const unsigned int p, const Tensor &transnum, const unsigned int ti, const unsigned int tf);
+		void prune(const unsigned int sec, const vector < vector <unsigned int> > &backpart);
+		const vector <uint16_t> &piece(const unsigned int sec, const unsigned int p) const;
+		
+	private:
+		void remove(unsigned int sec, unsigned int p, const vector < vector <unsigned int> > &backpart);
+		
+		unsigned int Ntot;                                   // The total number of particles
+		unsigned int pmin;                                   // The first particle on this core
+		unsigned int N;                                      // The number of particles on this core
+		
+		vector < vector <unsigned int> > nchild;             // The number of surviving children of each node [sec][p]
+		vector < vector < vector <uint16_t> > > code;        // The encoded transition numbers for local nodes [sec][p-pmin]
+};
+
+#endif
@@ -23,7 +23,7 @@ OPTIONS: nparticle, ngeneration / cutoff_final, nupdate, GR_max, nrun
 
 PAIS inference:
 mpirun -n 20 ./beepmbp inputfile="examples/EX1.toml" mode="pais" nparticle=50 ngeneration=5 nrun=4
-OPTIONS: nparticle, ngeneration / invT_final, nupdate, GR_max, nrun
+OPTIONS: nparticle, ngeneration / invT_final, nupdate, GR_max, nrun, resample ("multinomial", "systematic", "stratified" or "residual")
 
 Simple ABC inference:
 mpirun -n 20 ./beepmbp inputfile="examples/EX1.toml" mode="abc" nsample=100 cutoff_frac=0.1 nrun=4
@@ -31,11 +31,11 @@ OPTIONS: nsample / GR_max, cutoff / cutoff_frac, nrun
 
 ABC-SMC inference:
 mpirun -n 20 ./beepmbp inputfile="examples/EX1.toml" mode="abcsmc" ngeneration=5 cutoff_frac=0.5 nsample=200 nrun=4
-OPTIONS: nsample / GR_max, ngeneration / cutoff_final, cutoff_frac, nrun
+OPTIONS: nsample / GR_max, ngeneration / cutoff_final, cutoff_frac, nrun, resample ("multinomial", "systematic", "stratified" or "residual")
 
 PMCMC inference:
 mpirun -n 20 ./beepmbp inputfile="examples/EX1.toml" mode="pmcmc" nparticle=20 nsample=200
-OPTIONS: nparticle, nsample / GR_max, invT, nburnin, nthin, nrun
+OPTIONS: nparticle (a number or "auto"), nsample / GR_max, invT, nburnin, nthin, nrun, loglike_var, resample ("multinomial", "systematic", "stratified" or "residual"), pmcmc_correlation (correlated pseudo-marginal, from 0 (off, the default) up to but not including 1)
 
 MCMC-MBP inference:
 mpirun -n 4 ./beepmbp inputfile="examples/EX1.toml" mode="mcmcmbp" invT=303 nsample=200 nrun=4
@@ -43,7 +43,10 @@ OPTIONS: nsample / GR_max, invT, nburnin, nthin, nrun
 
 MC3 inference:
 mpirun -n 20 ./beepmbp inputfile="examples/EX1.toml" mode="mc3" nchain=20 invT_final=303 nsample=200 nrun=4
-OPTIONS: nchain, nsample / GR_max, invT_start, invT_final, nburnin, nquench, nthin, nrun
+OPTIONS: nchain, nsample / GR_max, invT_start, invT_final, nburnin, nquench, nthin, nrun, mc3_swap ("state" or "temperature"), mc3_swap_scheme ("reversible" or "nonreversible"), mc3_ladder ("fixed" or "adaptive")
+
+All modes:
+OPTIONS: nthread (the number of threads used by each MPI process to split areas), warm_particles ("true" or "false" (default), whether stored particles keep their derived state)
 */
 
 #include <iostream>
@@ -67,6 +70,7 @@ OPTIONS: nchain, nsample / GR_max, invT_start, invT_final, nburnin, nquench, nth
 
 #include "utils.hh"
 #include "timers.hh"
+#include "thread_pool.hh"
 
 #include "simulate.hh"
 #include "abc.hh"
@@ -145,6 +149,10 @@ int main(int argc, char** argv)
 	default: sran(mpi.core*10000+seed+100); break;
 	}
 	
+	ran_stream_seed(seed);                                      // Addressed random streams are the same on all cores
+	
+	threadpool.initialise(details.nthread,mpi.core*10000+seed+1000);   // Starts any additional threads
+	
 	ObservationModel obsmodel(details,data,model);              // Creates an observation model
 
 	Output output(details,data,model,inputs,obsmodel,mpi);      // Creates an output class
@@ -228,7 +236,7 @@ int main(int argc, char** argv)
 			auto param = model.sample_from_prior();   
 			State state(details,data,model,obsmodel);
 			state.simulate(param);
-			particle_store.push_back(state.create_particle(0));
+			particle_store.push_back(state.create_particle(0,false));
 			output.generate_graphs(particle_store); 
 		}
 		break;
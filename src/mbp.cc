@@ -18,6 +18,8 @@ using namespace std;
 #include "details.hh"
 #include "mpi.hh"
 #include "obsmodel.hh"
+#include "thread_pool.hh"
+#include "rng.hh"
 
 /// Initialises mbp update
 Mbp::Mbp(ObsModelMode obsmodel_mode_, const Details &details, const Data &data, const Model &model, const ObservationModel &obsmodel, const Output &output, Mpi &mpi) : state1(details,data,model,obsmodel), state2(details,data,model,obsmodel), comp(model.comp), trans(model.trans), details(details), data(data), model(model), obsmodel(obsmodel), output(output), mpi(mpi)
@@ -26,6 +28,8 @@ Mbp::Mbp(ObsModelMode obsmodel_mode_, const Details &details, const Data &data,
 	
 	initial = &state1; propose = &state2;                  // Sets the initial and proposed states (these may be swapped)
 
+	nupdate = 0; step_ref = 0; run_ref = 0; particle_ref = mpi.core; // Used to address random number streams
+
 	initialise_variables();                                // Initialises the variables in the class
 }
 
@@ -39,7 +43,11 @@ unsigned int Mbp::mcmc_updates(vector <Particle> &part, const vector <ParamSampl
 
 	auto prop_list = paramprop.get_proposal_list(param_samp); 
 	
-	for(auto &pa : part) update_particle(pa,prop_list,paramprop);
+	nupdate++;                                             // Every core makes the same number of calls
+	for(auto p = 0u; p < part.size(); p++){
+		particle_ref = mpi.core*part.size()+p;
+		update_particle(part[p],prop_list,paramprop);
+	}
 
 	if(pup == NO_UPDATE) paramprop.update_proposals();
 
@@ -48,8 +56,10 @@ unsigned int Mbp::mcmc_updates(vector <Particle> &part, const vector <ParamSampl
 
 
 /// Updates a vector of particles using MBP proposals
-unsigned int Mbp::mc3_mcmc_updates(Particle &part, const vector <ParamSample> &param_samp, const double invT_, const ParamUpdate pup_, ParamProp &paramprop)
+unsigned int Mbp::mc3_mcmc_updates(Particle &part, const unsigned int chain_ref, const unsigned int samp, const vector <ParamSample> &param_samp, const double invT_, const ParamUpdate pup_, ParamProp &paramprop)
 {
+	particle_ref = chain_ref;
+	nupdate = samp;
 	EFcut = UNSET;
 	invT = invT_;
 	pup = pup_;
@@ -68,13 +78,22 @@ unsigned int Mbp::mc3_mcmc_updates(Particle &part, const vector <ParamSample> &p
 /// Updates a particle using various types of MBP (specified in a proposal list)
 void Mbp::update_particle(Particle &pa, const vector <Proposal> &prop_list, ParamProp &paramprop)
 {
-	initial->initialise_from_particle(pa);                           // Initialises mbp updates from a particle
+	run_ref = pa.run;
+	initial->adopt_particle(pa);                                     // Initialises mbp updates from a particle
+	nsame = 0;
+	switch(obsmodel_mode){
+		case INVT: initial->set_EF(); break;                           // Stores observations so EF can be updated from changes
+		case CUTOFF: set_prefix_cache(); break;                        // Stores the EF accumulated before each division
+	}
 
 	timer[TIME_MCMCPROP].start();
 	for(auto i = 0u; i < prop_list.size(); i++){
 		auto &prop = prop_list[i];
 		auto num = prop.num;
 		
+		step_ref = rng_key(nupdate,i,UNSET);                         // Random numbers are addressed by the update, proposal,
+		ran_stream_outer(step_ref,run_ref,particle_ref);             // run and global particle (not the core or thread)
+		
 		switch(prop.type){
 			case MVN_PROP:
 				{
@@ -117,8 +136,9 @@ void Mbp::update_particle(Particle &pa, const vector <Proposal> &prop_list, Para
 		
 		if(checkon == true) initial->check(2);
 	}
+	ran_stream_outer_end();
 	timer[TIME_MCMCPROP].stop();
-	pa = initial->create_particle(pa.run);                       // Places final state back into particle
+	initial->release_particle(pa);                               // Places final state back into particle
 }         
 
 
@@ -128,6 +148,37 @@ void Mbp::swap_initial_propose_state()
 	State* temp = initial;
 	initial = propose;
 	propose = temp;
+	
+	if(obsmodel_mode == CUTOFF){                                     // Divisions from sett_start_prop change the cache
+		for(auto sett = sett_start_prop+1; sett <= details.ndivision; sett++){
+			EF_before[sett] = EF_before_prop[sett];
+			if(sett < details.ndivision) obs_open_value[sett].swap(obs_open_value_prop[sett]);
+		}
+	}
+}
+
+
+/// Sets the EF accumulated before each time division in the initial state (along with the partial values 
+/// of observations which span divisions), so proposals in CUTOFF mode need not rescore unchanged divisions 
+void Mbp::set_prefix_cache()
+{
+	for(auto &val : obs_value) val = 0;
+	
+	auto EF = 0.0;
+	EF_before[0] = EF;
+	for(auto sett = 0u; sett < details.ndivision; sett++){
+		store_open_value(sett,obs_open_value[sett]);
+		EF += -2*obsmodel.calculate_sett(initial,obs_value,sett);
+		EF_before[sett+1] = EF;
+	}
+}
+
+
+/// Stores the values (accumulated in obs_value) of those observations which span the start of sett
+void Mbp::store_open_value(const unsigned int sett, vector <double> &open_value) const
+{
+	const auto &open = obsmodel.obs_open[sett];
+	for(auto j = 0u; j < open.size(); j++) open_value[j] = obs_value[open[j]];
 }
 
 
@@ -141,11 +192,32 @@ Status Mbp::mbp(const vector<double> &paramv, const InfUpdate inf_update)
 	timer[TIME_MBP].start();
 	
 	timer[TIME_MBPINIT].start();
-	mbp_initialise();                                           // Prepares for the proposal
+	auto sett_start = get_sett_start();                         // Divisions before this are identical to the initial state
+	mbp_initialise(sett_start);                                 // Prepares for the proposal
 	timer[TIME_MBPINIT].stop();
 
-	for(auto sett = 0u; sett < details.ndivision; sett++){      // Performs a pure MBPs or a combination of MBP and simulation
-		propose->democat_change_pop_adjust(sett);
+	auto EF = 0.0;                                              // In CUTOFF mode the error function is accumulated
+	switch(obsmodel_mode){
+		case CUTOFF:                                              // Divisions before sett_start are taken from the cache
+			sett_start_prop = sett_start;
+			EF = EF_before[sett_start];
+			if(sett_start < details.ndivision){
+				const auto &open = obsmodel.obs_open[sett_start];
+				for(auto j = 0u; j < open.size(); j++) obs_value[open[j]] = obs_open_value[sett_start][j];
+			}
+			if(sett_start > 0 && EF + obsmodel.EFmin_after[sett_start-1] >= EFcut){ timer[TIME_MBP].stop(); return FAIL;}
+			break;
+			
+		case INVT:                                                // In INVT mode observations are updated from differences 
+			propose->obs_value = initial->obs_value;
+			break;
+	}
+
+	for(auto sett = sett_start; sett < details.ndivision; sett++){ // Performs a pure MBPs or a combination of MBP and simulation
+		if(sett == 0) propose->democat_change_pop_adjust(sett);
+		else{
+			if(sett > sett_start) propose->democat_change_pop_adjust(sett,area_changed); // pop at sett_start is already adjusted
+		}
 	
 		switch(inf_update){                                       // Sets Imap  
 			case INF_UPDATE: propose->set_Imap_sett(sett); break;
@@ -153,73 +225,120 @@ Status Mbp::mbp(const vector<double> &paramv, const InfUpdate inf_update)
 		}
 	
 		timer[TIME_TRANSNUM].start();
-		double rate_i, rate_p;
-		int num_i, num_p=0;
-	
-		for(auto c = 0u; c < data.narea; c++){                    // Performs simulation / MBPs on the transitions
-			propose->set_transmean(sett,c);
-			
-			auto &init_tnum = initial->transnum[sett][c];
-			auto &prop_tnum = propose->transnum[sett][c];
-			auto &init_tmean = initial->transmean[sett][c];
-			auto &prop_tmean = propose->transmean[sett][c];
-			
-			auto sorm = simu_or_mbp[sett][c];
-			
-			for(auto tr = 0u; tr < model.trans.size(); tr++){
-				for(auto dp = 0u; dp < data.ndemocatpos; dp++){	 
-					num_i = init_tnum[tr][dp];
-					rate_p = prop_tmean[tr][dp];
-					if(rate_p == 0) num_p = 0;
-					else{
-						switch(sorm){
-							case SIMU:	
-								num_p = poisson_sample(rate_p);								
-								break;
-						
-							case MBP:
-								rate_i = init_tmean[tr][dp];	
-								if(rate_p > rate_i) num_p = num_i + poisson_sample(rate_p-rate_i);
-								else{
-									if(rate_p == rate_i) num_p = num_i;
-									else num_p = binomial_sample(rate_p/rate_i,num_i);
-								}
-								break;
-						}
-					}
-					
-					auto num_diff = num_p - num_i;
-					dtransnum[c][tr][dp] = num_diff;
-					prop_tnum[tr][dp] = num_p;			
-				}
-			}
-		}
+		threadpool.run(data.narea,[&](const unsigned int, const unsigned int c_start, const unsigned int c_end){
+			propose->set_transmean(sett,c_start,c_end);
+			for(auto c = c_start; c < c_end; c++) mbp_area(sett,c);  // Performs simulation / MBPs on the transitions
+		});
 		timer[TIME_TRANSNUM].stop();
+		
+		switch(obsmodel_mode){
+			case CUTOFF:                                            // Rejects as soon as EF is guaranteed to exceed EFcut
+				if(cutoff_exceeded(EF,sett) == true){ timer[TIME_MBP].stop(); return FAIL;}
+				EF_before_prop[sett+1] = EF;
+				if(sett+1 < details.ndivision) store_open_value(sett+1,obs_open_value_prop[sett+1]);
+				break;
+				
+			case INVT:
+				obsmodel.update_obs_value(propose,initial,sett,propose->obs_value,obs_changed,obs_flag);
+				break;
+		}
 			
 		if(sett < details.ndivision-1){
 			timer[TIME_UPDATEPOP].start();
-			propose->update_pop(sett);
+			propose->update_pop(sett,initial,dtransnum[0],area_changed);
 			timer[TIME_UPDATEPOP].stop();
 			
 			timer[TIME_UPDATEIMAP].start();
-			if(inf_update == INF_DIF_UPDATE) propose->update_I_from_transnum(dImap,dIdiag,dtransnum);
+			if(inf_update == INF_DIF_UPDATE) propose->update_I_from_transnum(dImap,dIdiag,dtransnum[0]);
 			timer[TIME_UPDATEIMAP].stop();
 		}
 	}
 	
+	switch(obsmodel_mode){
+		case CUTOFF: propose->EF = EF; break;
+		case INVT: set_EF_from_change(); break;
+	}
+	
 	timer[TIME_MBP].stop();
 
 	return SUCCESS;
 }
 
 
+/// Performs simulation / MBPs on the transitions within area c at time division sett (transmean must already be set)
+void Mbp::mbp_area(const unsigned int sett, const unsigned int c)
+{
+	ran_stream(step_ref,run_ref,particle_ref,sett,c);           // Random numbers do not depend on the core or thread
+	
+	auto init_tnum = initial->transnum[sett][c].p;              // The [tr][dp] blocks are contiguous
+	auto prop_tnum = propose->transnum[sett][c].p;
+	auto init_tmean = initial->transmean[sett][c].p;
+	auto prop_tmean = propose->transmean[sett][c].p;
+	auto dtnum = dtransnum[0][c].p;
+	
+	auto n = model.trans.size()*data.ndemocatpos;
+	
+	switch(simu_or_mbp[sett][c]){
+		case SIMU: poisson_sample_block(prop_tmean,prop_tnum,n); break;
+		case MBP: mbp_sample_block(init_tmean,prop_tmean,init_tnum,prop_tnum,n); break;
+	}
+	
+	for(auto i = 0u; i < n; i++) dtnum[i] = prop_tnum[i] - init_tnum[i];
+	
+	ran_stream_default();
+}
+
+
+/// Adds the observations at sett to the accumulated EF and determines if EFcut must be exceeded
+bool Mbp::cutoff_exceeded(double &EF, const unsigned int sett)
+{
+	EF += -2*obsmodel.calculate_sett(propose,obs_value,sett);
+	if(EF + obsmodel.EFmin_after[sett] >= EFcut) return true;
+	return false;
+}
+
+
+/// Sets EF for the proposed state by only recalculating those observations which have changed
+void Mbp::set_EF_from_change()
+{
+	timer[TIME_OBSPROB].start();
+	
+	propose->obs_EF = initial->obs_EF;
+	for(auto i : obs_changed){
+		propose->obs_EF[i] = obsmodel.obs_EF(i,propose->obs_value[i]);
+		obs_flag[i] = false;
+	}
+	obs_changed.clear();
+	
+	auto EF = 0.0; for(auto val : propose->obs_EF) EF += val;
+	if(std::isnan(EF)) emsgEC("Mbp",3);
+	propose->EF = EF;
+	
+	timer[TIME_OBSPROB].stop();
+}
+
+
+/// Finds the first time division at which the proposed state can differ from the initial state
+unsigned int Mbp::get_sett_start() const
+{
+	auto sett_start = propose->first_param_change(initial);
+	
+	for(auto sett = 0u; sett < sett_start; sett++){             // Simulated divisions also change the state
+		for(auto c = 0u; c < data.narea; c++){
+			if(simu_or_mbp[sett][c] == SIMU) return sett;
+		}
+	}
+	
+	return sett_start;
+}
+
+
 /// Gets the acceptance probability
 double Mbp::get_al()
 {
 	auto al = 0.0;
 	
-	propose->set_EF();
-	propose->set_Pr();
+	propose->set_Pr();                                          // Note, EF is calculated within mbp()
 		
 	switch(obsmodel_mode){
 		case CUTOFF: 
@@ -245,14 +364,19 @@ double Mbp::get_al()
 /// Initialises the variables within Mbp
 void Mbp::initialise_variables()
 {
-	dtransnum.resize(data.narea);
-	for(auto c = 0u; c < data.narea; c++){
-		dtransnum[c].resize(model.trans.size());
-		for(auto tr = 0u; tr < model.trans.size(); tr++){
-			dtransnum[c][tr].resize(data.ndemocatpos);
-			for(auto dp = 0u; dp < data.ndemocatpos; dp++) dtransnum[c][tr][dp] = 0;
-		}				
+	dtransnum.resize(1,data.narea,model.trans.size(),data.ndemocatpos);
+	area_changed.resize(data.narea);
+	
+	obs_value.resize(data.nobs);
+	
+	EF_before.resize(details.ndivision+1); EF_before_prop.resize(details.ndivision+1);
+	obs_open_value.resize(details.ndivision); obs_open_value_prop.resize(details.ndivision);
+	for(auto sett = 0u; sett < details.ndivision; sett++){
+		obs_open_value[sett].resize(obsmodel.obs_open[sett].size());
+		obs_open_value_prop[sett].resize(obsmodel.obs_open[sett].size());
 	}
+	nsame = 0; sett_start_prop = 0;
+	obs_flag.resize(data.nobs,false);
 	
 	simu_or_mbp.resize(details.ndivision);
 	for(auto sett = 0u; sett < details.ndivision; sett++) simu_or_mbp[sett].resize(data.narea);
@@ -291,8 +415,8 @@ void Mbp::simu_or_mbp_reset()
 }
 
 
-/// Clears variables ready for a MBP
-void Mbp::mbp_initialise()
+/// Clears variables ready for a MBP (which starts at time division sett_start)
+void Mbp::mbp_initialise(const unsigned int sett_start)
 {
 	for(auto st = 0u; st < data.nstrain; st++){	
 		for(auto v = 0u; v < data.narage; v++){
@@ -301,7 +425,15 @@ void Mbp::mbp_initialise()
 		} 
 	}
 
-	propose->pop_init();
+	if(obsmodel_mode == CUTOFF){
+		for(auto &val : obs_value) val = 0;
+	}
+	
+	if(sett_start == 0) propose->pop_init();
+	else propose->copy_start(initial,nsame,sett_start);          // Only copies divisions which may differ
+	nsame = sett_start;
+	
+	for(auto c = 0u; c < data.narea; c++) area_changed[c] = false;
 }	
 
 
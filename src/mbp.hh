@@ -18,15 +18,21 @@ class Mbp
 		Mbp(ObsModelMode obsmodel_mode_, const Details &details, const Data &data, const Model &model, const ObservationModel &obsmodel, const Output &output, Mpi &mpi);
 		
 		unsigned int mcmc_updates(vector <Particle> &part, const vector <ParamSample> &param_samp, double EFcut_, double invT_,ParamUpdate pup_, ParamProp &paramprop);
-		unsigned int mc3_mcmc_updates(Particle &part, const vector <ParamSample> &param_samp, const double invT_, const ParamUpdate pup_, ParamProp &paramprop);
+		unsigned int mc3_mcmc_updates(Particle &part, const unsigned int chain_ref, const unsigned int samp, const vector <ParamSample> &param_samp, const double invT_, const ParamUpdate pup_, ParamProp &paramprop);
 	
 	private:
 		Status mbp(const vector<double> &paramv, const InfUpdate inf_update);	
+		void mbp_area(const unsigned int sett, const unsigned int c);
 		double get_al();
 		void initialise_variables();
 		void simu_or_mbp_reset();
 		void swap_initial_propose_state();
-		void mbp_initialise();
+		void mbp_initialise(const unsigned int sett_start);
+		unsigned int get_sett_start() const;
+		bool cutoff_exceeded(double &EF, const unsigned int sett);
+		void set_prefix_cache();
+		void store_open_value(const unsigned int sett, vector <double> &open_value) const;
+		void set_EF_from_change();
 		void update_particle(Particle &pa, const vector <Proposal> &prop_list, ParamProp &paramprop);
 		
 		void mvn_proposal(MVN &mvn);
@@ -47,6 +53,11 @@ class Mbp
 		
 		ParamUpdate pup;                                                // Determines how parameters are updated
 		
+		unsigned long nupdate;                                          // Counts updates (the same on all cores, used to address random streams)
+		unsigned long step_ref;                                         // Addresses the random streams for the current proposal
+		unsigned int run_ref;                                           // The run of the particle being updated
+		unsigned int particle_ref;                                      // The global number of the particle (or chain) being updated
+		
 		State state1, state2;                                           // Stores states and swaps references
 		State *initial, *propose;                                       // The states in the initial and proposed states
 
@@ -55,7 +66,18 @@ class Mbp
 		vector < vector <double> > dImap;                               // The difference in Imap between the two states
 		vector < vector <double> > dIdiag;                          		// The difference in Idiag between the two states
 		
-		vector < vector < vector <double> > > dtransnum;                // The difference in transnum between state (POP_MODEL)
+		Tensor dtransnum;                                               // The difference in transnum between state [0][area][tr][dp]
+		
+		vector <bool> area_changed;                                     // Flags areas where the proposed population differs from the initial
+		
+		vector <double> obs_value;                                      // Accumulates observed quantities during a MBP (CUTOFF mode)
+		
+		unsigned int nsame;                                             // The number of initial divisions in which propose equals initial
+		unsigned int sett_start_prop;                                   // The division at which the last proposal started
+		vector <double> EF_before, EF_before_prop;                      // The EF accumulated before each division (initial / proposed)
+		vector < vector <double> > obs_open_value, obs_open_value_prop; // Values of the observations spanning the start of each division
+		vector <unsigned int> obs_changed;                              // Lists observations altered by a MBP (INVT mode)
+		vector <bool> obs_flag;                                         // Flags if an observation is in obs_changed
 		
 		vector < vector <Simu_or_mbp> > mbp_sim;                        // Used in fixedtree to determine which areas are simulated 
 		
@@ -21,10 +21,33 @@ MC3::MC3(const Details &details, const Data &data, const Model &model, Inputs &i
 		case MC3_INF:
 			inputs.find_nchain(nchain,Ntot,N,nrun,mpi.ncore);
 			inputs.find_invT_start_invT_final(invT_start,invT_final);
+			{
+				auto swap = inputs.find_string("mc3_swap","state");
+				if(swap == "temperature") temperature_swap = true;
+				else{
+					if(swap != "state") emsgroot("'mc3_swap' must be 'state' or 'temperature'");
+					temperature_swap = false;
+				}
+				
+				auto scheme = inputs.find_string("mc3_swap_scheme","reversible");
+				if(scheme == "nonreversible") nonreversible = true;
+				else{
+					if(scheme != "reversible") emsgroot("'mc3_swap_scheme' must be 'reversible' or 'nonreversible'");
+					nonreversible = false;
+				}
+				
+				auto lad = inputs.find_string("mc3_ladder","fixed");
+				if(lad == "adaptive") ladder_adapt = true;
+				else{
+					if(lad != "fixed") emsgroot("'mc3_ladder' must be 'fixed' or 'adaptive'");
+					ladder_adapt = false;
+				}
+			}
 			break;
 		case MCMC_MBP:
 			nchain = 1; Ntot = nrun; if(Ntot%mpi.ncore != 0) emsgroot("'nrun' must be a multiple of the number of cores");
 			N = Ntot/mpi.ncore;
+			temperature_swap = false; nonreversible = false; ladder_adapt = false;
 			invT_start = UNSET;
 			inputs.find_invT(invT_final);
 			break;
@@ -44,7 +67,8 @@ void MC3::run()
 {
 	initialise();
 	
-	ofstream trace[N]; for(auto ch = 0u; ch < N; ch++) output.trace_plot_inititialise(chain[ch].name,trace[ch]);
+	vector <ofstream> trace;
+	trace_initialise(trace);
 
 	timer[TIME_ALG].start();
 	auto samp = 0u;
@@ -54,14 +78,14 @@ void MC3::run()
 		set_invT(samp);                                         // Sets the inverce temperatures for the chains
 																					
 		for(auto ch = 0u; ch < N; ch++){                        // MBP-MCMC updates	on chains		                      
-			chain[ch].nproposal = mbp.mc3_mcmc_updates(part[ch],chain[ch].param_samp,chain[ch].invT,pup,paramprop[ch]);	
+			chain[ch].nproposal = mbp.mc3_mcmc_updates(part[ch],mpi.core*N+ch,samp,chain[ch].param_samp,chain[ch].invT,pup,paramprop[ch]);	
 			
 			store_param_samp(ch);                                 // Stores the parameter sample
-		
-			output.trace_plot(samp,part[ch].EF,part[ch].paramval,trace[ch]);  // Outputs trace plot
 		}
 		
-		swap_states();                                          // Swaps between neighbouring chains
+		trace_output(samp,trace);                               // Outputs trace plots
+		
+		swap_chains(samp);                                      // Swaps between neighbouring chains
 			
 		if(burnin == false && samp%thin == 0) store_sample();   // Stores samples for plotting later
 		samp++;
@@ -78,6 +102,8 @@ void MC3::run()
 /// Initialises each of the chains
 void MC3::initialise()
 {
+	initialise_ladder();
+	
 	for(auto ch = 0u; ch < N; ch++){
 		auto param = model.sample_from_prior();                 // Samples parameters from the prior
 
@@ -92,15 +118,7 @@ void MC3::initialise()
 		auto num = n%nchain;
 		part.push_back(state.create_particle(run));             // Converts the initial state into a particle  
 		
-		string name;
-		if(num == 0){ // These are posterior chains
-			name = "Trace"; if(nrun > 1) name += "_Run"+to_string(run+1);
-		}
-		else{ 
-			name = "Other Chains/Trace"+to_string(num+1); if(nrun > 1) name += "_Run"+to_string(run+1);
-		}
-		
-		chain.push_back(Chain(name,num));                       // Creates the different chains
+		chain.push_back(Chain(chain_name(run,num),num));         // Creates the different chains
 		paramprop.push_back(ParamProp(details,data,model,output,mpi));
 	}
 	
@@ -113,6 +131,66 @@ void MC3::initialise()
 	}
 }
 
+
+/// The name of a chain (this is used for the trace plot)
+string MC3::chain_name(const unsigned int run, const unsigned int num) const
+{
+	string name;
+	if(num == 0){ // These are posterior chains
+		name = "Trace"; if(nrun > 1) name += "_Run"+to_string(run+1);
+	}
+	else{ 
+		name = "Other Chains/Trace"+to_string(num+1); if(nrun > 1) name += "_Run"+to_string(run+1);
+	}
+	return name;
+}
+
+
+/// Opens the files for the trace plots
+/// When swapping temperatures the chain at a given temperature moves between cores, so core 0 writes all the files
+void MC3::trace_initialise(vector <ofstream> &trace) const
+{
+	if(temperature_swap == false){
+		trace.resize(N);
+		for(auto ch = 0u; ch < N; ch++) output.trace_plot_inititialise(chain[ch].name,trace[ch]);
+	}
+	else{
+		if(mpi.core == 0){
+			trace.resize(Ntot);
+			for(auto i = 0u; i < Ntot; i++) output.trace_plot_inititialise(chain_name(i/nchain,i%nchain),trace[i]);
+		}
+	}
+}
+
+
+/// Outputs the current state of the chains to the trace plots
+void MC3::trace_output(const unsigned int samp, vector <ofstream> &trace) const
+{
+	if(temperature_swap == false){
+		for(auto ch = 0u; ch < N; ch++) output.trace_plot(samp,part[ch].EF,part[ch].paramval,trace[ch]);
+	}
+	else{
+		auto nparam = model.param.size();
+		
+		vector <double> vec;                                    // The chain number, EF and parameter values
+		for(auto ch = 0u; ch < N; ch++){
+			vec.push_back(chain[ch].num);
+			vec.push_back(part[ch].EF);
+			for(auto val : part[ch].paramval) vec.push_back(val);
+		}
+		auto vec_tot = mpi.gather(vec);
+		
+		if(mpi.core == 0){
+			for(auto i = 0u; i < Ntot; i++){
+				auto st = vec_tot.begin()+i*(2+nparam);
+				auto num = (unsigned int)(st[0]);
+				vector <double> paramval(st+2,st+2+nparam);
+				output.trace_plot(samp,st[1],paramval,trace[(i/nchain)*nchain+num]);
+			}
+		}
+	}
+}
+
 	
 /// Updates the burnin procedure
 void MC3::update_burnin(const unsigned int samp)
@@ -126,8 +204,18 @@ void MC3::update_burnin(const unsigned int samp)
 }
  
 
+/// Swaps between neighbouring chains and adapts the temperature ladder
+void MC3::swap_chains(const unsigned int samp)
+{
+	if(temperature_swap == true) swap_temperatures(samp);
+	else swap_states(samp);
+	
+	if(ladder_adapt == true && burnin == true && samp >= nquench && (samp+1)%ladder_adapt_period == 0) adapt_ladder();
+}
+
+
 /// Swaps state between neighbouring chains 
-void MC3::swap_states()
+void MC3::swap_states(const unsigned int samp)
 {
 	if(nchain == 1) return; 
 		
@@ -152,19 +240,11 @@ void MC3::swap_states()
 	auto nac_tot = mpi.gather(nac);
 	
 	if(mpi.core == 0){
-		for(auto loop = 0u; loop < 5; loop++){
-			for(auto i = 0u; i < Ntot-1; i++){
-				if(run_tot[i] == run_tot[i+1]){
-					auto al = exp(0.5*(invT_tot[i]-invT_tot[i+1])*(EF_tot[i]-EF_tot[i+1]));
-					ntr_tot[i]++;
-					if(ran() < al){
-						nac_tot[i]++;
-						auto temp = order_tot[i]; order_tot[i] = order_tot[i+1]; order_tot[i+1] = temp;
-						auto tempf = EF_tot[i]; EF_tot[i] = EF_tot[i+1]; EF_tot[i+1] = tempf;
-					}
-				}
-			}
-		}
+		swap_sweep(samp,invT_tot,EF_tot,order_tot,ntr_tot,nac_tot);
+		
+		auto walker_st = walker;                                // States move with the particles
+		for(auto i = 0u; i < Ntot; i++) walker[i] = walker_st[order_tot[i]];
+		update_round_trip(samp);
 		
 		if(false){
 			for(auto i = 0u; i < Ntot; i++){
@@ -194,6 +274,203 @@ void MC3::swap_states()
 }
 
 
+/// Swaps inverse temperatures between neighbouring chains (the states stay where they are)
+/// Along with the temperature go the chain number, the swap acceptance statistics and the proposal sizes,
+/// so only a few numbers per chain are exchanged. Proposal covariances (from param_samp) stay with the state.
+void MC3::swap_temperatures(const unsigned int samp)
+{
+	if(nchain == 1) return; 
+		
+	timer[TIME_SWAP].start();
+	vector <unsigned int> num, ntr, nac;
+	vector <double> invT, EF, sizes; 
+	
+	for(auto ch = 0u; ch < N; ch++){
+		num.push_back(chain[ch].num);
+		invT.push_back(chain[ch].invT);
+		EF.push_back(part[ch].EF);	
+		ntr.push_back(chain[ch].ntr);
+		nac.push_back(chain[ch].nac);
+		for(auto si : paramprop[ch].get_sizes()) sizes.push_back(si);
+	}
+	auto nsize = sizes.size()/N;
+	
+	auto num_tot = mpi.gather(num);
+	auto invT_tot = mpi.gather(invT);
+	auto EF_tot = mpi.gather(EF);
+	auto ntr_tot = mpi.gather(ntr);
+	auto nac_tot = mpi.gather(nac);
+	auto sizes_tot = mpi.gather(sizes);
+	
+	if(mpi.core == 0){
+		vector <unsigned int> slot(Ntot);                       // The chain (slot) at each temperature [run*nchain+num]
+		for(auto i = 0u; i < Ntot; i++) slot[(i/nchain)*nchain+num_tot[i]] = i;
+		auto slot_st = slot;
+		
+		vector <double> invT_rung(Ntot), EF_rung(Ntot);         // These quantities are ordered by temperature 
+		vector <unsigned int> ntr_rung(Ntot), nac_rung(Ntot);
+		for(auto k = 0u; k < Ntot; k++){
+			auto i = slot[k]; 
+			invT_rung[k] = invT_tot[i]; EF_rung[k] = EF_tot[i]; ntr_rung[k] = ntr_tot[i]; nac_rung[k] = nac_tot[i];
+		}
+		
+		swap_sweep(samp,invT_rung,EF_rung,slot,ntr_rung,nac_rung);
+		
+		walker = slot;                                          // States stay in their slots
+		update_round_trip(samp);
+		
+		auto sizes_st = sizes_tot;
+		for(auto k = 0u; k < Ntot; k++){
+			auto i = slot[k], i_st = slot_st[k];
+			num_tot[i] = k%nchain; invT_tot[i] = invT_rung[k]; ntr_tot[i] = ntr_rung[k]; nac_tot[i] = nac_rung[k];
+			for(auto j = 0u; j < nsize; j++) sizes_tot[i*nsize+j] = sizes_st[i_st*nsize+j];
+		}
+	}
+	
+	num = mpi.scatter(num_tot);
+	invT = mpi.scatter(invT_tot);
+	ntr = mpi.scatter(ntr_tot);
+	nac = mpi.scatter(nac_tot);
+	sizes = mpi.scatter(sizes_tot);
+	
+	for(auto ch = 0u; ch < N; ch++){
+		chain[ch].num = num[ch];
+		chain[ch].invT = invT[ch];
+		chain[ch].ntr = ntr[ch];
+		chain[ch].nac = nac[ch];
+		paramprop[ch].set_sizes(vector <double> (sizes.begin()+ch*nsize,sizes.begin()+(ch+1)*nsize));
+	}
+	
+	timer[TIME_SWAP].stop();
+}
+
+
+/// Performs swaps between neighbouring temperatures (on core 0)
+/// Quantities are ordered by temperature [run*nchain+num]. EF_rung and perm (which records where states come from)
+/// are swapped, and ntr_rung/nac_rung give the swap statistics for the pair with the next highest chain number.
+/// Reversible swaps do five sweeps over all pairs. Non-reversible swaps try even pairs on even samples and odd 
+/// pairs on odd samples (a deterministic even-odd scheme), so states travel along the ladder with momentum.
+void MC3::swap_sweep(const unsigned int samp, const vector <double> &invT_rung, vector <double> &EF_rung, vector <unsigned int> &perm, vector <unsigned int> &ntr_rung, vector <unsigned int> &nac_rung)
+{
+	auto nloop = 5u; if(nonreversible == true) nloop = 1;
+	
+	for(auto loop = 0u; loop < nloop; loop++){
+		for(auto k = 0u; k < Ntot-1; k++){
+			auto num = k%nchain;
+			if(num == nchain-1) continue;                         // The next chain is in a different run
+			if(nonreversible == true && num%2 != samp%2) continue;
+			
+			auto al = exp(0.5*(invT_rung[k]-invT_rung[k+1])*(EF_rung[k]-EF_rung[k+1]));
+			ntr_rung[k]++; ladder_ntr[num]++;
+			if(ran() < al){
+				nac_rung[k]++; ladder_nac[num]++;
+				auto temp = perm[k]; perm[k] = perm[k+1]; perm[k+1] = temp;
+				auto tempf = EF_rung[k]; EF_rung[k] = EF_rung[k+1]; EF_rung[k+1] = tempf;
+			}
+		}
+	}
+}
+
+
+/// Updates round trip information once the states have been swapped (on core 0)
+/// A round trip is completed when a state goes from the posterior chain to the prior chain and back again
+void MC3::update_round_trip(const unsigned int samp)
+{
+	if(burnin == true) return;
+	
+	for(auto k = 0u; k < Ntot; k++){
+		auto &rt = round_trip[walker[k]];
+		auto num = k%nchain;
+		if(num == 0){
+			if(rt.last == RT_PRIOR){ rt.ntrip++; rt.time_sum += samp-rt.t_start;}
+			if(rt.last != RT_POST){ rt.last = RT_POST; rt.t_start = samp;}
+		}
+		if(num == nchain-1 && rt.last == RT_POST) rt.last = RT_PRIOR;
+	}
+}
+
+
+/// Sets the initial temperature ladder (based on a power law)
+void MC3::initialise_ladder()
+{
+	ladder.resize(nchain);
+	if(nchain == 1) ladder[0] = invT_final;
+	else{
+		auto pmax = 1-pow(invT_start,1.0/Tpower);
+		auto pmin = 1-pow(invT_final,1.0/Tpower);
+		for(auto num = 0u; num < nchain; num++){
+			auto kappa = double(num)/(nchain-1);
+			ladder[num] = pow(1-(pmin+kappa*(pmax-pmin)),Tpower);
+		}
+	}
+	
+	ladder_ntr.resize(nchain); ladder_nac.resize(nchain);
+	for(auto num = 0u; num < nchain; num++){ ladder_ntr[num] = 0; ladder_nac[num] = 0;}
+	
+	walker.resize(Ntot); round_trip.resize(Ntot);
+	for(auto i = 0u; i < Ntot; i++){
+		walker[i] = i;
+		auto &rt = round_trip[i]; rt.last = RT_NONE; rt.t_start = 0; rt.ntrip = 0; rt.time_sum = 0;
+	}
+}
+
+
+/// Adapts the temperature ladder such that the swap rejection rates are equal for all pairs
+/// The cumulative rejection rate Lambda (the "communication barrier") is calculated as a function of the ladder 
+/// and the inverse temperatures are placed at equal spacings in Lambda (the end temperatures remain fixed)
+void MC3::adapt_ladder()
+{
+	if(nchain > 2 && mpi.core == 0){
+		auto fl = false;
+		vector <double> Lambda(nchain);
+		Lambda[0] = 0;
+		for(auto num = 0u; num < nchain-1; num++){
+			if(ladder_ntr[num] == 0) fl = true;
+			else Lambda[num+1] = Lambda[num] + 1-double(ladder_nac[num])/ladder_ntr[num];
+		}
+		
+		auto Lambda_tot = Lambda[nchain-1];
+		if(fl == false && Lambda_tot > TINY){
+			auto ladder_st = ladder;
+			auto k = 0u;
+			for(auto num = 1u; num < nchain-1; num++){
+				auto L = Lambda_tot*num/(nchain-1);
+				while(k < nchain-2 && Lambda[k+1] < L) k++;
+				auto dL = Lambda[k+1]-Lambda[k];
+				if(dL > 0) ladder[num] = ladder_st[k] + (ladder_st[k+1]-ladder_st[k])*(L-Lambda[k])/dL;
+				else ladder[num] = ladder_st[k];
+			}
+		}
+	}
+	mpi.bcast(ladder);
+	
+	for(auto num = 0u; num < nchain; num++){ ladder_ntr[num] = 0; ladder_nac[num] = 0;}
+}
+
+
+/// Outputs information about round trips (the rate at which states travel between the posterior and prior)
+string MC3::round_trip_diagnostics() const
+{
+	stringstream ss;
+	ss << "Round trips between the posterior chain and prior chain (after burnin):" << endl;
+	for(auto ru = 0u; ru < nrun; ru++){
+		if(nrun > 1) ss << "Run " << ru+1 << ":" << endl; 
+		auto ntrip = 0u; auto time_sum = 0.0;
+		for(auto ch = 0u; ch < nchain; ch++){
+			const auto &rt = round_trip[ru*nchain+ch];
+			ss << "State " << ch+1 << "   Round trips: " << rt.ntrip;
+			if(rt.ntrip > 0) ss << "   Mean round trip time: " << rt.time_sum/rt.ntrip << " samples";
+			ss << endl;
+			ntrip += rt.ntrip; time_sum += rt.time_sum;
+		}
+		ss << "Total round trips: " << ntrip;
+		if(ntrip > 0) ss << "   Mean round trip time: " << time_sum/ntrip << " samples";
+		ss << endl << endl;
+	}
+	return ss.str();
+}
+
+
 /// Stores particle samples to be plotted later
 void MC3::store_sample()
 {
@@ -207,7 +484,10 @@ void MC3::store_sample()
 void MC3::store_param_samp(unsigned int ch)
 {
 	if(burnin == true) chain[ch].param_samp.push_back(part[ch].create_param_samp());
-	else chain[ch].EF_samp.push_back(part[ch].EF);
+	else{
+		chain[ch].EF_samp.push_back(part[ch].EF);
+		chain[ch].EF_samp_num.push_back(chain[ch].num);
+	}
 }		
 
 
@@ -263,18 +543,27 @@ void MC3::diagnostics()
 	}	
 	
 	if(nchain > 1){
-		vector <unsigned int> ntr, nac;
+		vector <unsigned int> num, ntr, nac;
 		vector <double> invT;
 		for(auto ch = 0u; ch < N; ch++){
+			num.push_back(chain[ch].num);
 			ntr.push_back(chain[ch].ntr);
 			nac.push_back(chain[ch].nac);
 			invT.push_back(chain[ch].invT);
 		}
-		auto ntr_tot = mpi.gather(ntr);
-		auto nac_tot = mpi.gather(nac);
-		auto invT_tot = mpi.gather(invT);
+		auto num_st = mpi.gather(num);
+		auto ntr_st = mpi.gather(ntr);
+		auto nac_st = mpi.gather(nac);
+		auto invT_st = mpi.gather(invT);
 			
 		if(mpi.core == 0){
+			vector <unsigned int> ntr_tot(Ntot), nac_tot(Ntot);   // Orders by temperature (chains may have swapped these)
+			vector <double> invT_tot(Ntot);
+			for(auto i = 0u; i < Ntot; i++){
+				auto k = (i/nchain)*nchain + num_st[i];
+				ntr_tot[k] = ntr_st[i]; nac_tot[k] = nac_st[i]; invT_tot[k] = invT_st[i];
+			}
+			
 			string filefull = details.output_directory+"/Diagnostics/Chain_Swap.txt";
 			ofstream dia(filefull);
 			if(!dia) emsg("Cannot open the file '"+filefull+"'");
@@ -312,6 +601,14 @@ void MC3::diagnostics()
 				if(ch == nchain-1) dia << "             <<<< Prior >>>>";
 				dia << endl;
 			}
+			if(ladder_adapt == true) dia << "(the ladder was adapted during burnin to equalise swap acceptance)" << endl;
+			dia << endl;
+			
+			if(nonreversible == true) dia << "Swaps use a non-reversible even-odd scheme." << endl;
+			else dia << "Swaps use a reversible scheme." << endl;
+			dia << endl;
+			
+			dia << round_trip_diagnostics();
 		
 			cout << "Chain swapping diagnostics can be found in 'Diagnostics/Chain_Swap.txt'" << endl;
 			cout << ss.str();
@@ -320,27 +617,13 @@ void MC3::diagnostics()
 }
 
 
-/// Sets the inverse temperature of the chain
+/// Sets the inverse temperature of the chain (from the ladder, reduced during quenching)
 void MC3::set_invT(const unsigned int samp)
 {
-	auto pmax = 1-pow(invT_start,1.0/Tpower);
-	auto pmin = 1-pow(invT_final,1.0/Tpower);
+	auto fac = 1.0; if(samp < nquench) fac = double(samp)/nquench;
+	auto qfac = pow(fac,Tpower);
 	
-	for(auto ch = 0u; ch < N; ch++){
-		auto num = chain[ch].num;
-		
-		auto fac = 1.0; if(samp < nquench) fac = double(samp)/nquench;
-	
-		if(nchain == 1){
-			chain[ch].invT = invT_final*pow(fac,Tpower);
-		}
-		else{
-			auto kappa = double(num)/(nchain-1);
-			auto ppf = pmin+kappa*(pmax-pmin);
-			auto ppeff = 1-fac*(1-ppf);	
-			chain[ch].invT = pow(1-ppeff,Tpower);
-		}
-	}
+	for(auto ch = 0u; ch < N; ch++) chain[ch].invT = qfac*ladder[chain[ch].num];
 	
 	if(false){
 		for(auto ch = 0u; ch < N; ch++){
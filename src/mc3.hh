@@ -1,6 +1,8 @@
 #ifndef BEEPMBP__MC3_HH
 #define BEEPMBP__MC3_HH
 
+#include <fstream>
+
 #include "struct.hh"
 #include "mbp.hh"
 #include "param_prop.hh"
@@ -15,7 +17,17 @@ public:
 private:
 	void initialise();
 	void update_burnin(const unsigned int samp);
-	void swap_states();
+	void swap_chains(const unsigned int samp);
+	void swap_states(const unsigned int samp);
+	void swap_temperatures(const unsigned int samp);
+	void swap_sweep(const unsigned int samp, const vector <double> &invT_rung, vector <double> &EF_rung, vector <unsigned int> &perm, vector <unsigned int> &ntr_rung, vector <unsigned int> &nac_rung);
+	void update_round_trip(const unsigned int samp);
+	void adapt_ladder();
+	void initialise_ladder();
+	string round_trip_diagnostics() const;
+	string chain_name(const unsigned int run, const unsigned int num) const;
+	void trace_initialise(vector <ofstream> &trace) const;
+	void trace_output(const unsigned int samp, vector <ofstream> &trace) const;
 	void store_param_samp(const unsigned int ch);
 	void store_sample();
 	void diagnostics();
@@ -31,6 +43,21 @@ private:
 	unsigned int nquench;                    // The number of steps over which quenching is performed
 	
 	double Tpower;                           // The power used to specify the inverse temperature of chains
+	
+	bool temperature_swap;                   // Set if chains swap inverse temperatures rather than states
+	
+	bool nonreversible;                      // Set if swaps alternate between even and odd pairs (non-reversible)
+	
+	bool ladder_adapt;                       // Set if the temperature ladder is adapted during burnin
+	
+	vector <double> ladder;                  // The inverse temperature of each chain number (before quenching)
+	
+	vector <unsigned int> ladder_ntr;        // Swaps tried and accepted for each pair since the ladder was last adapted
+	vector <unsigned int> ladder_nac;        // (pooled over runs, on core 0)
+	
+	vector <unsigned int> walker;            // The state (labelled by its initial position) at each position (on core 0)
+	
+	vector <RoundTrip> round_trip;           // Round trip information for each state (on core 0)
 	 
 	double invT_start;                       // The inverse temperature of the lowest invT (by default zero)
 	
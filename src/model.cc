@@ -5,16 +5,21 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <cstring>
+#include <cstdint>
  
 #include "math.h"
 
 using namespace std;
 
 #include "model.hh"
+#include "thread_pool.hh"
 
 /// Initialises the model 
 Model::Model(Inputs &inputs, const Details &details, Data &data, Mpi &mpi) : details(details), data(data), inputs(inputs), mpi(mpi)
 {
+	R_ratio_cache_size = 0;
+	
 	load_model();
 
 	complete_datatables();
@@ -25,6 +30,10 @@ Model::Model(Inputs &inputs, const Details &details, Data &data, Mpi &mpi) : det
 	
 	set_parameter_type();
 	
+	set_param_derived();
+	
+	set_M_csr();
+	
 	if(false) print_parameter_types();
 }
 
@@ -516,6 +525,71 @@ void Model::set_parameter_type()
 }
 
 
+/// Determines which derived quantities depend on each of the parameters
+/// (this allows State::set_param to only recalculate those quantities which change)
+void Model::set_param_derived()
+{
+	param_derived.resize(param.size());
+	for(auto &pd : param_derived){
+		pd.transrate = false; pd.susceptibility = false; pd.areafactor = false; pd.beta = false;
+	}
+	
+	for(const auto &co : comp){
+		for(auto th : co.param_mean){ if(th != UNSET) param_derived[th].transrate = true;}
+		if(co.infectivity_param != UNSET) param_derived[co.infectivity_param].beta = true;
+	}
+	
+	for(const auto &tr : trans){
+		for(auto th : tr.param_prob){ if(th != UNSET) param_derived[th].transrate = true;}
+	}
+	
+	for(const auto &dc : data.democat){
+		if(dc.sus_vari == true){
+			for(auto th : dc.sus_param) param_derived[th].susceptibility = true;
+		}
+	}
+	
+	vector <unsigned int> area_list;
+	if(region_effect.on == true) area_list = region_effect.area_param;
+	if(data.area_effect.on == true){ for(auto th : area_effect_param_list) area_list.push_back(th);}
+	for(auto th : covariate_param) area_list.push_back(th);
+	if(data.level_effect.on == true){ for(auto th : level_effect_param_list) area_list.push_back(th);}
+	for(auto th : area_list) param_derived[th].areafactor = true;
+	
+	for(const auto &str : data.strain) param_derived[str.Rfactor_param].beta = true;
+	
+	for(auto sp = 0u; sp < spline.size(); sp++){
+		vector <unsigned int> list;
+		list.push_back(spline[sp].param_factor);
+		for(const auto &po : spline[sp].p) list.push_back(po.param);
+		
+		for(auto th : list){
+			auto &spl = param_derived[th].spline;
+			if(find_in(spl,sp) == UNSET) spl.push_back(sp);
+		}
+	}
+}
+
+
+/// Stores the off-diagonal part of the geographic mixing matrix in compressed sparse row format
+/// Columns are multiplied by the number of ages, so each element points to a contiguous block in Imap
+void Model::set_M_csr()
+{
+	const auto &M = data.genQ.M;
+	
+	M_csr.start.resize(M.N+1);
+	M_csr.col.clear(); M_csr.val.clear();
+	for(auto c = 0u; c < M.N; c++){
+		M_csr.start[c] = M_csr.col.size();
+		for(auto j = 0u; j < M.to[c].size(); j++){
+			M_csr.col.push_back(M.to[c][j]*data.nage);
+			M_csr.val.push_back(M.val[c][j]);
+		}
+	}
+	M_csr.start[M.N] = M_csr.col.size();
+}
+
+
 /// Updates the references to the spline
 void Model::update_R_ref(string &name, string &desc, string area_str, vector <unsigned int>& spl_ref, vector <SplineInfo> &spline_info) const
 {	
@@ -1335,71 +1409,145 @@ double Model::calculate_area_av(const vector < vector <double> > &areafactor) co
 
 
 /// Defines the time variation in the age mixing matrix
-vector < vector < vector <double> > > Model::create_Ntime(const vector < vector<double> > &disc_spline) const
+NtimeTable Model::create_Ntime(const vector < vector<double> > &disc_spline) const
+{	
+	NtimeTable Ntime;
+	set_Ntime(Ntime,disc_spline);
+	return Ntime;
+}
+
+
+/// Sets the time variation in the age mixing matrix (reusing the existing storage)
+/// A new matrix is only generated when the splines which modify the matrix change value
+void Model::set_Ntime(NtimeTable &Ntime, const vector < vector<double> > &disc_spline) const
 {	
 	timer[TIME_CREATEN].start();
 	
-	vector < vector < vector <double> > > Ntime;
-
-	Ntime.resize(details.ndivision);
+	const auto &matmod = data.genQ.matmod;
+	
+	vector <double> fac(matmod.size()), fac_last;
+	
+	Ntime.ref.resize(details.ndivision);
+	auto nmat = 0u;
 	for(auto sett = 0u; sett < details.ndivision; sett++){
-		auto &N = Ntime[sett];
-		N = data.genQ.N[0].ele;
-		
-		for(auto &mm : data.genQ.matmod){                             // These modify the basic contact matrix
-			switch(mm.type){
-				case ROW_COLUMN: case PERTURB:
-					auto si = N.size();
-					vector <bool> flag(si);
-					//for(auto i = 0u; i < si; i++) flag[i] = false;
-					
-					//for(auto a : mm.ages) flag[a] = true;
-				
-					auto fac = disc_spline[mm.spline_ref][sett];
-				
-					for(auto a : mm.ages){
-						for(auto i = 0u; i < si; i++){
-							N[a][i] *= fac;
-							N[i][a] *= fac; 
-							//if(flag[i] == false) N[i][a] *= fac; 
-						}
-					}
-					break;
-			}
-		}
+		for(auto i = 0u; i < matmod.size(); i++) fac[i] = disc_spline[matmod[i].spline_ref][sett];
 		
-		if(false){
-			for(auto j = 0u; j < N.size(); j++){
-				for(auto i = 0u; i < N.size(); i++){
-					cout << N[j][i] << " ";
-					
-				}
-				cout << "   " << sett << " Mixing matrix" << endl;
-			}				
+		if(sett == 0 || fac != fac_last){
+			if(nmat == Ntime.mat.size()) Ntime.mat.push_back(vector < vector <double> > ());
+			set_Ntime_matrix(Ntime.mat[nmat],fac,sett);
+			if(nmat == Ntime.fac.size()){ Ntime.fac.push_back(fac); Ntime.nuse.push_back(0);}
+			else{ Ntime.fac[nmat] = fac; Ntime.nuse[nmat] = 0;}
+			nmat++;
+			fac_last = fac;
 		}
-	}	
+		Ntime.ref[sett] = nmat-1;
+		Ntime.nuse[nmat-1]++;
+	}
+	Ntime.mat.resize(nmat); Ntime.fac.resize(nmat); Ntime.nuse.resize(nmat);
 	
 	timer[TIME_CREATEN].stop();
-		
-	return Ntime;
 }
 
 
-/// Determines if two matrices are equal or not
-bool Model::equal(const vector < vector <double> > &Ntime_1, const vector < vector <double> > &Ntime_2) const  
+/// Sets an age mixing matrix given the factors from the matrix modification splines
+void Model::set_Ntime_matrix(vector < vector <double> > &N, const vector <double> &fac, const unsigned int sett) const
 {
-	for(auto i = 0u; i < Ntime_1.size(); i++){
-		for(auto j = 0u; j < Ntime_1[i].size(); j++){
-			auto val1 = Ntime_1[i][j], val2 = Ntime_2[i][j];
-			if(val1 < val2-TINY || val1 > val2+TINY) return false;
+	N = data.genQ.N[0].ele;
+	
+	const auto &matmod = data.genQ.matmod;
+	for(auto i = 0u; i < matmod.size(); i++){                      // These modify the basic contact matrix
+		const auto &mm = matmod[i];
+		switch(mm.type){
+			case ROW_COLUMN: case PERTURB:
+				auto si = N.size();
+			
+				auto f = fac[i];
+			
+				for(auto a : mm.ages){
+					for(auto j = 0u; j < si; j++){
+						N[a][j] *= f;
+						N[j][a] *= f; 
+					}
+				}
+				break;
 		}
 	}
-	return true;
+	
+	if(false){
+		for(auto j = 0u; j < N.size(); j++){
+			for(auto i = 0u; i < N.size(); i++){
+				cout << N[j][i] << " ";
+				
+			}
+			cout << "   " << sett << " Mixing matrix" << endl;
+		}				
+	}
 }
+
+
+/// Updates the age mixing matrix if the splines which modify it have changed 
+/// Returns the range of time divisions which are changed
+SettRange Model::update_Ntime(NtimeTable &Ntime, const vector < vector<double> > &disc_spline, const vector <SettRange> &spline_range) const
+{
+	SettRange range; range.ti = details.ndivision; range.tf = 0;
+	for(const auto &mm : data.genQ.matmod){
+		const auto &ra = spline_range[mm.spline_ref];
+		if(ra.ti < ra.tf){
+			if(ra.ti < range.ti) range.ti = ra.ti;
+			if(ra.tf > range.tf) range.tf = ra.tf;
+		}
+	}
+	if(range.ti >= range.tf) return range;
 	
+	timer[TIME_CREATEN].start();
+	
+	const auto &matmod = data.genQ.matmod;                           // Only divisions within the range are recalculated
+	vector <double> fac(matmod.size());
+	vector <unsigned int> free;                                      // Matrices which are no longer used
+	for(auto m = 0u; m < Ntime.nuse.size(); m++){ if(Ntime.nuse[m] == 0) free.push_back(m);}
+	
+	for(auto sett = range.ti; sett < range.tf; sett++){
+		for(auto i = 0u; i < matmod.size(); i++) fac[i] = disc_spline[matmod[i].spline_ref][sett];
+		
+		auto m = Ntime.ref[sett];
+		if(Ntime.fac[m] == fac) continue;
+		
+		Ntime.nuse[m]--;
+		
+		auto m_new = UNSET;                                            // Shares a matrix with a neighbouring division
+		if(sett > 0 && Ntime.fac[Ntime.ref[sett-1]] == fac) m_new = Ntime.ref[sett-1];
+		else{
+			if(sett+1 >= range.tf && sett+1 < details.ndivision && Ntime.fac[Ntime.ref[sett+1]] == fac) m_new = Ntime.ref[sett+1];
+		}
+		
+		if(m_new == UNSET){                                            // Otherwise generates a new matrix
+			if(Ntime.nuse[m] == 0) m_new = m;
+			else{
+				if(free.size() > 0){ m_new = free.back(); free.pop_back();}
+				else{
+					m_new = Ntime.mat.size();
+					Ntime.mat.push_back(vector < vector <double> > ()); Ntime.fac.push_back(fac); Ntime.nuse.push_back(0);
+				}
+			}
+			set_Ntime_matrix(Ntime.mat[m_new],fac,sett);
+			Ntime.fac[m_new] = fac;
+		}
+		else{
+			if(Ntime.nuse[m] == 0) free.push_back(m);
+		}
+		
+		Ntime.ref[sett] = m_new;
+		Ntime.nuse[m_new]++;
+	}
+	
+	timer[TIME_CREATEN].stop();
+	
+	return range;
+}
+
 
 /// Calculates the transmission rate beta from R
-vector < vector < vector <double> > > Model::calculate_beta_from_R(const vector <double> &susceptibility, const vector <double> &paramv_dir, const vector < vector < vector <double> > > &Ntime, const vector < vector <double> > &transrate,	const vector < vector <double> > &disc_spline) const 
+vector < vector < vector <double> > > Model::calculate_beta_from_R(const vector <double> &susceptibility, const vector <double> &paramv_dir, const NtimeTable &Ntime, const vector < vector <double> > &transrate,	const vector < vector <double> > &disc_spline) const 
 {
 	timer[TIME_BETA_FROM_R].start();
 		
@@ -1418,7 +1566,7 @@ vector < vector < vector <double> > > Model::calculate_beta_from_R(const vector
 			
 			auto ratio = 0.0;
 			for(auto sett = 0u; sett < details.ndivision; sett++){
-				if(sett == 0 || equal(Ntime[sett-1],Ntime[sett]) == false){
+				if(sett == 0 || Ntime.ref[sett-1] != Ntime.ref[sett]){
 					ratio = calculate_R_beta_ratio_using_NGM(paramv_dir,susceptibility,Ntime[sett],Vinv,st,info.democatpos_dist);
 				}		
 				beta[st][c][sett] = paramv_dir[data.strain[st].Rfactor_param]*disc_spline[spl][sett]/ratio;
@@ -1446,6 +1594,54 @@ vector < vector < vector <double> > > Model::calculate_beta_from_R(const vector
 }
 
 
+/// Updates beta over the time ranges affected by changes in the R splines and the age mixing matrix
+/// (this gives the same result as calculate_beta_from_R when the other quantities are unchanged)
+void Model::update_beta_from_R(vector < vector < vector <double> > > &beta, const vector <double> &susceptibility, const vector <double> &paramv_dir, const NtimeTable &Ntime, const vector < vector <double> > &transrate, const vector < vector <double> > &disc_spline, const vector <SettRange> &spline_range, const SettRange Ntime_range) const 
+{
+	timer[TIME_BETA_FROM_R].start();
+	
+	auto Ntime_change = (Ntime_range.ti < Ntime_range.tf);
+	
+	for(auto st = 0u; st < data.nstrain; st++){
+		vector < vector <double> > Vinv;
+		
+		for(const auto &info : Rspline_info){			
+			auto spl = info.spline_ref;
+			
+			auto ti = details.ndivision, tf = 0u;                          // Works out the time range which changes
+			const auto &ra = spline_range[spl];
+			if(ra.ti < ra.tf){ ti = ra.ti; tf = ra.tf;}
+			if(Ntime_change == true){
+				if(Ntime_range.ti < ti) ti = Ntime_range.ti;
+				if(Ntime_range.tf > tf) tf = Ntime_range.tf;
+			}
+			if(ti >= tf) continue;
+			
+			while(ti > 0 && Ntime.ref[ti-1] == Ntime.ref[ti]) ti--;   // The ratio is only recalculated when Ntime changes
+			if(Ntime_change == true){
+				while(tf < details.ndivision && Ntime.ref[tf-1] == Ntime.ref[tf]) tf++;
+			}
+			
+			if(Vinv.size() == 0) Vinv = calculate_Vinv(transrate,st);
+			
+			auto ratio = 0.0;
+			for(auto sett = ti; sett < tf; sett++){
+				if(sett == ti || Ntime.ref[sett-1] != Ntime.ref[sett]){
+					ratio = calculate_R_beta_ratio_using_NGM(paramv_dir,susceptibility,Ntime[sett],Vinv,st,info.democatpos_dist);
+				}
+				auto val = paramv_dir[data.strain[st].Rfactor_param]*disc_spline[spl][sett]/ratio;
+				for(auto c : info.area){
+					beta[st][c][sett] = val;
+					if(details.mode == PREDICTION) beta[st][c][sett] *= modelmod.beta_mult[sett][c][st];
+				}
+			}
+		}
+	}
+	
+	timer[TIME_BETA_FROM_R].stop();
+}
+
+
 /// Gets a comparment from it's name 
 unsigned int Model::get_compartment(const string compname, const ErlangPos pos) const
 {
@@ -2005,7 +2201,7 @@ vector <double> Model::calculate_probreach(const vector<double> &paramv_dir, con
 
 	
 /// Returns a sample of all the splines that will be output
-vector <SplineOutput> Model::get_spline_output(const vector <double> &paramv_dir, const vector < vector < vector < vector <double> > > > &pop) const
+vector <SplineOutput> Model::get_spline_output(const vector <double> &paramv_dir, const Tensor &pop) const
 {
 	vector <SplineOutput> splineout;
 	
@@ -2019,7 +2215,7 @@ vector <SplineOutput> Model::get_spline_output(const vector <double> &paramv_dir
 		for(auto i = 0u; i < Rspline_info.size(); i++){
 			auto sp = Rspline_info[i].spline_ref; flag[sp] = true;
 			
-			if(pop.size() > 0){                                    // This outputs effective Rt
+			if(pop.empty() == false){                               // This outputs effective Rt
 				SplineOutput so;
 				so.name = "Effective "+spline[sp].name+name_add;
 				so.desc = "The effective reproduction number"+name_add;
@@ -2225,7 +2421,7 @@ vector <DerivedParam> Model::get_derived_param(const vector<double> &paramv_dir,
 
 
 /// Returns the distribution in the susceptible individuals for a set of areas
-vector <double> Model::get_sus_dist(const unsigned int sett, const vector <unsigned int> &area, const vector < vector < vector < vector <double> > > > &pop) const
+vector <double> Model::get_sus_dist(const unsigned int sett, const vector <unsigned int> &area, const Tensor &pop) const
 {
 	vector <double> dist(data.ndemocatpos_per_strain);
 	for(auto dp = 0u; dp < data.ndemocatpos_per_strain; dp++) dist[dp] = 0;
@@ -2269,7 +2465,7 @@ vector <double> Model::get_sus_dist_init(const vector <unsigned int> &area) cons
 			
 
 /// Stores maps for the reproduction number
-vector <RMap> Model::get_Rmap(const vector<double> &paramv_dir, const vector < vector <double> > &disc_spline, const vector < vector <double> > &areafactor, const vector <double> &susceptibility, const vector < vector < vector <double> > > &Ntime, const vector < vector <double> > &transrate, const vector < vector < vector < vector <double> > > > &pop) const
+vector <RMap> Model::get_Rmap(const vector<double> &paramv_dir, const vector < vector <double> > &disc_spline, const vector < vector <double> > &areafactor, const vector <double> &susceptibility, const NtimeTable &Ntime, const vector < vector <double> > &transrate, const Tensor &pop) const
 {
 	vector <RMap> rmap_list;
 	
@@ -2438,10 +2634,10 @@ double Model::calculate_generation_time(const vector<double> &paramv_dir, const
 
 
 /// Works out effective R_t
-vector < vector <double> > Model::calculate_R_eff(const vector <double> &paramv_dir, const vector < vector < vector < vector <double> > > > &pop, const unsigned int st) const
+vector < vector <double> > Model::calculate_R_eff(const vector <double> &paramv_dir, const Tensor &pop, const unsigned int st) const
 {
 	vector < vector <double> > R_eff; 
-	if(pop.size() == 0) return R_eff;
+	if(pop.empty()) return R_eff;
 	
 	auto transrate = create_transrate(paramv_dir);
 	auto susceptibility = create_susceptibility(paramv_dir);   
@@ -2497,7 +2693,7 @@ vector < vector <double> > Model::calculate_R_age(const vector <double> &paramv_
 		double ratio;
 		vector <double> vec(dpmax);
 		for(auto sett = 0u; sett < details.ndivision; sett++){
-			if(sett == 0 || equal(Ntime[sett-1],Ntime[sett]) == false){
+			if(sett == 0 || Ntime.ref[sett-1] != Ntime.ref[sett]){
 				auto F = calculate_F(paramv_dir,susceptibility,Ntime[sett],st,info.democatpos_dist);
 				auto NGM = calculate_NGM(F,Vinv);
 
@@ -2624,8 +2820,59 @@ vector < vector <double> > Model::calculate_NGM(const vector < vector<double> >
 }
 
 
-/// Estimates the ratio between R and beta based on largest eigenvector of next generation matrix
+/// Hashes a vector of doubles based on the bit patterns of its elements
+size_t HashVector::operator()(const vector <double> &vec) const
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for(auto val : vec){
+		uint64_t bits; memcpy(&bits,&val,sizeof(bits));
+		h ^= bits + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	}
+	return size_t(h);
+}
+
+
+/// Generates a key containing all the quantities on which the ratio between R and beta depends
+vector <double> Model::R_ratio_key(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &Vinv, const unsigned int st, const vector <double> &democatpos_dist) const
+{
+	auto Q = data.ndemocatpos_per_strain;
+	
+	vector <double> key;
+	key.push_back(st);
+	for(auto s : inf_state) key.push_back(paramv_dir[comp[s].infectivity_param]);
+	for(auto q = 0u; q < Q; q++) key.push_back(susceptibility[Q*st + q]);
+	for(const auto &row : A) key.insert(key.end(),row.begin(),row.end());
+	for(const auto &row : Vinv) key.insert(key.end(),row.begin(),row.end());
+	key.insert(key.end(),democatpos_dist.begin(),democatpos_dist.end());
+	
+	return key;
+}
+
+
+/// Gets the ratio between R and beta (previously calculated values are looked up in a cache)
 double Model::calculate_R_beta_ratio_using_NGM(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &Vinv, const unsigned int st, const vector <double> &democatpos_dist) const
+{
+	if(thread_num != 0) return calculate_R_beta_ratio_NGM(paramv_dir,susceptibility,A,Vinv,st,democatpos_dist);  // Only the main thread uses the cache
+	
+	auto key = R_ratio_key(paramv_dir,susceptibility,A,Vinv,st,democatpos_dist);
+	
+	auto it = R_ratio_cache.find(key);
+	if(it != R_ratio_cache.end()){ counter[COUNT_RRATIO_HIT]++; return it->second;}
+	counter[COUNT_RRATIO_MISS]++;
+	
+	auto ratio = calculate_R_beta_ratio_NGM(paramv_dir,susceptibility,A,Vinv,st,democatpos_dist);
+	
+	auto bytes = key.size()*sizeof(double) + R_ratio_cache_entry;  // Includes the node, bucket and vector overhead
+	if(R_ratio_cache_size + bytes > R_ratio_cache_max){ R_ratio_cache.clear(); R_ratio_cache_size = 0;}
+	R_ratio_cache_size += bytes;
+	R_ratio_cache[key] = ratio;
+	
+	return ratio;
+}
+
+
+/// Estimates the ratio between R and beta based on largest eigenvector of next generation matrix
+double Model::calculate_R_beta_ratio_NGM(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &Vinv, const unsigned int st, const vector <double> &democatpos_dist) const
 {
 	auto F = calculate_F(paramv_dir,susceptibility,A,st,democatpos_dist);
 	
@@ -3351,7 +3598,7 @@ void Model::print_parameter_types()
 
 
 /// Looks at different models to estimate eigenvectors (this is used in the raw data analysis)
-void Model::eignevector_compare_models(const vector <double> &susceptibility, const vector <double> &paramv_dir, const vector < vector < vector <double> > > &Ntime, const vector < vector <double> > &transrate) const
+void Model::eignevector_compare_models(const vector <double> &susceptibility, const vector <double> &paramv_dir, const NtimeTable &Ntime, const vector < vector <double> > &transrate) const
 {
 	auto Vinv = calculate_Vinv(transrate,0);
 		
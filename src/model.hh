@@ -2,12 +2,18 @@
 #define BEEPMBP__Model_HH
 
 #include <vector>
+#include <unordered_map>
 
 using namespace std;
 
 #include "utils.hh"
 #include "data.hh"
 
+struct HashVector                                       // Hashes a vector of doubles (used for the NGM ratio cache)
+{
+	size_t operator()(const vector <double> &vec) const;
+};
+
 class Model                                             // Stores information about the model
 {
 	public:
@@ -47,6 +53,10 @@ class Model                                             // Stores information ab
 		
 		vector <unsigned int> param_not_fixed;              // A list of all parameters which actualy change 
 
+		vector <ParamDerived> param_derived;                // The derived quantities which depend on each parameter
+		
+		SparseMatrixCSR M_csr;                              // The off-diagonal geographic mixing matrix with age-blocked columns
+
 		ModelMod modelmod;                                  // Stores any modifications to the model
 		
 		double get_infectivity_dif(const unsigned int tr, const vector <double> &paramv) const;
@@ -56,15 +66,15 @@ class Model                                             // Stores information ab
 		double calculate_area_av(const vector < vector <double> > &areafactor) const;
 		vector < vector <double> > calculate_F(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const unsigned int sp, const vector <double> &democatpos_dist) const;
 		vector < vector <double> > calculate_NGM(const vector < vector<double> > &F, const vector < vector<double> > &Vinv) const;
-		void eignevector_compare_models(const vector <double> &susceptibility, const vector <double> &paramv_dir, const vector < vector < vector <double> > > &Ntime, const vector < vector <double> > &transrate) const;
+		void eignevector_compare_models(const vector <double> &susceptibility, const vector <double> &paramv_dir, const NtimeTable &Ntime, const vector < vector <double> > &transrate) const;
 		double calculate_R_beta_ratio_using_NGM(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &Vinv, const unsigned int sp, const vector <double> &democatpos_dist) const;
 		vector <double> calculate_probreach(const vector<double> &paramv_dir, const unsigned int st) const;
 		vector <double> calculate_external_ninf(const vector<double> &paramv_dir) const;
-		vector <SplineOutput> get_spline_output(const vector <double> &paramv_dir, const vector < vector < vector < vector <double> > > > &pop) const;
+		vector <SplineOutput> get_spline_output(const vector <double> &paramv_dir, const Tensor &pop) const;
 		vector <DerivedParam> get_derived_param(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &transrate) const;
 		vector <double> get_sus_dist_init(const vector <unsigned int> &area) const;
-		vector <double> get_sus_dist(const unsigned int sett, const vector <unsigned int> &area, const vector < vector < vector < vector <double> > > > &pop) const;
-		vector <RMap> get_Rmap(const vector<double> &paramv_dir, const vector < vector <double> > &disc_spline, const vector < vector <double> > &areafactor, const vector <double> &susceptibility, const vector < vector < vector <double> > > &Ntime, const vector < vector <double> > &transrate, const vector < vector < vector < vector <double> > > > &pop) const;
+		vector <double> get_sus_dist(const unsigned int sett, const vector <unsigned int> &area, const Tensor &pop) const;
+		vector <RMap> get_Rmap(const vector<double> &paramv_dir, const vector < vector <double> > &disc_spline, const vector < vector <double> > &areafactor, const vector <double> &susceptibility, const NtimeTable &Ntime, const vector < vector <double> > &transrate, const Tensor &pop) const;
 		double calculate_generation_time(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &transrate, const vector <double> &democatpos_dist, const unsigned int st) const;
 		bool do_mbp_events(const vector <double> &parami, const vector <double> &paramp) const;
 		double prior(const vector<double> &paramv) const;
@@ -74,10 +84,12 @@ class Model                                             // Stores information ab
 		vector < vector <double> > create_areafactor(const vector<double> &paramv_dir) const;
 		vector < vector <double> > create_transrate(const vector<double> &paramv_dir) const;
 		vector <CompProb> create_compprob(const vector<double> &paramv_dir, const unsigned int st) const;
-		vector < vector < vector <double> > > create_Ntime(const vector < vector<double> > &disc_spline) const;
-		bool equal(const vector < vector <double> > &Ntime_1, const vector < vector <double> > &Ntime_2) const;
-		vector < vector < vector <double> > > calculate_beta_from_R(const vector <double> &susceptibility, const vector <double> &paramv_dir, const vector < vector < vector <double> > > &Ntime, const vector < vector <double> > &transrate, const vector < vector <double> > &disc_spline) const;
-		vector < vector <double> > calculate_R_eff(const vector <double> &paramv_dir, const vector < vector < vector < vector <double> > > > &pop, const unsigned int st) const;
+		NtimeTable create_Ntime(const vector < vector<double> > &disc_spline) const;
+		void set_Ntime(NtimeTable &Ntime, const vector < vector<double> > &disc_spline) const;
+		SettRange update_Ntime(NtimeTable &Ntime, const vector < vector<double> > &disc_spline, const vector <SettRange> &spline_range) const;
+		vector < vector < vector <double> > > calculate_beta_from_R(const vector <double> &susceptibility, const vector <double> &paramv_dir, const NtimeTable &Ntime, const vector < vector <double> > &transrate, const vector < vector <double> > &disc_spline) const;
+		void update_beta_from_R(vector < vector < vector <double> > > &beta, const vector <double> &susceptibility, const vector <double> &paramv_dir, const NtimeTable &Ntime, const vector < vector <double> > &transrate, const vector < vector <double> > &disc_spline, const vector <SettRange> &spline_range, const SettRange Ntime_range) const;
+		vector < vector <double> > calculate_R_eff(const vector <double> &paramv_dir, const Tensor &pop, const unsigned int st) const;
 		vector < vector <double> > calculate_R_age(const vector <double> &paramv_dir) const;
 		bool inbounds(const vector <double> &paramv) const;
 		double dPr_dth(const unsigned int th, const vector<double> &paramv) const;
@@ -104,6 +116,9 @@ class Model                                             // Stores information ab
 	
 		vector <ProbReach> prob_reach;                      // Calculates the probability of reaching a certain conpartment
 		
+		mutable unordered_map <vector <double>, double, HashVector> R_ratio_cache; // Stores previously calculated NGM ratios
+		mutable unsigned long R_ratio_cache_size;           // The approximate memory used by the cache (bytes)
+		
 		void load_model();
 		void add_comps();
 		void add_trans();
@@ -132,9 +147,14 @@ class Model                                             // Stores information ab
 		bool prior_order_correct(const vector <double> &paramv) const;
 		void prior_order();
 		void set_parameter_type();
+		void set_param_derived();
+		void set_M_csr();
+		void set_Ntime_matrix(vector < vector <double> > &N, const vector <double> &fac, const unsigned int sett) const;
 		void update_R_ref(string &name, string &desc, string area_str, vector <unsigned int>& spl_ref, vector <SplineInfo> &spline_info) const;
 		void update_efoi_ref(string &name, string &desc, string area_str, string strain_str, const vector <double> efoi_ad, vector < vector <unsigned int> > &spl_ref, vector <SplineInfo> &spline_info) const;
 		void counterfactual_modification();
+		double calculate_R_beta_ratio_NGM(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &Vinv, const unsigned int st, const vector <double> &democatpos_dist) const;
+		vector <double> R_ratio_key(const vector<double> &paramv_dir, const vector <double> &susceptibility, const vector <vector <double> > &A, const vector < vector <double> > &Vinv, const unsigned int st, const vector <double> &democatpos_dist) const;
 			
 		const Details &details;
 		Data &data;
@@ -1,12 +1,15 @@
 /// Information and routines for transferring data between cores using MPI
 
 #include <sstream>
+#include <cstring>
+#include <algorithm>
 
 using namespace std;
 
 #include "mpi.hh"
 #include "param_prop.hh"
 #include "state.hh"
+#include "resample.hh"
 
 Mpi::Mpi(const Details &details): details(details)
 {
@@ -20,6 +23,8 @@ Mpi::Mpi(const Details &details): details(details)
 	ncore = 1;
 	core = 0;
 	#endif
+	
+	resample_step = 0;
 }
 
 /// Copies data from core zero to all the others
@@ -211,180 +216,209 @@ void Mpi::exchange_samples(Generation &gen)
 }
 
 
-/// At the end of an observed section, this swaps information between different particles (PMCMC)
-void Mpi::end_sec_swap(vector <State> &particle, const unsigned int sett, const vector <unsigned int> &backpart, const unsigned int buffersize)
+/// At the end of an observed section, this starts swapping information between different particles (PMCMC)
+/// Particles copied from ancestors on the same core are set immediately and remote ancestors are sent using
+/// non-blocking messages. Returns which particles are ready to simulate the next section (the others are 
+/// set by end_sec_swap_finish, so their transfer can overlap with simulating the ready particles).
+vector <bool> Mpi::end_sec_swap_start(vector <State> &particle, const unsigned int sett, const vector <unsigned int> &backpart, const unsigned int buffersize)
 {
 	timer[TIME_PMCMCSWAP].start();
 		
 	auto N = particle.size();
 	auto Ntot = backpart.size();
+	auto pmin = core*N;
 	
-	MPI_Request reqs[Ntot];                                        // These store information used in Isend and Irecv
-	MPI_Status stats[Ntot];
-	
-	vector < vector<double> > sendbuffer;                          // Buffers used for Isend and Irecv
-	vector < vector<double> > recibuffer;
-	sendbuffer.resize(N); recibuffer.resize(N);
-
 	if(false && core == 0){
 		for(auto p = 0u; p < Ntot; p++) cout << p << " " << backpart[p] << "  backpart" << endl;
 	}
 	
-	auto npreclist = 0u;
-	vector <unsigned int> preclist;
-	vector < vector <unsigned int> > preclistli;
-	
 	if(false){ for(auto p = 0u; p < N; p++){ particle[p].pop[sett][0][0][0] = core*N+p;}} // For testing
 	
-	auto nreqs = 0u;
-	auto pmin = core*N;                                             // Sets up information to be recieved
-	for(auto p = pmin; p < pmin+N; p++){
-		auto pp = backpart[p];
-		if(p != pp){                   
-			auto cor = pp/N;
-			if(cor != core){
-				auto j = 0u; while(j < npreclist && preclist[j] != pp) j++;
-				if(j < npreclist) preclistli[j].push_back(p%N);
-				else{
-					preclist.push_back(pp); 
-					preclistli.push_back(vector <unsigned int> ()); 
-					preclistli[npreclist].push_back(p%N);
-					
-					recibuffer[npreclist].resize(buffersize);
-					MPI_Irecv(&recibuffer[npreclist][0],buffersize,MPI_DOUBLE,cor,pp,MPI_COMM_WORLD,&reqs[nreqs]);
-					nreqs++; if(nreqs > Ntot) emsgEC("Mpi",2); 
-					npreclist++; if(npreclist > N) emsgEC("Mpi",3); 
-				}
-			}
+	swap_reqs.clear(); swap_sendbuffer.clear(); swap_recibuffer.clear(); swap_reclist.clear();
+	swap_sett = sett;
+	
+	vector <bool> ready(N,true);
+	
+	vector <unsigned int> needed;                                  // Remote ancestors needed on this core
+	vector <unsigned int> recindex(Ntot,UNSET);
+	for(auto p = 0u; p < N; p++){
+		auto pp = backpart[pmin+p];
+		if(pp/N != core){
+			if(recindex[pp] == UNSET){ recindex[pp] = 0; needed.push_back(pp);}
+			ready[p] = false;
 		}
 	}
-
-	auto nsendbuf = 0u;
-	for(auto p = pmin; p < pmin+N; p++){                           // Initiates information to be sent
-		if(p == backpart[p]){ 
-			auto ncorlist = 0u;
-			vector <unsigned int> corlist;
-			for(auto pp = 0u; pp < Ntot; pp++){
-				if(p == backpart[pp]){
-					auto cor = pp/N;
-					if(cor == core){
-						if(pp != p){
-							particle[pp%N].pop[sett] = particle[p%N].pop[sett];
-							particle[pp%N].Imap[sett-1] = particle[p%N].Imap[sett-1];
-							particle[pp%N].Idiag[sett-1] = particle[p%N].Idiag[sett-1];
-						}
-					}
-					else{
-						auto j = 0u; while(j < ncorlist && corlist[j] != cor) j++;
-						if(j == ncorlist){ corlist.push_back(cor); ncorlist++;}
-					}
+	
+	// Messages between a pair of cores are received in the same order as they are sent (ascending ancestor)
+	sort(needed.begin(),needed.end());
+	for(auto j = 0u; j < needed.size(); j++) recindex[needed[j]] = j;
+	
+	swap_reclist.resize(needed.size());
+	for(auto p = 0u; p < N; p++){
+		auto pp = backpart[pmin+p];
+		if(pp/N != core) swap_reclist[recindex[pp]].push_back(p);
+	}
+	
+	swap_recibuffer.resize(needed.size());
+	for(auto j = 0u; j < needed.size(); j++){                       // Sets up information to be recieved
+		auto pp = needed[j];
+		swap_recibuffer[j].resize(buffersize);
+		swap_reqs.push_back(MPI_Request());
+		MPI_Irecv(&swap_recibuffer[j][0],buffersize,MPI_DOUBLE,pp/N,0,MPI_COMM_WORLD,&swap_reqs.back());
+	}
+	
+	vector < vector <unsigned int> > dest(N);                       // The cores each local ancestor is sent to
+	for(auto pp = 0u; pp < Ntot; pp++){
+		auto p = backpart[pp];
+		if(p/N == core){
+			if(pp/N == core){
+				if(pp != p){                                               // Copies from an ancestor on the same core
+					particle[pp%N].pop.copy_sett(sett,particle[p%N].pop);
+					particle[pp%N].Imap[sett-1] = particle[p%N].Imap[sett-1];
+					particle[pp%N].Idiag[sett-1] = particle[p%N].Idiag[sett-1];
+					particle[pp%N].transnum.copy_sett(sett-1,particle[p%N].transnum);
 				}
 			}
-						
-			if(ncorlist > 0){
-				pack_initialise(0);
-				pack(particle[p%N].pop[sett]); 
-				pack(particle[p%N].Imap[sett-1]);
-				pack(particle[p%N].Idiag[sett-1]);
-				sendbuffer[nsendbuf] = copybuffer(); if(sendbuffer[nsendbuf].size() != buffersize) emsgEC("Mpi",4);
-				
-				for(auto j = 0u; j < ncorlist; j++){
-					MPI_Isend(&sendbuffer[nsendbuf][0],buffersize,MPI_DOUBLE,corlist[j],p,MPI_COMM_WORLD,&reqs[nreqs]);
-					nreqs++; if(nreqs > Ntot) emsgEC("Mpi",5); 
-				}				
-				nsendbuf++; if(nsendbuf > N) emsgEC("Mpi",6);
+			else{
+				auto &de = dest[p%N];
+				if(de.size() == 0 || de[de.size()-1] != pp/N) de.push_back(pp/N);
+			}
+		}
+	}
+	
+	for(auto p = 0u; p < N; p++){                                   // Initiates information to be sent
+		if(dest[p].size() > 0){
+			if(backpart[pmin+p] != pmin+p) emsgEC("Mpi",2);
+			
+			pack_initialise(0);
+			pack(particle[p].pop,sett); 
+			pack(particle[p].Imap[sett-1]);
+			pack(particle[p].Idiag[sett-1]);
+			pack(particle[p].transnum,sett-1);                         // Used to continue the infectivity map
+			swap_sendbuffer.push_back(copybuffer()); 
+			auto &buf = swap_sendbuffer.back();
+			if(buf.size() != buffersize) emsgEC("Mpi",4);
+			
+			for(auto co : dest[p]){
+				swap_reqs.push_back(MPI_Request());
+				MPI_Isend(&buf[0],buffersize,MPI_DOUBLE,co,0,MPI_COMM_WORLD,&swap_reqs.back());
 			}
 		}
 	}
 	
-	if(nreqs > 0){
-		if(MPI_Waitall(nreqs,reqs,stats) != MPI_SUCCESS) emsgEC("Mpi",7);
+	timer[TIME_PMCMCSWAP].stop();
+	
+	return ready;
+}
+
+
+/// Allows the messages started in end_sec_swap_start to progress (called between simulating particles)
+void Mpi::end_sec_swap_progress()
+{
+	if(swap_reqs.size() == 0) return;
+	int flag;
+	MPI_Testall(swap_reqs.size(),swap_reqs.data(),&flag,MPI_STATUSES_IGNORE);
+}
+
+
+/// Completes the swap of information started in end_sec_swap_start
+void Mpi::end_sec_swap_finish(vector <State> &particle)
+{
+	timer[TIME_PMCMCSWAP].start();
+	
+	auto sett = swap_sett;
+	
+	if(swap_reqs.size() > 0){
+		if(MPI_Waitall(swap_reqs.size(),swap_reqs.data(),MPI_STATUSES_IGNORE) != MPI_SUCCESS) emsgEC("Mpi",7);
 	}
 		
-	for(auto rec = 0u; rec < npreclist; rec++){                       	// Unpacks the recieved information
-		auto p = preclistli[rec][0];
+	for(auto rec = 0u; rec < swap_reclist.size(); rec++){           // Unpacks the recieved information
+		auto p = swap_reclist[rec][0];
 		
-		setbuffer(recibuffer[rec]);
-		unpack(particle[p].pop[sett]);
+		setbuffer(swap_recibuffer[rec]);
+		unpack(particle[p].pop,sett);
 		unpack(particle[p].Imap[sett-1]);
 		unpack(particle[p].Idiag[sett-1]);
+		unpack(particle[p].transnum,sett-1);
 	
-		for(auto j = 1u; j < preclistli[rec].size(); j++){
-			auto pp = preclistli[rec][j];
-			particle[pp].pop[sett] = particle[p].pop[sett];
+		for(auto j = 1u; j < swap_reclist[rec].size(); j++){
+			auto pp = swap_reclist[rec][j];
+			particle[pp].pop.copy_sett(sett,particle[p].pop);
+			particle[pp].Imap[sett-1] = particle[p].Imap[sett-1];
+			particle[pp].Idiag[sett-1] = particle[p].Idiag[sett-1];
+			particle[pp].transnum.copy_sett(sett-1,particle[p].transnum);
 		}
 	}
 	
-	if(false){
-		for(auto p = 0u; p < N; p++){ 
-			if(particle[p].pop[sett][0][0][0] != int(backpart[core*N+p])) emsgEC("Mpi",8);
-			cout << core << ": " << " " << core*N+p << " " << particle[p].pop[sett][0][0][0] << " " << backpart[core*N+p] << " compare" << endl;
-		}
-		emsg("Done");
-	}
+	swap_reqs.clear(); swap_sendbuffer.clear(); swap_recibuffer.clear(); swap_reclist.clear();
 	
 	timer[TIME_PMCMCSWAP].stop();
 }
 
 
 /// Constructs a particle by gathering the pieces from different particles (from the bootstrap function)
-Particle Mpi::particle_sample(const unsigned int ru, const vector < vector <unsigned int> > &backpart, vector <State> &particle, const ObservationModel &obsmodel)	
+/// The pieces of the lineage are stored in the ancestral tree on the cores which simulated them. Each core sends
+/// its pieces to core 0 in a single message, where they are joined to give the encoded transition numbers.
+Particle Mpi::particle_sample(const unsigned int ru, const vector < vector <unsigned int> > &backpart, const vector <State> &particle, const LineageTree &lineage, const ObservationModel &obsmodel)	
 {
 	timer[TIME_STATESAMPLE].start();
 			
 	auto N = particle.size();
-	auto Ntot = backpart[0].size();
 	auto nsec = obsmodel.nsection;
 	
 	if(false){
 		for(auto sec = 1u; sec < nsec; sec++){
-			cout << sec << ": "; for(auto p = 0u; p < Ntot; p++) cout << backpart[sec][p] << ",";
+			cout << sec << ": "; for(auto p = 0u; p < backpart[sec].size(); p++) cout << backpart[sec][p] << ",";
 			cout << " Backpart" << endl;  
 		}
 	}
 
+	vector <unsigned int> lin(nsec);                               // The particle on the lineage in each section
 	auto p = backpart[nsec][0];
 	for(int sec = nsec-1; sec >= 0; sec--){
-		auto ti = obsmodel.section_ti[sec];
-		auto tf = obsmodel.section_tf[sec];
+		lin[sec] = p;
+		p = backpart[sec][p];
+	}
+	
+	Particle part;
+	part.run = ru;
+	part.EF = particle[0].EF;
+	part.paramval = particle[0].paramval;
+	
+	if(core == 0){
+		vector < vector <uint16_t> > piece(nsec);
+		for(auto sec = 0u; sec < nsec; sec++){
+			if(lin[sec]/N == 0) piece[sec] = lineage.piece(sec,lin[sec]);
+		}
 		
-		unsigned int co = p/N;
-		if(core == 0){  
-			if(co != 0){
+		for(auto co = 1u; co < ncore; co++){
+			auto fl = false; for(auto sec = 0u; sec < nsec; sec++){ if(lin[sec]/N == co) fl = true;}
+			if(fl == true){
 				pack_recv(co);
-				for(auto sett = ti; sett < tf; sett++){
-					unpack(particle[0].pop[sett]);
-					unpack(particle[0].transnum[sett]);
-				}
+				for(auto sec = 0u; sec < nsec; sec++){ if(lin[sec]/N == co) unpack_words(piece[sec]);}
 				unpack_check();
 			}
-			else{
-				if(p != 0){
-					for(auto sett = ti; sett < tf; sett++){
-						particle[0].pop[sett] = particle[p].pop[sett];
-						particle[0].transnum[sett] = particle[p].transnum[sett];
-					}
-				}
-			}
 		}
-		else{
-			if(co == core){
-				pack_initialise(0);
-				for(auto sett = ti; sett < tf; sett++){
-					pack(particle[p%N].pop[sett]);
-					pack(particle[p%N].transnum[sett]);
-				}
-				pack_send(0);
-			}
-		}
-		barrier();
 		
-		p = backpart[sec][p];
+		const auto &tn = particle[0].transnum;
+		unsigned int n[4] = {obsmodel.section_tf[nsec-1], tn.size(1), tn.size(2), tn.size(3)};
+		part.transnum_code.set_shape(n,TIME_MAJOR);
+		auto &code = part.transnum_code.code;
+		for(const auto &pi : piece) code.insert(code.end(),pi.begin(),pi.end());
+		code.shrink_to_fit();
+	}
+	else{
+		auto fl = false; for(auto sec = 0u; sec < nsec; sec++){ if(lin[sec]/N == core) fl = true;}
+		if(fl == true){
+			pack_initialise(0);
+			for(auto sec = 0u; sec < nsec; sec++){ if(lin[sec]/N == core) pack_words(lineage.piece(sec,lin[sec]));}
+			pack_send(0);
+		}
 	}
 	
 	timer[TIME_STATESAMPLE].stop();
 	
-	return particle[0].create_particle(ru);
+	return part;
 }
 
 
@@ -489,6 +523,15 @@ vector <double> Mpi::average(const vector <double> &val)
 }
 
 
+/// Gets the maximum value across all cores (returned to all cores)
+double Mpi::max(const double val)
+{
+	double valmax;
+	MPI_Allreduce(&val,&valmax,1,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+	return valmax;
+}
+
+
 /// Gets the acceptance rate across all mpi processes
 double Mpi::get_acrate(const unsigned int nac, const unsigned int ntr)
 {
@@ -579,6 +622,121 @@ void Mpi::barrier()
 }
 
 
+const int TAG_WORKREQUEST = 30001;                                 // Message tags used by the work queue
+const int TAG_WORKREPLY = 30002;
+
+/// Starts a queue which hands out nround rounds of work to the cores in batches (ABC, ABC-SMC)
+/// Core 0 coordinates the queue (as well as doing work itself) and batches shrink as the queue empties
+/// (guided self-scheduling), so cores finish at close to the same time without synchronising
+void Mpi::workqueue_start(const unsigned long nround)
+{
+	wq_nround = nround;
+	wq_nleft = nround;
+	wq_ndone = 0;
+	wq_batch.assign(ncore,0);
+	wq_nactive = ncore-1;
+}
+
+
+/// Takes the next batch from the queue (zero when the queue is empty)
+unsigned int Mpi::workqueue_take()
+{
+	if(wq_nleft == 0) return 0;
+	
+	auto nb = wq_nleft/(2*ncore); 
+	if(nb == 0) nb = 1;
+	wq_nleft -= nb;
+	
+	return nb;
+}
+
+
+/// Replies to a request for work from core co (which has completed its previous batch)
+void Mpi::workqueue_serve(const unsigned int co)
+{
+	unsigned int ndone;
+	MPI_Recv(&ndone,1,MPI_UNSIGNED,co,TAG_WORKREQUEST,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+	if(ndone != wq_batch[co]) emsgEC("Mpi",14);
+	wq_ndone += ndone;
+	
+	auto nb = workqueue_take();
+	wq_batch[co] = nb;
+	if(nb == 0) wq_nactive--;
+	
+	MPI_Send(&nb,1,MPI_UNSIGNED,co,TAG_WORKREPLY,MPI_COMM_WORLD);
+}
+
+
+/// Replies to any outstanding requests for work (called by core 0 between simulations)
+void Mpi::workqueue_poll()
+{
+	if(core != 0) return;
+	
+	do{
+		int flag;
+		MPI_Status status;
+		MPI_Iprobe(MPI_ANY_SOURCE,TAG_WORKREQUEST,MPI_COMM_WORLD,&flag,&status);
+		if(!flag) break;
+		workqueue_serve(status.MPI_SOURCE);
+	}while(true);
+}
+
+
+/// Gets the number of rounds in the next batch of work (zero when all the work has been completed)
+/// The previous batch on this core must be complete
+unsigned int Mpi::workqueue_next()
+{
+	unsigned int nb;
+	if(core == 0){
+		wq_ndone += wq_batch[0];
+		workqueue_poll();
+		
+		nb = workqueue_take();
+		wq_batch[0] = nb;
+		
+		if(nb == 0){                                                    // Waits for the other cores to finish
+			timer[TIME_WAIT].start();
+			while(wq_nactive > 0){
+				MPI_Status status;
+				MPI_Probe(MPI_ANY_SOURCE,TAG_WORKREQUEST,MPI_COMM_WORLD,&status);
+				workqueue_serve(status.MPI_SOURCE);
+			}
+			timer[TIME_WAIT].stop();
+			
+			if(wq_ndone != wq_nround) emsgEC("Mpi",15);
+		}
+	}
+	else{
+		timer[TIME_WAIT].start();
+		MPI_Send(&wq_batch[core],1,MPI_UNSIGNED,0,TAG_WORKREQUEST,MPI_COMM_WORLD);
+		MPI_Recv(&nb,1,MPI_UNSIGNED,0,TAG_WORKREPLY,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+		timer[TIME_WAIT].stop();
+		wq_batch[core] = nb;
+	}
+	
+	return nb;
+}
+
+
+/// The number of rounds of work completed so far (only known on core 0)
+unsigned long Mpi::workqueue_ndone() const
+{
+	return wq_ndone;
+}
+
+
+/// Gathers an unsigned int vector across all cores and returns the combined vector to all the cores
+vector <unsigned int> Mpi::allgather(const vector <unsigned int> &vec)
+{
+	vector <unsigned int> vectot;
+	vectot.resize(vec.size()*ncore);
+	
+	MPI_Allgather(&vec[0],vec.size(),MPI_UNSIGNED,&vectot[0],vec.size(),MPI_UNSIGNED,MPI_COMM_WORLD);
+	
+	return vectot;
+}
+
+
 /// Gathers an unsigned int vector across all cores and returns the combined vector to core 0
 vector <unsigned int> Mpi::gather(const vector <unsigned int> &vec)
 {
@@ -677,18 +835,23 @@ vector < vector < vector <double> > > Mpi::gather_EF_chain_sample(const vector <
 			auto run = part[ch].run;
 			auto num = chain[ch].num;
 			if(run == 0) invT_total[num] = chain[ch].invT;
-			EF_chain_sample[run][num] = chain[ch].EF_samp;
+			const auto &EF_samp = chain[ch].EF_samp;
+			for(auto i = 0u; i < EF_samp.size(); i++) EF_chain_sample[run][chain[ch].EF_samp_num[i]].push_back(EF_samp[i]);
 		}
 
 		for(auto co = 1u; co < ncore; co++){
 			unsigned int run, num;
 			double invT;
+			vector <double> EF_samp;
+			vector <unsigned int> EF_samp_num;
 			pack_recv(co);
 			for(auto ch = 0u; ch < N; ch++){
 				unpack(run);
 				unpack(num);
 				unpack(invT);
-				unpack(EF_chain_sample[run][num]);
+				unpack(EF_samp);
+				unpack(EF_samp_num);
+				for(auto i = 0u; i < EF_samp.size(); i++) EF_chain_sample[run][EF_samp_num[i]].push_back(EF_samp[i]);
 				if(run == 0) invT_total[num] = invT;
 			}
 			unpack_check();
@@ -701,6 +864,7 @@ vector < vector < vector <double> > > Mpi::gather_EF_chain_sample(const vector <
 			pack(chain[ch].num);
 			pack(chain[ch].invT);
 			pack(chain[ch].EF_samp);
+			pack(chain[ch].EF_samp_num);
 		}
 		pack_send(0);
 	}
@@ -971,25 +1135,54 @@ void Mpi::pack(const vector <string> &vec)
 	pack_item(vec);
 }
 
-void Mpi::pack(const Particle &part)
+void Mpi::pack(const Particle &part)                                   // Transition numbers are sent in compact form
 {
 	pack(part.paramval);
 	pack(part.EF);
 	pack(part.run);
-		
-	const auto &vec = part.transnum;
-	auto imax = vec.size(); buffer.push_back(imax); k++;
-	for(auto i = 0u; i < imax; i++){
-		auto jmax = vec[i].size(); buffer.push_back(jmax); k++;
-		for(auto j = 0u; j < jmax; j++){
-			auto nmax = vec[i][j].size(); buffer.push_back(nmax); k++;
-			for(auto n = 0u; n < nmax; n++){
-				auto pmax = vec[i][j][n].size(); buffer.push_back(pmax); k++;
-				for(auto p = 0u; p < pmax; p++){
-					buffer.push_back(vec[i][j][n][p]); k++;
-				}
-			}
-		}
+	if(part.transnum_code.empty() == false) pack(part.transnum_code);
+	else{
+		CompactTensor ct; ct.encode(part.transnum);
+		pack(ct);
+	}
+}
+
+void Mpi::pack(const CompactTensor &ct)                                // Packs the shape followed by the words
+{
+	for(auto i = 0u; i < 4; i++){ buffer.push_back(ct.n[i]); k++;}
+	buffer.push_back(ct.ord); k++;
+	pack_words(ct.code);
+}
+
+void Mpi::pack_words(const vector <uint16_t> &code)                    // Four 16 bit words are placed in each double
+{
+	k += compact_pack_words(code,buffer);
+}
+
+void Mpi::pack_compact(const Tensor &ten, const unsigned int i0)       // Packs the slab i0 in compact form
+{
+	vector <uint16_t> code;
+	auto sl = ten[i0];
+	for(auto i1 = 0u; i1 < ten.size(1); i1++) compact_encode(sl[i1][0],ten.size(2)*ten.size(3),code);
+	pack_words(code);
+}
+
+void Mpi::pack(const Tensor &ten)                                      // Packs the shape followed by the flat data
+{
+	for(auto i = 0u; i < 4; i++){ buffer.push_back(ten.size(i)); k++;}
+	buffer.push_back(ten.order()); k++;
+	
+	auto da = ten.data();
+	buffer.insert(buffer.end(),da,da+ten.nelement()); k += ten.nelement();
+}
+
+void Mpi::pack(const Tensor &ten, const unsigned int i0)                // Packs the slab i0 (shape known by receiver)
+{
+	auto sl = ten[i0];
+	for(auto i1 = 0u; i1 < ten.size(1); i1++){
+		auto st = sl[i1][0];
+		auto num = ten.size(2)*ten.size(3);
+		buffer.insert(buffer.end(),st,st+num); k += num;
 	}
 }
 
@@ -1203,20 +1396,57 @@ void Mpi::unpack(Particle &part)
 	unpack(part.paramval);
 	unpack(part.EF);
 	unpack(part.run);
+	CompactTensor ct; unpack(ct);
+	ct.decode(part.transnum);
+	part.transnum_code.clear();
+	part.warm = false;
+}
+
+void Mpi::unpack(CompactTensor &ct)
+{
+	unsigned int n[4]; for(auto i = 0u; i < 4; i++){ n[i] = buffer[k]; k++;}
+	auto ord = TensorOrder(buffer[k]); k++;
 	
-	auto &vec = part.transnum;
-	unsigned int imax = buffer[k]; k++; vec.resize(imax);
-	for(auto i = 0u; i < imax; i++){
-		unsigned int jmax = buffer[k]; k++; vec[i].resize(jmax);
-		for(auto j = 0u; j < jmax; j++){
-			unsigned int nmax = buffer[k]; k++; vec[i][j].resize(nmax);
-			for(auto n = 0u; n < nmax; n++){
-				unsigned int pmax = buffer[k]; k++; vec[i][j][n].resize(pmax);
-				for(auto p = 0u; p < pmax; p++){
-					vec[i][j][n][p] = buffer[k]; k++;
-				}
-			}
-		}
+	ct.set_shape(n,ord);
+	unpack_words(ct.code);
+}
+
+void Mpi::unpack_words(vector <uint16_t> &code)
+{
+	if(k >= buffer.size()) emsgEC("Mpi",10);
+	k += compact_unpack_words(buffer.data()+k,buffer.size()-k,code);
+}
+
+void Mpi::unpack_compact(Tensor &ten, const unsigned int i0)
+{
+	vector <uint16_t> code;
+	unpack_words(code);
+	
+	auto sl = ten[i0];
+	auto num = ten.size(2)*ten.size(3);
+	size_t w = 0;
+	for(auto i1 = 0u; i1 < ten.size(1); i1++){
+		w += compact_decode(code.data()+w,code.size()-w,sl[i1][0],num);
+	}
+	if(w != code.size()) emsgEC("Mpi",11);
+}
+
+void Mpi::unpack(Tensor &ten)
+{
+	unsigned int n[4]; for(auto i = 0u; i < 4; i++){ n[i] = buffer[k]; k++;}
+	auto ord = TensorOrder(buffer[k]); k++;
+	ten.resize(n[0],n[1],n[2],n[3],ord);
+	
+	auto num = ten.nelement();
+	copy(buffer.begin()+k,buffer.begin()+k+num,ten.data()); k += num;
+}
+
+void Mpi::unpack(Tensor &ten, const unsigned int i0)
+{
+	auto sl = ten[i0];
+	for(auto i1 = 0u; i1 < ten.size(1); i1++){
+		auto num = ten.size(2)*ten.size(3);
+		copy(buffer.begin()+k,buffer.begin()+k+num,sl[i1][0]); k += num;
 	}
 }
 
@@ -1324,4 +1554,73 @@ void Mpi::unpack(vector<ParamSample> &vec)
 		unpack(vec[i].run);
 		unpack(vec[i].EF);
 	}
-}
\ No newline at end of file
+}
+
+
+/// Resamples particles whose weights w are distributed across cores (the total weight is returned in wtot)
+/// Returns the number of copies of each local particle. Only the offset of the cumulative weight on each core 
+/// is communicated (by means of a prefix sum), so the cost is O(N) on each core rather than O(Ntot) on core 0
+vector <unsigned int> Mpi::resample_number_distributed(const vector <double> &w, const unsigned int nsamp, const ResampleType type, double &wtot)
+{
+	auto n = w.size();
+	
+	auto wloc = 0.0; for(auto val : w) wloc += val;
+	
+	double woff = 0;                                                 // The cumulative weight on previous cores
+	MPI_Exscan(&wloc,&woff,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+	if(core == 0) woff = 0;
+	MPI_Allreduce(&wloc,&wtot,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+	if(!(wtot > 0)) emsgEC("Mpi",12);
+	
+	vector <unsigned int> num(n,0);
+	
+	switch(type){
+		case MULTINOMIAL_RESAMPLE: 
+			emsgroot("Multinomial resampling cannot be distributed across cores");
+			break;
+			
+		case RESIDUAL_RESAMPLE:                                        // Integer parts are copied and the remainder is
+			{                                                            // resampled systematically
+				vector <double> wres(n);
+				auto nloc = 0u;
+				for(auto i = 0u; i < n; i++){
+					auto val = nsamp*w[i]/wtot;
+					num[i] = (unsigned int)(val);
+					nloc += num[i];
+					wres[i] = val-num[i]; if(wres[i] < 0) wres[i] = 0;
+				}
+				
+				unsigned int nint;
+				MPI_Allreduce(&nloc,&nint,1,MPI_UNSIGNED,MPI_SUM,MPI_COMM_WORLD);
+				if(nint > nsamp) emsgEC("Mpi",13);
+				
+				if(nint < nsamp){
+					double wrestot;
+					auto numres = resample_number_distributed(wres,nsamp-nint,SYSTEMATIC_RESAMPLE,wrestot);
+					for(auto i = 0u; i < n; i++) num[i] += numres[i];
+				}
+			}
+			break;
+			
+		case SYSTEMATIC_RESAMPLE: case STRATIFIED_RESAMPLE:
+			{
+				auto u = ran(); bcast(u);                                  // The same offset is used on all cores
+				
+				auto fac = nsamp/wtot;
+				
+				unsigned int below_end = 0;                                // The number of points below the end of this core
+				if(n > 0) below_end = resample_below((woff+wloc)*fac,nsamp,type,u,resample_step);
+				if(core == ncore-1) below_end = nsamp;
+				
+				unsigned int below_start = 0;                              // Ensures the points on neighbouring cores are consistent
+				MPI_Exscan(&below_end,&below_start,1,MPI_UNSIGNED,MPI_MAX,MPI_COMM_WORLD);
+				if(core == 0) below_start = 0;
+				
+				num = resample_number_block(w,woff*fac,fac,nsamp,type,u,resample_step,below_start,below_end);
+			}
+			break;
+	}
+	resample_step++;
+	
+	return num;
+}
@@ -2,6 +2,7 @@
 #define BEEPMBP__MPI_HH
 
 #include "struct.hh"
+#include "lineage.hh"
 #include <fstream>
 
 struct Mpi {
@@ -19,11 +20,14 @@ public:
 	vector <ParamSample> gather_psamp(const vector <ParamSample> &psample);
 	vector <Particle> gather_particle(const vector <Particle> &part);
 	void exchange_samples(Generation &gen);
-	void end_sec_swap(vector <State> &particle, const unsigned int sett, const vector <unsigned int> &backpart, const unsigned int buffersize);
-	Particle particle_sample(const unsigned int ru, const vector < vector <unsigned int> > &backpart, vector <State> &particle, const ObservationModel &obsmodel);
+	vector <bool> end_sec_swap_start(vector <State> &particle, const unsigned int sett, const vector <unsigned int> &backpart, const unsigned int buffersize);
+	void end_sec_swap_progress();
+	void end_sec_swap_finish(vector <State> &particle);
+	Particle particle_sample(const unsigned int ru, const vector < vector <unsigned int> > &backpart, const vector <State> &particle, const LineageTree &lineage, const ObservationModel &obsmodel);
 		
 	vector <double> gather(const vector <double> &vec);
 	vector <unsigned int> gather(const vector <unsigned int> &vec);	
+	vector <unsigned int> allgather(const vector <unsigned int> &vec);
 	vector <long> gather(const long val);
 	vector <double> gather(const double val);
 	vector <double> scatter(const vector <double> &vectot);
@@ -33,6 +37,7 @@ public:
 	long sum(const long val);
 	double sum(const double val);
 	double average(const double val);
+	double max(const double val);
 	vector <double> average(const vector <double> &val);
 	double get_acrate(const unsigned int nac, const unsigned int ntr);
 	vector <double> get_acrate(const vector <unsigned int> &nac, const vector <unsigned int> &ntr);
@@ -47,9 +52,32 @@ public:
 	
 	vector <double> combine(const vector <double> &vec);
 	
+	vector <unsigned int> resample_number_distributed(const vector <double> &w, const unsigned int nsamp, const ResampleType type, double &wtot);
+	
+	void workqueue_start(const unsigned long nround);
+	unsigned int workqueue_next();
+	void workqueue_poll();
+	unsigned long workqueue_ndone() const;
+	
 private:
 	vector<double> buffer;                                              // Stores packed up information to be sent between cores
 	unsigned int k;                                                     // Indexes the buffer
+	unsigned long resample_step;                                        // Counts distributed resampling steps (addresses random streams)
+	
+	vector <MPI_Request> swap_reqs;                                     // Outstanding messages swapping particles at the end of a section
+	vector < vector <double> > swap_sendbuffer;                         // Buffers for the messages sent
+	vector < vector <double> > swap_recibuffer;                         // Buffers for the messages received
+	vector < vector <unsigned int> > swap_reclist;                      // The local particles set by each received message
+	unsigned int swap_sett;                                             // The time division at which particles are swapped
+	
+	unsigned long wq_nround;                                            // The total number of rounds of work in the queue
+	unsigned long wq_nleft;                                             // The number of rounds not yet handed out (core 0)
+	unsigned long wq_ndone;                                             // The number of rounds completed (core 0)
+	vector <unsigned int> wq_batch;                                     // The batch of rounds currently held by each core
+	unsigned int wq_nactive;                                            // The number of cores yet to be told the work is complete
+	
+	unsigned int workqueue_take();
+	void workqueue_serve(const unsigned int co);
 	
 	void pack_initialise(const size_t size);
 	void unpack_check();
@@ -78,6 +106,10 @@ private:
 	void pack_send(const unsigned int co);
 	void pack_recv(const unsigned int co);
 	void pack_bcast();
+	void pack_words(const vector <uint16_t> &code);
+	void unpack_words(vector <uint16_t> &code);
+	void pack_compact(const Tensor &ten, const unsigned int i0);
+	void unpack_compact(Tensor &ten, const unsigned int i0);
 	
 	void pack(const int num);
 	void pack(const unsigned int num);
@@ -94,6 +126,9 @@ private:
 	void pack(const vector< vector< vector <double> > > &vec);
 	void pack(const vector <string> &vec);
 	void pack(const Particle &part);
+	void pack(const Tensor &ten);
+	void pack(const Tensor &ten, const unsigned int i0);
+	void pack(const CompactTensor &ct);
 	void pack(const Observation &ob);
 	void pack(const Modification &cf);
 	void pack(const GenerateQ &genQ);
@@ -121,6 +156,9 @@ private:
 	void unpack(vector< vector< vector <double> > > &vec);
 	void unpack(vector <string> &vec);
 	void unpack(Particle &part);
+	void unpack(Tensor &ten);
+	void unpack(Tensor &ten, const unsigned int i0);
+	void unpack(CompactTensor &ct);
 	void unpack(Observation &ob);
 	void unpack(Modification &cf);
 	void unpack(GenerateQ &genQ);
@@ -1,6 +1,7 @@
 // This describes the observation model. This prescribes how likely the data is given a true event state.
 
 #include <cmath>
+#include <algorithm>
 
 using namespace std;
 
@@ -14,6 +15,8 @@ ObservationModel::ObservationModel(const Details &details, Data &data, const Mod
 {
 	initialise_obs_change();
 	
+	initialise_obs_end();
+	
 	if(details.mode == PMCMC_INF) split_observations();
 }
 
@@ -58,6 +61,96 @@ double ObservationModel::calculate_section(const State *state, unsigned int sec)
 }
 
 
+/// Adds the contribution from time division sett to obs_value and returns the observation probability
+/// from those observations which are complete at sett (used to incrementally calculate EF during a MBP)
+double ObservationModel::calculate_sett(const State *state, vector <double> &obs_value, const unsigned int sett) const
+{
+	timer[TIME_OBSPROB].start();
+	
+	get_obs_value_section(state,obs_value,sett,sett+1);
+	
+	auto L = 0.0; for(auto i : obs_end[sett]) L += obs_prob(obs_value[i],data.obs[i]);
+	
+	if(std::isnan(L)) emsgEC("ObsModel",7);
+	
+	timer[TIME_OBSPROB].stop();
+	
+	return L;
+}
+
+
+/// Calculates the error function and stores the observed quantities and the EF from each observation
+double ObservationModel::calculate_EF(const State *state, vector <double> &obs_value, vector <double> &obs_EF) const
+{
+	timer[TIME_OBSPROB].start();
+	
+	obs_value = get_obs_value(state);
+	
+	obs_EF.resize(data.nobs);
+	auto EF = 0.0; 
+	for(auto i = 0u; i < data.nobs; i++){
+		obs_EF[i] = -2*obs_prob(obs_value[i],data.obs[i]);
+		EF += obs_EF[i];
+	}
+	
+	if(std::isnan(EF)) emsgEC("ObsModel",9);
+	
+	timer[TIME_OBSPROB].stop();
+	
+	return EF;
+}
+
+
+/// Updates obs_value (from a reference state state_ref) using the changes to the state at time division sett
+/// Observations which change are added to obs_changed 
+void ObservationModel::update_obs_value(const State *state, const State *state_ref, const unsigned int sett, vector <double> &obs_value, vector <unsigned int> &obs_changed, vector <bool> &obs_flag) const
+{
+	timer[TIME_OBSPROB].start();
+	
+	auto use_transmean = (obsmodel_transmean == true && details.siminf == INFERENCE);
+	const auto &tn = use_transmean ? state->transmean : state->transnum;
+	const auto &tn_ref = use_transmean ? state_ref->transmean : state_ref->transnum;
+	
+	for(auto j = obs_trans.sett_start[sett]; j < obs_trans.sett_start[sett+1]; j++){
+		const auto &ce = obs_trans.cell[j];
+		auto num = tn(sett,ce.c,ce.i,ce.dp), num_ref = tn_ref(sett,ce.c,ce.i,ce.dp);
+		for(auto k = obs_trans.cell_start[j]; k < obs_trans.cell_start[j+1]; k++){
+			auto spl = obs_trans.factor_spline[k];
+			double dif;
+			if(spl == UNSET) dif = num - num_ref;
+			else dif = num*state->disc_spline[spl][sett] - num_ref*state_ref->disc_spline[spl][sett];
+			
+			if(dif != 0){
+				auto ob = obs_trans.obs[k];
+				obs_value[ob] += obs_trans.factor[k]*dif;
+				if(obs_flag[ob] == false){ obs_flag[ob] = true; obs_changed.push_back(ob);}
+			}
+		}
+	}
+	
+	for(auto j = obs_pop.sett_start[sett]; j < obs_pop.sett_start[sett+1]; j++){
+		const auto &ce = obs_pop.cell[j];
+		auto dif = state->pop(sett,ce.c,ce.i,ce.dp) - state_ref->pop(sett,ce.c,ce.i,ce.dp);
+		if(dif != 0){
+			for(auto k = obs_pop.cell_start[j]; k < obs_pop.cell_start[j+1]; k++){
+				auto ob = obs_pop.obs[k];
+				obs_value[ob] += obs_pop.factor[k]*dif;
+				if(obs_flag[ob] == false){ obs_flag[ob] = true; obs_changed.push_back(ob);}
+			}
+		}
+	}
+	
+	timer[TIME_OBSPROB].stop();
+}
+
+
+/// The contribution to the error function from observation i given the observed quantity value
+double ObservationModel::obs_EF(const unsigned int i, const double value) const
+{
+	return -2*obs_prob(value,data.obs[i]);
+}
+
+
 /// Uses precalculated quantities to calculate measured quantities faster
 vector <double> ObservationModel::get_obs_value(const State *state) const
 {
@@ -73,36 +166,27 @@ vector <double> ObservationModel::get_obs_value(const State *state) const
 /// Gets the observation values within a given time period
 void ObservationModel::get_obs_value_section(const State *state,  vector <double> &obs_value, const unsigned int ti, const unsigned int tf) const
 {
+	auto use_transmean = (obsmodel_transmean == true && details.siminf == INFERENCE);
+	const auto &tn = use_transmean ? state->transmean : state->transnum;
+	
 	for(auto sett = ti; sett < tf; sett++){
-		for(auto c = 0u; c < data.narea; c++){
-			for(auto tr = 0u; tr < model.trans.size(); tr++){
-				for(auto dp = 0u; dp < data.ndemocatpos; dp++){
-					double num;
-					if(obsmodel_transmean == true && details.siminf == INFERENCE) num = state->transmean[sett][c][tr][dp];
-					else num = state->transnum[sett][c][tr][dp];
-					
-					if(num != 0){
-						for(auto ob : obs_trans[sett][c][tr][dp]){
-							auto spl = data.obs[ob].factor_spline;
-							if(spl == UNSET) obs_value[ob] += data.obs[ob].factor*num;
-							else obs_value[ob] += data.obs[ob].factor*num*state->disc_spline[spl][sett];
-						}
-					}
+		for(auto j = obs_trans.sett_start[sett]; j < obs_trans.sett_start[sett+1]; j++){
+			const auto &ce = obs_trans.cell[j];
+			auto num = tn(sett,ce.c,ce.i,ce.dp);
+			if(num != 0){
+				for(auto k = obs_trans.cell_start[j]; k < obs_trans.cell_start[j+1]; k++){
+					auto spl = obs_trans.factor_spline[k];
+					if(spl == UNSET) obs_value[obs_trans.obs[k]] += obs_trans.factor[k]*num;
+					else obs_value[obs_trans.obs[k]] += obs_trans.factor[k]*num*state->disc_spline[spl][sett];
 				}
 			}
-			
-			for(auto co = 0u; co < model.comp.size(); co++){
-				for(auto dp = 0u; dp < data.ndemocatpos; dp++){
-					if(obs_pop[sett][c][co][dp].size() > 0){
-						auto num = state->pop[sett][c][co][dp];
-						for(auto ob : obs_pop[sett][c][co][dp]){
-							auto spl = data.obs[ob].factor_spline;
-							if(spl != UNSET) emsgEC("ObsModel",3);
-							if(spl == UNSET) obs_value[ob] += data.obs[ob].factor*num;
-							else obs_value[ob] += data.obs[ob].factor*num*state->disc_spline[spl][sett];
-						}
-					}
-				}
+		}
+		
+		for(auto j = obs_pop.sett_start[sett]; j < obs_pop.sett_start[sett+1]; j++){
+			const auto &ce = obs_pop.cell[j];
+			auto num = state->pop(sett,ce.c,ce.i,ce.dp);
+			for(auto k = obs_pop.cell_start[j]; k < obs_pop.cell_start[j+1]; k++){
+				obs_value[obs_pop.obs[k]] += obs_pop.factor[k]*num;
 			}
 		}
 	}
@@ -173,47 +257,122 @@ vector < vector <double> > ObservationModel::get_graph_state(const State *state)
 /// Initialises quantities related to how Measurements change when a transition changes
 void ObservationModel::initialise_obs_change()
 {
-	obs_trans.resize(details.ndivision);
-	for(auto sett = 0u; sett < details.ndivision; sett++){
-		obs_trans[sett].resize(data.narea); obs_trans[sett].resize(data.narea);
-		for(auto c = 0u; c < data.narea; c++){
-			obs_trans[sett][c].resize(model.trans.size());
-			for(auto tr = 0u; tr < model.trans.size(); tr++){
-				obs_trans[sett][c][tr].resize(data.ndemocatpos);
+	obs_trans = create_obs_index(true);
+	obs_pop = create_obs_index(false);
+}
+
+
+/// Creates a compressed sparse index linking transitions (or populations) to observations
+ObsIndex ObservationModel::create_obs_index(const bool trans) const
+{
+	struct Link { unsigned int sett, c, i, dp, ob;};
+	
+	vector <Link> link;
+	for(auto ob = 0u; ob < data.nobs; ob++){
+		const auto &obs = data.obs[ob];
+		const auto &list = trans ? data.datatable[obs.datatable].translist : data.datatable[obs.datatable].complist;
+		if(list.size() > 0 && trans == false && obs.factor_spline != UNSET) emsgEC("ObsModel",3);
+		
+		for(auto sett = obs.sett_i; sett < obs.sett_f; sett++){
+			for(auto c : obs.area){
+				for(auto dp : obs.dp_sel){
+					for(auto i : list) link.push_back(Link{sett,c,i,dp,ob});
+				}
 			}
 		}
 	}
 	
-	obs_pop.resize(details.ndivision);
-	for(auto sett = 0u; sett < details.ndivision; sett++){
-		obs_pop[sett].resize(data.narea);
-		for(auto c = 0u; c < data.narea; c++){
-			obs_pop[sett][c].resize(model.comp.size());
-			for(auto co = 0u; co < model.comp.size(); co++){
-				obs_pop[sett][c][co].resize(data.ndemocatpos);
-			}			
+	sort(link.begin(),link.end(),[](const Link &a, const Link &b){
+		if(a.sett != b.sett) return a.sett < b.sett;
+		if(a.c != b.c) return a.c < b.c;
+		if(a.i != b.i) return a.i < b.i;
+		if(a.dp != b.dp) return a.dp < b.dp;
+		return a.ob < b.ob;
+	});
+	
+	ObsIndex index;
+	index.sett_start.resize(details.ndivision+1);
+	
+	auto sett = 0u;
+	for(auto k = 0u; k < link.size(); k++){
+		const auto &li = link[k];
+		if(k == 0 || li.sett != link[k-1].sett || li.c != link[k-1].c || li.i != link[k-1].i || li.dp != link[k-1].dp){
+			while(sett <= li.sett){ index.sett_start[sett] = index.cell.size(); sett++;}
+			index.cell_start.push_back(k);
+			index.cell.push_back(ObsCell{li.c,li.i,li.dp});
 		}
+		
+		const auto &obs = data.obs[li.ob];
+		index.obs.push_back(li.ob);
+		index.factor.push_back(obs.factor);
+		index.factor_spline.push_back(obs.factor_spline);
 	}
+	while(sett <= details.ndivision){ index.sett_start[sett] = index.cell.size(); sett++;}
+	index.cell_start.push_back(link.size());
+	
+	return index;
+}
+
+
+/// Works out which observations end at each time division, along with a lower bound on the EF from later observations
+void ObservationModel::initialise_obs_end()
+{
+	obs_end.resize(details.ndivision);
+	
+	vector <double> EFmin(details.ndivision);
+	for(auto sett = 0u; sett < details.ndivision; sett++) EFmin[sett] = 0;
 	
 	for(auto i = 0u; i < data.nobs; i++){
-		auto &ob = data.obs[i];
-		
-		auto dt = ob.datatable;
+		const auto &ob = data.obs[i];
+		if(ob.sett_f == 0 || ob.sett_f > details.ndivision) emsgEC("ObsModel",8);
 		
-		for(auto sett = ob.sett_i; sett < ob.sett_f; sett++){
-			for(auto c : ob.area){
-				for(auto dp : ob.dp_sel){
-					for(auto tr : data.datatable[dt].translist){					
-						obs_trans[sett][c][tr][dp].push_back(i);
-					}
-					
-					for(auto co : data.datatable[dt].complist){	
-						obs_pop[sett][c][co][dp].push_back(i);
-					}
+		obs_end[ob.sett_f-1].push_back(i);
+		EFmin[ob.sett_f-1] += obs_EF_min(ob);
+	}
+	
+	EFmin_after.resize(details.ndivision);
+	auto sum = 0.0;
+	for(int sett = details.ndivision-1; sett >= 0; sett--){
+		EFmin_after[sett] = sum;
+		sum += EFmin[sett];
+	}
+	
+	vector <unsigned int> sett_first(data.nobs);                      // The first division contributing to each observation
+	for(auto i = 0u; i < data.nobs; i++) sett_first[i] = data.obs[i].sett_f-1;
+	for(const auto *ind : {&obs_trans, &obs_pop}){
+		for(auto sett = 0u; sett < details.ndivision; sett++){
+			for(auto j = ind->sett_start[sett]; j < ind->sett_start[sett+1]; j++){
+				for(auto k = ind->cell_start[j]; k < ind->cell_start[j+1]; k++){
+					auto ob = ind->obs[k];
+					if(sett < sett_first[ob]) sett_first[ob] = sett;
 				}
 			}
 		}
 	}
+	
+	obs_open.resize(details.ndivision);
+	for(auto i = 0u; i < data.nobs; i++){
+		for(auto sett = sett_first[i]+1; sett < data.obs[i].sett_f; sett++) obs_open[sett].push_back(i);
+	}
+}
+
+
+/// The minimum possible contribution an observation can make to the error function EF = -2*log(obsmodel)
+double ObservationModel::obs_EF_min(const Observation& ob) const
+{
+	if(ob.value == UNKNOWN) return 0;
+	
+	switch(ob.obsmodel){
+		case LOADSD_OBSMODEL:                                           // Normal densities can exceed one 
+			if(ob.sd == 0) return -LARGE;
+			return ob.w*ob.invT*log(2*M_PI*ob.sd*ob.sd);
+		
+		case NORMAL_OBSMODEL: 
+			return ob.w*ob.invT*log(2*M_PI);
+		
+		default:                                                        // Other models give probabilities below one
+			return 0;
+	}
 }
 
 
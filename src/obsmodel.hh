@@ -12,6 +12,10 @@ class ObservationModel
 		
 		double calculate(const State *state) const;
 		double calculate_section(const State *state, unsigned int sec) const;
+		double calculate_sett(const State *state, vector <double> &obs_value, const unsigned int sett) const;
+		double calculate_EF(const State *state, vector <double> &obs_value, vector <double> &obs_EF) const;
+		void update_obs_value(const State *state, const State *state_ref, const unsigned int sett, vector <double> &obs_value, vector <unsigned int> &obs_changed, vector <bool> &obs_flag) const;
+		double obs_EF(const unsigned int i, const double value) const;
 		vector <double> get_EF_datatable(const State *state) const;
 		vector <double> get_obs_value(const State *state) const;
 		vector < vector <double> > get_graph_state(const State *state) const;
@@ -20,16 +24,25 @@ class ObservationModel
 		vector <unsigned int> section_ti;             
 		vector <unsigned int> section_tf;
 		
+		vector <double> EFmin_after;                               // Lower bound on the EF from observations ending after sett
+		
+		vector < vector <unsigned int> > obs_open;                 // The observations which span the start of sett (started earlier, end at or after sett)
+		
 	private:
 		void initialise_obs_change();
+		ObsIndex create_obs_index(const bool trans) const;
 		void split_observations();
+		void initialise_obs_end();
+		double obs_EF_min(const Observation& ob) const;
 		void get_obs_value_section(const State *state,  vector <double> &obs_value, const unsigned int ti, const unsigned int tf) const;
 		double obs_prob(double value, const Observation& ob) const;
 		
 		vector < vector <unsigned int> > section_obs;              // Stores the observations in each section
 		
-		vector < vector <vector < vector < vector <unsigned int> > > > > obs_trans; // Observation in  transition [sett][c][tr][dp]
-		vector < vector <vector < vector < vector <unsigned int> > > > > obs_pop;   // Observation in population [sett][c][co][dp]
+		vector < vector <unsigned int> > obs_end;                  // The observations whose last time division is sett
+		
+		ObsIndex obs_trans;                                        // Links transitions [sett][c][tr][dp] to observations
+		ObsIndex obs_pop;                                          // Links populations [sett][c][co][dp] to observations
 				
 		const Details &details;
 		const Data &data;
@@ -882,7 +882,7 @@ void Output::spline_plots(const vector <Sample> &opsamp, vector <OutputPlot> &op
 		if(details.mode == SIM) sim_spline_output = opsamp[0].spline_output;
 		else{
 			vector <double> vec; for(auto par : model.param) vec.push_back(par.value);	
-			sim_spline_output = model.get_spline_output(vec,vector < vector < vector < vector <double> > > > ());
+			sim_spline_output = model.get_spline_output(vec,Tensor());
 		}
 	}
 	
@@ -12,6 +12,7 @@ using namespace std;
 #include "pais.hh"
 #include "inputs.hh"
 #include "output.hh"
+#include "resample.hh"
 
 /// Initilaises the PAIS class
 PAIS::PAIS(const Details &details, const Data &data, const Model &model, Inputs &inputs, const Output &output, const ObservationModel &obsmodel, Mpi &mpi) : state(details,data,model,obsmodel), mbp(INVT,details,data,model,obsmodel,output,mpi), paramprop(details,data,model,output,mpi), details(details), data(data), model(model), output(output), obsmodel(obsmodel),mpi(mpi)
@@ -21,6 +22,7 @@ PAIS::PAIS(const Details &details, const Data &data, const Model &model, Inputs
 	inputs.find_GRmax_nupdate(GRmax,nrun,nupdate);
 	inputs.find_nparticle(npart,Ntot,N,nrun,mpi.ncore);
 	inputs.find_quench_factor(quench_factor);
+	inputs.find_resample(resample);
 	part.resize(N);
 	partcopy.resize(Ntot);	
 }
@@ -33,7 +35,7 @@ void PAIS::run()
 		timer[TIME_ALG].start();
 		
 		Generation gen;
-		gen.time = clock();
+		gen.time = wall_clock();
 		
 		if(g == 0){                                             // For the first generation sample states from the prior
 			gen.invT = 0;                                         // Starts at zero inverse temperature (i.e. the prior)
@@ -86,10 +88,11 @@ void PAIS::run()
 /// Stores a sample from each of the particles 
 void PAIS::store_sample(Generation &gen)
 {
-	for(const auto &pa : part){
+	for(auto &pa : part){
 		gen.param_samp.push_back(pa.create_param_samp());
-		state.initialise_from_particle(pa);
+		state.adopt_particle(pa);                               // The particle is lent to the state (avoiding copies)
 		gen.EF_datatable.push_back(obsmodel.get_EF_datatable(&state));
+		state.release_particle(pa);
 	}
 }
 
@@ -135,40 +138,18 @@ void PAIS::bootstrap(Generation &gen, vector<Particle> &part, vector <unsigned i
 			if(invT+DinvT > invT_final) DinvT = invT_final-invT;   // Limits invT to invT_final
 		}
 		
-		vector <double> wsum(npart);                             // Weights particles
+		vector <double> w(npart);                                // Weights particles
 		vector <unsigned int> num(npart);   
 		for(auto ru = 0u; ru < nrun; ru++){
-			auto sum = 0.0;
-			for(auto j = 0u; j < npart; j++){
-				sum += exp(-0.5*DinvT*(EFtot[ru*npart + j]-muav));
-				wsum[j] = sum;
-			}
-		
-	    for(auto j = 0u; j < npart; j++) num[j] = 0;            // Performs a bootstrap step
-
-			for(auto j = 0u; j < npart; j++){                       // Samples in proportion to particle weights
-				auto z = ran()*sum;
-				auto sel=0u; while(sel < npart && z > wsum[sel]) sel++;
-				if(sel == npart) emsgEC("PAIS",1);
-				num[sel]++;
-			}
+			for(auto j = 0u; j < npart; j++) w[j] = exp(-0.5*DinvT*(EFtot[ru*npart + j]-muav));
 		
-			vector <unsigned int> list;                             // Works out which particles to copy and which to discard
-			for(auto j = 0u; j < npart; j++){     
-				if(num[j] > 1){ for(auto k = 1u; k < num[j]; k++) list.push_back(ru*npart+j);}
-			}
-		
-			if(false) cout << npart - list.size() << " / "<< npart << " Particles kept" << endl;
-			 
+			num = resample_number(w,npart,resample);                // Performs a bootstrap step
+			auto anc = resample_ancestor(num);                      // Works out which particles to copy and which to discard
+			
 			for(auto j = 0u; j < npart; j++){  
-				if(num[j] > 0) partcopy[ru*npart + j] = UNSET;
-				else{
-					if(list.size() == 0) emsgEC("PAIS",2);
-					partcopy[ru*npart + j] = list[list.size()-1];
-					list.pop_back();
-				}
+				if(anc[j] == j) partcopy[ru*npart + j] = UNSET;
+				else partcopy[ru*npart + j] = ru*npart + anc[j];
 			}
-			if(list.size() != 0) emsgEC("PAIS",3);
 		}
 		
 		if(false){
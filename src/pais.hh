@@ -41,6 +41,8 @@ private:
 	unsigned int loop;                       // Stores the number of iterations of MCMC update
 	
 	double quench_factor;                    // Parameter that determines how quickly the PAIC algorithm quenches
+
+	ResampleType resample;                   // The scheme used to resample particles
 		
 	State state;                             // Stores the state of the system
 		
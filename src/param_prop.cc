@@ -372,6 +372,34 @@ void ParamProp::update_proposals()
 }
 
 
+/// Gets the sizes of proposals (used to pass tuning between chains when MC3 swaps temperatures)
+/// The number of fixedtree and slicetime proposals can vary between chains, so these are not included
+vector <double> ParamProp::get_sizes() const
+{
+	vector <double> vec;
+	for(const auto &mv : mvn) vec.push_back(mv.size);
+	for(const auto &mt : mean_time) vec.push_back(mt.size);
+	for(const auto &rn : neighbour) vec.push_back(rn.size);
+	for(const auto &jo : joint) vec.push_back(jo.size);
+	for(const auto &ca : covar_area) vec.push_back(ca.size);
+	return vec;
+}
+
+
+/// Sets the sizes of proposals (from a vector given by get_sizes)
+void ParamProp::set_sizes(const vector <double> &vec)
+{
+	if(vec.size() != mvn.size()+mean_time.size()+neighbour.size()+joint.size()+covar_area.size()) emsgEC("ParamProp",4);
+	
+	auto i = 0u;
+	for(auto &mv : mvn){ mv.size = vec[i]; i++;}
+	for(auto &mt : mean_time){ mt.size = vec[i]; i++;}
+	for(auto &rn : neighbour){ rn.size = vec[i]; i++;}
+	for(auto &jo : joint){ jo.size = vec[i]; i++;}
+	for(auto &ca : covar_area){ ca.size = vec[i]; i++;}
+}
+
+
 /// Sets the acceptance rate (PMCMC)
 void ParamProp::set_ac_rate()
 {	
@@ -129,6 +129,8 @@ public:
 	void update_splicetime();
 	void diagnostics() const;
 	void set_ac_rate();
+	vector <double> get_sizes() const;
+	void set_sizes(const vector <double> &vec);
 	
 	vector <double> variance_vector(const vector <ParamSample> &param_samp) const;
 	string print_proposal_information(const bool brief) const;
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <fstream>   
 #include <cmath>
+#include <algorithm>
 
 using namespace std;
 
@@ -12,15 +13,21 @@ using namespace std;
 #include "pmcmc.hh"
 #include "mpi.hh"
 #include "output.hh"
+#include "resample.hh"
 
 PMCMC::PMCMC(const Details &details, const Data &data, const Model &model, Inputs &inputs, Output &output, const ObservationModel &obsmodel, Mpi &mpi) : paramprop(details,data,model,output,mpi), details(details), data(data), model(model), output(output), obsmodel(obsmodel), mpi(mpi)
 {
 	inputs.find_nrun(nrun);
-	inputs.find_nparticle_pmcmc(Ntot,N,mpi.ncore);
+	inputs.find_nparticle_pmcmc(Ntot,N,mpi.ncore,npart_tune);
+	loglike_var = inputs.find_double("loglike_var",1);
+	if(loglike_var <= 0) emsgroot("'loglike_var' must be positive");
 	inputs.find_nsample_GRmax(nsample,GRmax,nrun);
 	inputs.find_nburnin(nburnin,nsample);
 	inputs.find_nthin(thin,nsample);
 	invT = inputs.find_double("invT",UNSET); 
+	inputs.find_resample(resample);
+	cpm_rho = inputs.find_double("pmcmc_correlation",0);
+	if(cpm_rho < 0 || cpm_rho >= 1) emsgroot("'pmcmc_correlation' must be between zero and one");
 	initialise_variables();
 	
 	percentage = UNSET;
@@ -50,11 +57,17 @@ void PMCMC::run()
 		}
 		
 		if(samp%10 == 0) get_proposals();                                      // Gets a list of proposals used as an "update"
+		
+		if(samp == 0 && npart_tune == true && core == 0){
+			cout << "Expected wall-clock time per MCMC update: " << time_eval*prop_list.size()*nrun << "s" << endl << endl;
+		}
 
 		for(auto ru = 0u; ru < nrun; ru++){
 			Li = Li_run[ru]; Pi = Pi_run[ru]; Pri = Pri_run[ru];                 // Loads stored values for run
 			
+			run_cur = ru;
 			mcmc_updates();                                                      // Performs the MCMC updates
+			aux_update();                                                        // Resolves the final proposal
 
 			if(core == 0 && burnin == true){                                     // Samples adaptively improving proposals
 				ParamSample ps; ps.paramval = Pi.paramval; ps.run = UNSET; ps.EF = Li;
@@ -64,6 +77,7 @@ void PMCMC::run()
 			if(core == 0 && burnin == false && samp%thin == 0){                  // Stores samples for plotting later
 				Pi.run = ru;
 				particle_store.push_back(Pi);
+				particle_store.back().compact();                             // Reduces the memory used to store the particle
 			}
 			
 			Li_run[ru] = Li; Pi_run[ru] = Pi; Pri_run[ru] = Pri;                 // Saves stored values for run
@@ -97,11 +111,15 @@ void PMCMC::update_burnin(const unsigned int samp)
 /// Initialises quantities in the class
 void PMCMC::initialise()
 {
-	for(auto p = 0u; p < N; p++) particle.push_back(State(details,data,model,obsmodel));
+	set_particle_number(Ntot);
+	
+	aux_pending = false; aux_accept = 0;
 		
 	auto ninit_samp = 10u;
 	
 	for(auto ru = 0u; ru < nrun; ru++){                              // Goes over all the runs
+		run_cur = ru;
+		aux_fresh = true;                                              // Initial states use newly drawn auxiliary normals
 		Li_run[ru] = -LARGE;
 		for(auto i = 0u; i < ninit_samp; i++){                         // Randomly samples parameters / states and picks the best
 			if(core == 0){
@@ -116,9 +134,14 @@ void PMCMC::initialise()
 			
 			if(Li > Li_run[ru]){
 				Li_run[ru] = Li;
-				Pi_run[ru] = mpi.particle_sample(ru,backpart,particle,obsmodel);
+				Pi_run[ru] = mpi.particle_sample(ru,backpart,particle,lineage,obsmodel);
+				if(cpm_rho > 0){
+					for(auto p = 0u; p < N; p++) aux_run[ru][p].swap(aux_prop[p]);
+					auxres_run[ru].swap(auxres_prop);
+				}
 			}
 		}
+		aux_fresh = false;
 			
 		if(core == 0){
 			// This generates parameter samples near to the intial set (for the initial normal and MVN proposal distributions)
@@ -135,6 +158,124 @@ void PMCMC::initialise()
 		
 		if(core == 0) Pri_run[ru] = model.prior(Pi.paramval);
 	}
+	
+	if(npart_tune == true){                                          // Tunes the number of particles
+		tune_particle_number();
+		
+		for(auto ru = 0u; ru < nrun; ru++){                            // Estimates the likelihood with the new number
+			run_cur = ru;
+			aux_fresh = true;
+			Li_run[ru] = obs_prob(Pi_run[ru].paramval);
+			mpi.bcast(Li_run[ru]);
+			Pi_run[ru] = mpi.particle_sample(ru,backpart,particle,lineage,obsmodel);
+			if(cpm_rho > 0){
+				for(auto p = 0u; p < N; p++) aux_run[ru][p].swap(aux_prop[p]);
+				auxres_run[ru].swap(auxres_prop);
+			}
+		}
+		aux_fresh = false;
+	}
+}
+
+
+/// Sets the total number of particles (which are split equally between cores)
+void PMCMC::set_particle_number(const unsigned int Ntot_new)
+{
+	Ntot = Ntot_new;
+	N = Ntot/mpi.ncore;
+	
+	while(particle.size() > N) particle.pop_back();
+	while(particle.size() < N){
+		particle.push_back(State(details,data,model,obsmodel));
+		particle.back().set_window(nwindow);                           // Only the current section is stored
+	}
+	for(auto p = 0u; p < N; p++) particle[p].rng_particle = mpi.core*N+p;  // Random numbers depend on the global particle number 
+	
+	for(auto sec = 0u; sec <= obsmodel.nsection; sec++) backpart[sec].resize(Ntot);
+	
+	if(cpm_rho > 0){                                                 // Allocates the auxiliary normals 
+		auto ntr = model.trans.size();                                 // These cover the entire time period
+		aux_run.resize(nrun); auxres_run.resize(nrun);
+		for(auto ru = 0u; ru < nrun; ru++){
+			aux_run[ru].resize(N);
+			for(auto p = 0u; p < N; p++) aux_run[ru][p].resize(details.ndivision,data.narea,ntr,data.ndemocatpos);
+			auxres_run[ru].resize(obsmodel.nsection,0);
+		}
+		
+		aux_prop.resize(N);
+		for(auto p = 0u; p < N; p++){
+			aux_prop[p].resize(details.ndivision,data.narea,ntr,data.ndemocatpos);
+			particle[p].aux_prop = &aux_prop[p];
+			particle[p].aux_rho = cpm_rho;
+		}
+		auxres_prop.resize(obsmodel.nsection,0);
+	}
+}
+
+
+/// Selects the number of particles such that the variance in the estimated log-likelihood reaches 'loglike_var'
+/// The variance is estimated at a pilot parameter set (the initial state of the first run) for a sequence of 
+/// particle numbers and is assumed to scale as 1/N. It is calculated from the differences between successive 
+/// estimates, so in the correlated pseudo-marginal case it accounts for the correlation between them.
+void PMCMC::tune_particle_number()
+{
+	if(core == 0) cout << "Tuning the number of particles..." << endl;
+	
+	auto paramv = Pi_run[0].paramval;
+	
+	vector <double> Nst, varst;
+	auto time_part = 0.0;                                            // The wall-clock time per particle per estimate
+	auto Nsel = Ntot, Ntry = Ntot;
+	for(auto loop = 0u; loop < 4; loop++){
+		set_particle_number(Ntry);
+		
+		run_cur = 0;
+		aux_fresh = true;
+		vector <double> Lst;
+		auto t = wall_clock();
+		for(auto r = 0u; r < particle_tune_nrep; r++){
+			Lst.push_back(obs_prob(paramv));
+			if(cpm_rho > 0){                                             // The auxiliary normals follow a chain
+				for(auto p = 0u; p < N; p++) aux_run[0][p].swap(aux_prop[p]);
+				auxres_run[0].swap(auxres_prop);
+				aux_fresh = false;
+			}
+		}
+		time_part = mpi.max(double(wall_clock()-t)/(double(CLOCKS_PER_SEC)*particle_tune_nrep*N)); // The slowest core sets the time
+		
+		auto var = 0.0;                                                // Half the mean squared successive difference
+		if(core == 0){
+			for(auto r = 1u; r < particle_tune_nrep; r++) var += (Lst[r]-Lst[r-1])*(Lst[r]-Lst[r-1]);
+			var /= 2*(particle_tune_nrep-1);
+		}
+		mpi.bcast(var);
+		
+		Nst.push_back(Ntot); varst.push_back(var);
+		if(core == 0) cout << "  " << Ntot << " particles: log-likelihood variance " << var << endl;
+		
+		auto num = 0.0, den = 0.0;                                     // Least squares fit of var = c/N
+		for(auto i = 0u; i < Nst.size(); i++){ num += varst[i]/Nst[i]; den += 1.0/(Nst[i]*Nst[i]);}
+		auto Nopt = (num/den)/loglike_var;
+		
+		auto ncore = mpi.ncore;                                        // Rounds up to a multiple of the number of cores
+		auto Nmax = ncore*(particle_tune_max/ncore); if(Nmax == 0) Nmax = ncore;
+		if(Nopt >= Nmax) Nsel = Nmax;
+		else{
+			Nsel = ncore*(unsigned int)(ceil(Nopt/ncore));
+			if(Nsel < ncore) Nsel = ncore;
+		}
+		
+		if(10*Nsel >= 9*Ntot && 9*Nsel <= 10*Ntot) break;              // Stops when within about 10%
+		Ntry = Nsel;
+	}
+	
+	set_particle_number(Nsel);
+	
+	time_eval = time_part*N;
+	if(core == 0){
+		cout << "Selected " << Ntot << " particles (" << N << " per core)." << endl;
+		cout << "Expected wall-clock time per likelihood estimate: " << time_eval << "s" << endl;
+	}
 }
 	
 
@@ -146,20 +287,49 @@ double PMCMC::obs_prob(vector <double> &paramv)
 	mpi.bcast(paramv);
 
 	for(auto p = 0u; p < N; p++) particle[p].set_param(paramv);
+	
+	if(cpm_rho > 0){                                                 // Simulations are driven by the auxiliary normals
+		for(auto p = 0u; p < N; p++){
+			if(aux_fresh == true) particle[p].aux = NULL; else particle[p].aux = &aux_run[run_cur][p];
+		}
+	}
 
-	vector <double> L(N);
+	vector <double> L(N), S(N);
+	
+	lineage.initialise(obsmodel.nsection,Ntot,mpi.core*N,N);
 	
 	auto obprob = 0.0; 
 	for(auto sec = 0u; sec < obsmodel.nsection; sec++){
-		if(sec > 0) mpi.end_sec_swap(particle,obsmodel.section_ti[sec],backpart[sec],buffersize);
-
-		for(auto p = 0u; p < N; p++){ 	
-			particle[p].simulate(obsmodel.section_ti[sec],obsmodel.section_tf[sec]);
+		auto ti = obsmodel.section_ti[sec], tf = obsmodel.section_tf[sec];
+		
+		auto sim = [&](const unsigned int p){
+			particle[p].simulate(ti,tf);
 		
 			L[p] = obsmodel.calculate_section(&particle[p],sec);
+			if(cpm_rho > 0){                                             // Summarises the state at the end of the section
+				auto t = tf; if(t > details.ndivision-1) t = details.ndivision-1;
+				S[p] = particle[p].infected_total(t);
+			}
+			
+			lineage.store(sec,mpi.core*N+p,particle[p].transnum,ti,tf);  // Adds the section to the ancestral tree
+		};
+		
+		if(sec == 0){
+			for(auto p = 0u; p < N; p++) sim(p);
+		}
+		else{                                                          // Particles with local ancestors are simulated 
+			auto ready = mpi.end_sec_swap_start(particle,ti,backpart[sec],buffersize); // while others are transferred
+			for(auto p = 0u; p < N; p++){
+				if(ready[p] == true){ sim(p); mpi.end_sec_swap_progress();}
+			}
+			
+			mpi.end_sec_swap_finish(particle);
+			for(auto p = 0u; p < N; p++){ if(ready[p] == false) sim(p);}
 		}
 	
-		obprob += bootstrap(sec,L);
+		obprob += bootstrap(sec,L,S);
+		
+		lineage.prune(sec,backpart);                                   // Removes pieces with no descendants
 		
 		if(std::isnan(obprob) || std::isinf(obprob)) emsgEC("PMCMC",1);
 	}
@@ -171,57 +341,52 @@ double PMCMC::obs_prob(vector <double> &paramv)
 
 
 /// Performs the bootstrap step which randomly selects particles based on their observation probability
-double PMCMC::bootstrap(const unsigned int sec, vector <double> &L)
+double PMCMC::bootstrap(const unsigned int sec, vector <double> &L, const vector <double> &S)
 {
 	timer[TIME_BOOTSTRAP].start();
 	
-	vector <double> w(Ntot), wsum(Ntot);
-	
-	auto Ltot = mpi.gather(L);
-
 	auto obprob = 0.0;
-	auto sum = 0.0;
-	if(core == 0){	
-		double Lmax = -LARGE; 
-		for(auto p = 0u; p < Ntot; p++){
-			if(Ltot[p] > Lmax) Lmax = Ltot[p];
-		}
-	
-		for(auto p = 0u; p < Ntot; p++){
-			w[p] = exp(Ltot[p]-Lmax);
-			sum += w[p];
-			wsum[p] = sum;
-		}
-	
-		obprob = Lmax + log(sum/Ntot);
-	}
-	
 	auto &bp = backpart[sec+1];
 		
-	if(core == 0){
-		for(auto p = 0u; p < Ntot; p++) bp[p] = UNSET;
-		 
-		vector <unsigned int> extra; 
-	
-		for(auto p = 0u; p < Ntot; p++){
-			auto z = ran()*sum;
-			auto pp = 0u; while(pp < Ntot && z > wsum[pp]) pp++;
-			if(pp == Ntot) emsgEC("PMCMC",2);
-			
-			if(bp[pp] == UNSET) bp[pp] = pp;
-			else extra.push_back(pp);	
-		}
+	if(resample != MULTINOMIAL_RESAMPLE && mpi.ncore > 1 && cpm_rho == 0){ // Weights are calculated on each core
+		auto Lmax = -LARGE; 
+		for(auto p = 0u; p < N; p++){ if(L[p] > Lmax) Lmax = L[p];}
+		Lmax = mpi.max(Lmax);
 		
-		for(auto p = 0u; p < Ntot; p++){  
-			if(bp[p] == UNSET){
-				auto pp = extra[extra.size()-1]; extra.pop_back();
-				bp[p] = pp;
+		vector <double> w(N);
+		for(auto p = 0u; p < N; p++) w[p] = exp(L[p]-Lmax);
+		
+		double wtot;
+		auto num = mpi.resample_number_distributed(w,Ntot,resample,wtot);
+		obprob = Lmax + log(wtot/Ntot);
+		
+		bp = resample_ancestor_blocks(mpi.allgather(num),mpi.ncore);   // Every core finds the same ancestors
+	}
+	else{
+		auto Ltot = mpi.gather(L);
+		vector <double> Stot; if(cpm_rho > 0) Stot = mpi.gather(S);
+
+		if(core == 0){	
+			double Lmax = -LARGE; 
+			for(auto p = 0u; p < Ntot; p++){
+				if(Ltot[p] > Lmax) Lmax = Ltot[p];
+			}
+		
+			vector <double> w(Ntot);
+			auto sum = 0.0;
+			for(auto p = 0u; p < Ntot; p++){
+				w[p] = exp(Ltot[p]-Lmax);
+				sum += w[p];
 			}
+		
+			obprob = Lmax + log(sum/Ntot);
+			
+			if(cpm_rho > 0) bp = resample_ancestor_blocks(resample_correlated(sec,Stot,w),mpi.ncore);
+			else bp = resample_ancestor_blocks(resample_number(w,Ntot,resample),mpi.ncore);
 		}
-		if(extra.size() != 0) emsgEC("PMCMC",3);
+		
+		mpi.bcast(bp);
 	}
-
-	mpi.bcast(bp);
 	
 	timer[TIME_BOOTSTRAP].stop();
 	
@@ -229,6 +394,33 @@ double PMCMC::bootstrap(const unsigned int sec, vector <double> &L)
 }
 
 
+/// Resampling used by the correlated pseudo-marginal method
+/// Systematic resampling is driven by an auxiliary normal (which undergoes a Crank-Nicolson move) and
+/// particles are ordered by a summary of their state (Stot) so the result varies smoothly with the normals
+vector <unsigned int> PMCMC::resample_correlated(const unsigned int sec, const vector <double> &Stot, const vector <double> &w)
+{
+	auto z = normal_sample(0,1);
+	if(aux_fresh == false) z = cpm_rho*auxres_run[run_cur][sec] + sqrt(1-cpm_rho*cpm_rho)*z;
+	auxres_prop[sec] = z;
+	
+	return resample_sorted(Stot,w,Ntot,0.5*erfc(-z*M_SQRT1_2));
+}
+
+
+/// Adopts the proposed auxiliary normals if the last proposal was accepted (correlated pseudo-marginal)
+void PMCMC::aux_update()
+{
+	if(aux_pending == false) return;
+	
+	mpi.bcast(aux_accept);
+	if(aux_accept == 1){
+		for(auto p = 0u; p < N; p++) aux_run[run_cur][p].swap(aux_prop[p]);
+		auxres_run[run_cur].swap(auxres_prop);
+	}
+	aux_pending = false; aux_accept = 0;
+}
+
+
 /// Gets the proposals used for the next itermation of MCMC
 void PMCMC::get_proposals()
 {
@@ -290,10 +482,13 @@ void PMCMC::mcmc_updates()
 /// Returns the acceptance probability
 double PMCMC::get_al()
 {
+	aux_update();
+	
 	mpi.bcast(Pp.paramval);
 
 	Lp = obs_prob(Pp.paramval);
-	Pp = mpi.particle_sample(UNSET,backpart,particle,obsmodel);
+	if(cpm_rho > 0) aux_pending = true;
+	Pp = mpi.particle_sample(UNSET,backpart,particle,lineage,obsmodel);
 	if(core == 0) Prp = model.prior(Pp.paramval);
 	
 	double al = exp(invT*(Lp-Li) + Prp-Pri);
@@ -313,6 +508,7 @@ void PMCMC::copy_propose_state()
 	Li = Lp;
 	Pi = Pp;
 	Pri = Prp;
+	if(cpm_rho > 0) aux_accept = 1;
 }
 
 
@@ -459,11 +655,18 @@ void PMCMC::covar_area_proposal(CovarArea &ca)
 /// Initialises quantities before PMCMC can start
 void PMCMC::initialise_variables()
 {
-	backpart.resize(obsmodel.nsection+1); for(auto sec = 0u; sec <= obsmodel.nsection; sec++) backpart[sec].resize(Ntot);
+	backpart.resize(obsmodel.nsection+1);
 	
-	buffersize = 1 + data.narea*(1+ model.comp.size()*(1+data.ndemocatpos)); // This stores population sizes
+	buffersize = data.narea*model.comp.size()*data.ndemocatpos;              // This stores population sizes
 	buffersize += 1 + data.nstrain*(1 + data.narage);                        // This stores Imap
 	buffersize += 1 + data.nstrain*(1 + data.narage);                        // This stores Idiag
+	buffersize += data.narea*model.trans.size()*data.ndemocatpos;            // This stores the previous transitions
+	
+	nwindow = 0;                                                             // The longest section
+	for(auto sec = 0u; sec < obsmodel.nsection; sec++){
+		auto len = obsmodel.section_tf[sec]-obsmodel.section_ti[sec];
+		if(len > nwindow) nwindow = len;
+	}
 	
 	auto nparam = model.param.size();
 	
@@ -3,6 +3,7 @@
 
 #include "struct.hh"
 #include "param_prop.hh"
+#include "lineage.hh"
 
 class PMCMC
 {
@@ -13,9 +14,13 @@ public:
 	
 private:
 	double obs_prob(vector <double> &paramv);
-	double bootstrap(const unsigned int sec, vector <double> &L);
+	double bootstrap(const unsigned int sec, vector <double> &L, const vector <double> &S);
+	vector <unsigned int> resample_correlated(const unsigned int sec, const vector <double> &Stot, const vector <double> &w);
+	void aux_update();
 	Particle particle_sample();
 	void initialise();
+	void set_particle_number(const unsigned int Ntot_new);
+	void tune_particle_number();
 	void initialise_variables();
 	void update_burnin(const unsigned int samp);
 	bool terminate(const unsigned int samp);
@@ -63,6 +68,10 @@ private:
 	
 	unsigned int N;                            // The number of particles per core
 	unsigned int Ntot;                         // The total number of particles
+	
+	bool npart_tune;                           // Set if the number of particles is tuned before the run
+	double loglike_var;                        // The target variance in the estimated log-likelihood (when tuning)
+	double time_eval;                          // The wall-clock time per likelihood estimate (when tuning)
 
 	unsigned int nrun;                         // The number of runs
 	
@@ -72,11 +81,27 @@ private:
 	
 	vector < vector <unsigned int> > backpart; // How particles are related through the bootstrap step
 
-	vector <State> particle;                   // The vector of states
+	vector <State> particle;                   // The vector of states (each only stores the current section)
+	
+	unsigned int nwindow;                      // The number of time divisions stored by each particle
+	
+	LineageTree lineage;                       // Stores the pieces of particle trajectories from previous sections
 	
 	vector <Particle> particle_store;          // Stores the states for output later
 	
 	unsigned int buffersize;                   // The size of the buffer for sending / recieving during MPI
+
+	ResampleType resample;                     // The scheme used to resample particles
+	
+	double cpm_rho;                            // Correlation used by the correlated pseudo-marginal method (zero if not used)
+	unsigned int run_cur;                      // The run currently being updated
+	bool aux_fresh;                            // Set if the auxiliary normals are drawn afresh (during initialisation)
+	vector < vector <Tensor> > aux_run;        // The auxiliary normals driving particle simulation [run][p]
+	vector <Tensor> aux_prop;                  // The proposed auxiliary normals [p]
+	vector < vector <double> > auxres_run;     // The auxiliary normals driving resampling [run][sec]
+	vector <double> auxres_prop;               // The proposed auxiliary normals for resampling [sec]
+	bool aux_pending;                          // Set if a proposal has been made whose acceptance is not yet known
+	unsigned int aux_accept;                   // Set to one (on core 0) if the pending proposal has been accepted
 	
 	unsigned int percentage;                   // Stores the percentage progress
 	
@@ -0,0 +1,244 @@
+/// Implements resampling of particles in proportion to their weights
+/// All the schemes use O(N) operations: the points at which the cumulative weight is sampled are generated
+/// in increasing order and merged with the cumulative weights (rather than scanning the weights for each sample)
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+#include "resample.hh"
+#include "utils.hh"
+
+static void resample_merge(const vector <double> &w, const vector <double> &point, vector <unsigned int> &num);
+
+
+/// Returns the number of copies of each particle when nsamp particles are sampled with weights w (not normalised)
+vector <unsigned int> resample_number(const vector <double> &w, const unsigned int nsamp, const ResampleType type)
+{
+	auto n = w.size();
+	vector <unsigned int> num(n,0);
+	if(n == 0 || nsamp == 0) return num;
+	
+	auto wtot = 0.0; for(auto val : w) wtot += val;
+	if(!(wtot > 0)) emsgEC("Resample",1);
+
+	vector <double> point(nsamp);                             // The (ordered) points at which the cumulative weight is sampled
+	switch(type){
+		case MULTINOMIAL_RESAMPLE:                              // Ordered uniforms are generated from exponential spacings
+			{
+				auto sum = 0.0;
+				for(auto k = 0u; k < nsamp; k++){ sum -= log(ran()); point[k] = sum;}
+				sum -= log(ran());
+				for(auto k = 0u; k < nsamp; k++) point[k] *= wtot/sum;
+			}
+			break;
+			
+		case SYSTEMATIC_RESAMPLE:                               // A single uniform shifts an evenly spaced grid
+			return resample_systematic(w,nsamp,ran());
+			
+		case STRATIFIED_RESAMPLE:                               // One uniform within each of nsamp strata
+			for(auto k = 0u; k < nsamp; k++) point[k] = (k+ran())*wtot/nsamp;
+			break;
+			
+		case RESIDUAL_RESAMPLE:                                 // The integer part of the expected number is copied
+			{                                                     // and the remainder is sampled systematically
+				vector <double> wres(n);
+				auto nres = nsamp;
+				for(auto i = 0u; i < n; i++){
+					auto val = nsamp*w[i]/wtot;
+					num[i] = (unsigned int)(val);
+					if(num[i] > nres) num[i] = nres;
+					nres -= num[i];
+					wres[i] = val-num[i]; if(wres[i] < 0) wres[i] = 0;
+				}
+				
+				if(nres > 0){
+					auto numres = resample_number(wres,nres,SYSTEMATIC_RESAMPLE);
+					for(auto i = 0u; i < n; i++) num[i] += numres[i];
+				}
+			}
+			return num;
+	}
+	
+	resample_merge(w,point,num);
+	
+	return num;
+}
+
+
+/// Systematic resampling using a specified uniform u (so the same u can be used for different weights)
+vector <unsigned int> resample_systematic(const vector <double> &w, const unsigned int nsamp, const double u)
+{
+	auto n = w.size();
+	vector <unsigned int> num(n,0);
+	if(n == 0 || nsamp == 0) return num;
+	
+	auto wtot = 0.0; for(auto val : w) wtot += val;
+	if(!(wtot > 0)) emsgEC("Resample",5);
+	
+	vector <double> point(nsamp);
+	for(auto k = 0u; k < nsamp; k++) point[k] = (k+u)*wtot/nsamp;
+	
+	resample_merge(w,point,num);
+	
+	return num;
+}
+
+
+/// Systematic resampling with the particles ordered by key (a one-dimensional summary of their state)
+/// This is used by the correlated pseudo-marginal method: particles with similar states are adjacent, so
+/// the numbers change little when u and the states change slightly
+vector <unsigned int> resample_sorted(const vector <double> &key, const vector <double> &w, const unsigned int nsamp, const double u)
+{
+	auto n = w.size();
+	if(key.size() != n) emsgEC("Resample",8);
+	
+	vector <unsigned int> order(n);
+	for(auto i = 0u; i < n; i++) order[i] = i;
+	stable_sort(order.begin(),order.end(),[&key](const unsigned int a, const unsigned int b){ return key[a] < key[b];});
+	
+	vector <double> word(n);
+	for(auto i = 0u; i < n; i++) word[i] = w[order[i]];
+	
+	auto numord = resample_systematic(word,nsamp,u);
+	
+	vector <unsigned int> num(n);
+	for(auto i = 0u; i < n; i++) num[order[i]] = numord[i];
+	
+	return num;
+}
+
+
+/// Counts the number of points which fall within the cumulative weight of each particle 
+static void resample_merge(const vector <double> &w, const vector <double> &point, vector <unsigned int> &num)
+{
+	auto n = w.size();
+	auto i = 0u;
+	auto cum = w[0];
+	for(auto pt : point){
+		while(i < n-1 && pt >= cum){ i++; cum += w[i];}
+		num[i]++;
+	}
+}
+
+
+/// Given the number of copies of each particle, gives the ancestor of each particle after resampling
+/// Particles which are copied at least once keep their own state, so the minimum number of states are moved
+vector <unsigned int> resample_ancestor(const vector <unsigned int> &num)
+{
+	auto n = num.size();
+	
+	vector <unsigned int> extra;                              // Additional copies of particles
+	for(auto i = 0u; i < n; i++){
+		for(auto k = 1u; k < num[i]; k++) extra.push_back(i);
+	}
+	
+	vector <unsigned int> anc(n);
+	for(auto i = 0u; i < n; i++){
+		if(num[i] > 0) anc[i] = i;
+		else{
+			if(extra.size() == 0) emsgEC("Resample",2);
+			anc[i] = extra[extra.size()-1];
+			extra.pop_back();
+		}
+	}
+	if(extra.size() != 0) emsgEC("Resample",3);
+	
+	return anc;
+}
+
+
+/// Gives the ancestor of each particle when particles are split into nblock equal contiguous blocks (e.g. cores)
+/// Within each block particles which are copied keep their own state and additional copies fill the other 
+/// particles in the block. Only the surplus copies are moved between blocks (the minimum possible). 
+/// This only depends on num, so each core can calculate the ancestors for all particles itself.
+vector <unsigned int> resample_ancestor_blocks(const vector <unsigned int> &num, const unsigned int nblock)
+{
+	auto n = num.size();
+	if(n%nblock != 0) emsgEC("Resample",6);
+	auto nb = n/nblock;
+	
+	vector <unsigned int> anc(n,UNSET);
+	vector <unsigned int> extra_all, hole_all;                 // Surplus copies and unfilled particles across blocks
+	for(auto b = 0u; b < nblock; b++){
+		vector <unsigned int> extra, hole;
+		for(auto i = b*nb; i < (b+1)*nb; i++){
+			if(num[i] > 0){
+				anc[i] = i;
+				for(auto k = 1u; k < num[i]; k++) extra.push_back(i);
+			}
+			else hole.push_back(i);
+		}
+		
+		auto nloc = extra.size(); if(hole.size() < nloc) nloc = hole.size();
+		for(auto j = 0u; j < nloc; j++) anc[hole[j]] = extra[j];   // Copies within the block
+		
+		for(auto j = nloc; j < extra.size(); j++) extra_all.push_back(extra[j]);
+		for(auto j = nloc; j < hole.size(); j++) hole_all.push_back(hole[j]);
+	}
+	
+	if(extra_all.size() != hole_all.size()) emsgEC("Resample",7);
+	for(auto j = 0u; j < hole_all.size(); j++) anc[hole_all[j]] = extra_all[j];
+	
+	return anc;
+}
+
+
+/// The number of sampling points below y (where the cumulative weight is scaled so the total weight is nsamp)
+/// This is used when the weights are distributed across cores (each core only needs the cumulative weight at 
+/// the boundaries of its particles). For stratified resampling the uniform in each stratum comes from a random 
+/// stream addressed by step and the stratum (so all cores agree on it).
+unsigned int resample_below(const double y, const unsigned int nsamp, const ResampleType type, const double u, const unsigned long step)
+{
+	if(!(y > 0)) return 0;
+	if(y >= nsamp) return nsamp;
+	
+	switch(type){
+		case SYSTEMATIC_RESAMPLE:                               // Points at k+u
+			{
+				auto val = ceil(y-u); if(val < 0) val = 0;
+				return (unsigned int)(val);
+			}
+			
+		case STRATIFIED_RESAMPLE:                               // Points at k+u_k
+			{
+				auto k = (unsigned int)(y);
+				ran_stream(step,UNSET,k,UNSET,UNSET);
+				auto uk = ran();
+				ran_stream_default();
+				if(k+uk < y) return k+1;
+				return k;
+			}
+			
+		default: emsgEC("Resample",4); break;
+	}
+	return 0;
+}
+
+
+/// The number of copies of each of a contiguous block of particles (e.g. those on one core) when the weights are 
+/// distributed. yoff is the scaled cumulative weight before the block and fac scales weights so the total is nsamp.
+/// below_start and below_end are the number of points below the start and end of the block (these are agreed with 
+/// the neighbouring blocks so the counts over all blocks sum to nsamp).
+vector <unsigned int> resample_number_block(const vector <double> &w, const double yoff, const double fac, const unsigned int nsamp, const ResampleType type, const double u, const unsigned long step, const unsigned int below_start, unsigned int below_end)
+{
+	auto n = w.size();
+	vector <unsigned int> num(n,0);
+	if(below_end < below_start) below_end = below_start;
+	
+	auto y = yoff;
+	auto below = below_start;
+	for(auto i = 0u; i < n; i++){
+		y += w[i]*fac;
+		unsigned int b;
+		if(i == n-1) b = below_end;
+		else b = resample_below(y,nsamp,type,u,step);
+		if(b < below) b = below;
+		if(b > below_end) b = below_end;
+		num[i] = b-below;
+		below = b;
+	}
+	
+	return num;
+}
@@ -0,0 +1,20 @@
+/// Resampling of particles in proportion to their weights (used in PAIS, PMCMC and ABC-SMC)
+
+#ifndef BEEPMBP__RESAMPLE_HH
+#define BEEPMBP__RESAMPLE_HH
+
+#include <vector>
+
+using namespace std;
+
+#include "consts.hh"
+
+vector <unsigned int> resample_number(const vector <double> &w, const unsigned int nsamp, const ResampleType type);
+vector <unsigned int> resample_systematic(const vector <double> &w, const unsigned int nsamp, const double u);
+vector <unsigned int> resample_sorted(const vector <double> &key, const vector <double> &w, const unsigned int nsamp, const double u);
+vector <unsigned int> resample_ancestor(const vector <unsigned int> &num);
+vector <unsigned int> resample_ancestor_blocks(const vector <unsigned int> &num, const unsigned int nblock);
+vector <unsigned int> resample_number_block(const vector <double> &w, const double yoff, const double fac, const unsigned int nsamp, const ResampleType type, const double u, const unsigned long step, const unsigned int below_start, unsigned int below_end);
+unsigned int resample_below(const double y, const unsigned int nsamp, const ResampleType type, const double u, const unsigned long step);
+
+#endif
@@ -0,0 +1,78 @@
+/// Implements the Philox4x32-10 counter-based random number generator (Salmon et al. 2011)
+
+using namespace std;
+
+#include "rng.hh"
+
+const uint32_t PHILOX_M0 = 0xD2511F53, PHILOX_M1 = 0xCD9E8D57; // Multipliers
+const uint32_t PHILOX_W0 = 0x9E3779B9, PHILOX_W1 = 0xBB67AE85; // Weyl sequence used to update the key
+
+
+/// Initialises the stream with a zero key
+RngStream::RngStream()
+{
+	set(0,0,0,0);
+}
+
+
+/// Sets the key and position of the stream (numbers start at the beginning of the stream)
+void RngStream::set(const uint64_t key_, const uint32_t c1, const uint32_t c2, const uint32_t c3)
+{
+	key[0] = uint32_t(key_); key[1] = uint32_t(key_ >> 32);
+	ctr[0] = 0; ctr[1] = c1; ctr[2] = c2; ctr[3] = c3;
+	nbuf = 0;
+}
+
+
+/// Returns the next random 32 bit integer
+RngStream::result_type RngStream::operator()()
+{
+	if(nbuf == 0){ generate(); nbuf = 4;}
+	nbuf--;
+	return buf[nbuf];
+}
+
+
+/// Generates a block of four numbers from the current counter and increments the counter
+void RngStream::generate()
+{
+	philox4x32_10(ctr,key,buf);
+	ctr[0]++;
+}
+
+
+/// Applies the ten rounds of Philox4x32 to a counter and key (this is a pure function, so it can be 
+/// checked against published known-answer vectors)
+void philox4x32_10(const uint32_t *ctr, const uint32_t *key, uint32_t *out)
+{
+	uint32_t c[4] = {ctr[0], ctr[1], ctr[2], ctr[3]};
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for(auto r = 0u; r < 10; r++){
+		auto p0 = uint64_t(PHILOX_M0)*c[0];
+		auto p1 = uint64_t(PHILOX_M1)*c[2];
+		uint32_t hi0 = uint32_t(p0 >> 32), lo0 = uint32_t(p0);
+		uint32_t hi1 = uint32_t(p1 >> 32), lo1 = uint32_t(p1);
+
+		c[0] = hi1^c[1]^k0; c[1] = lo1; c[2] = hi0^c[3]^k1; c[3] = lo0;
+
+		k0 += PHILOX_W0; k1 += PHILOX_W1;
+	}
+
+	for(auto i = 0u; i < 4; i++) out[i] = c[i];
+}
+
+
+/// Combines a seed with two numbers to generate a key (using the splitmix64 mixing function)
+uint64_t rng_key(const uint64_t seed, const uint64_t a, const uint64_t b)
+{
+	uint64_t z = seed;
+	uint64_t vals[2] = {a, b};
+	for(auto val : vals){
+		z += 0x9E3779B97F4A7C15ULL + val;
+		z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+		z = z ^ (z >> 31);
+	}
+	return z;
+}
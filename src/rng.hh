@@ -0,0 +1,38 @@
+/// A counter-based random number generator (Philox4x32-10)
+/// Every random number is a function of a key and a counter, so independent streams can be addressed
+/// directly (e.g. by run, particle, time division and area) without regard to which core or thread draws them
+
+#ifndef BEEPMBP__RNG_HH
+#define BEEPMBP__RNG_HH
+
+#include <cstdint>
+
+using namespace std;
+
+class RngStream
+{
+	public:
+		typedef uint32_t result_type;
+
+		RngStream();
+
+		void set(const uint64_t key_, const uint32_t c1, const uint32_t c2, const uint32_t c3);
+
+		static constexpr result_type min(){ return 0;}
+		static constexpr result_type max(){ return 0xffffffff;}
+
+		result_type operator()();
+
+	private:
+		void generate();
+
+		uint32_t key[2];                                     // The key which identifies the stream
+		uint32_t ctr[4];                                     // The counter (ctr[0] counts blocks, ctr[1-3] give the position)
+		uint32_t buf[4];                                     // The most recently generated block
+		unsigned int nbuf;                                   // The number of unused numbers in buf
+};
+
+void philox4x32_10(const uint32_t *ctr, const uint32_t *key, uint32_t *out);
+uint64_t rng_key(const uint64_t seed, const uint64_t a, const uint64_t b);
+
+#endif
@@ -46,7 +46,7 @@ void Simulate::run()
 
 	output.simulated_data(obs_value,details.output_directory+"/Simulated_data"); // Outputs the simulated data files
 
-	particle_store.push_back(state.create_particle(0));                          // Generate the pdf output file
+	particle_store.push_back(state.create_particle(0,false));                          // Generate the pdf output file
 	output.generate_graphs(particle_store); 
 }
 
@@ -62,7 +62,8 @@ void Simulate::multisim()
 		
 		state.simulate(paramval);
 		
-		particle_store.push_back(state.create_particle(0));
+		particle_store.push_back(state.create_particle(0,false));
+		particle_store.back().compact();                                          // Reduces the memory used to store the particle
 		
 		output.print_percentage((s+1)*mpi.ncore,nsim,percentage);
 	}	
@@ -151,7 +152,8 @@ void Simulate::model_modification()
 		for(auto i = 0u; i < nsim_per_sample; i++){
 			state.simulate(model.modelmod.pred_start*details.division_per_time,details.ndivision);
 		
-			particle_store.push_back(state.create_particle(0));
+			particle_store.push_back(state.create_particle(0,false));
+			particle_store.back().compact();
 		}
 		
 		output.print_percentage(s+1,nsamp_per_core,percentage);
@@ -3,37 +3,26 @@
 #include <cmath>   
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 
 using namespace std;
 
 #include "state.hh"
+#include "thread_pool.hh"
 #include "output.hh"
 
 /// Initialises the state class
 State::State(const Details &details, const Data &data, const Model &model, const ObservationModel &obsmodel) : comp(model.comp), trans(model.trans), param(model.param), details(details), data(data), model(model), obsmodel(obsmodel)
 {
 	disc_spline.resize(model.spline.size());
-
-	pop.resize(details.ndivision);
-	for(auto sett = 0u; sett < details.ndivision; sett++){
-		pop[sett].resize(data.narea); 
-		for(auto c = 0u; c < data.narea; c++){
-			pop[sett][c].resize(model.comp.size());
-			for(auto co = 0u; co < model.comp.size(); co++) pop[sett][c][co].resize(data.ndemocatpos);
-		}
-	}
 	
-	transnum.resize(details.ndivision); transmean.resize(details.ndivision);
-	for(auto sett = 0u; sett < details.ndivision; sett++){
-		transnum[sett].resize(data.narea); transmean[sett].resize(data.narea);
-		for(auto c = 0u; c < data.narea; c++){
-			transnum[sett][c].resize(model.trans.size()); transmean[sett][c].resize(model.trans.size());
-			for(auto tr = 0u; tr < model.trans.size(); tr++){
-				transnum[sett][c][tr].resize(data.ndemocatpos);
-				transmean[sett][c][tr].resize(data.ndemocatpos);
-			}		
-		}
-	}
+	rng_particle = UNSET; rng_step = 0;
+	aux = NULL; aux_prop = NULL; aux_rho = 0;
+	nwindow = UNSET;
+
+	pop.resize(details.ndivision,data.narea,model.comp.size(),data.ndemocatpos);
+	transnum.resize(details.ndivision,data.narea,model.trans.size(),data.ndemocatpos);
+	transmean.resize(details.ndivision,data.narea,model.trans.size(),data.ndemocatpos);
 	
 	Imap.resize(details.ndivision); Idiag.resize(details.ndivision);
 	for(auto sett = 0u; sett < details.ndivision; sett++){
@@ -45,53 +34,154 @@ State::State(const Details &details, const Data &data, const Model &model, const
 			}
 		}
 	}
-	
-	Ntime.resize(details.ndivision);
-	for(auto sett = 0u; sett < details.ndivision; sett++){
-		Ntime[sett].resize(data.nage);
-		for(auto a = 0u; a < data.nage; a++) Ntime[sett][a].resize(data.nage);
-	}
 }
 		
 	
+
+/// Stores only a window of nwin time divisions (used by particle filtering, which simulates one section at a time)
+/// The window holds the populations at the start and end of the section and the transitions in the previous 
+/// time division (which are needed to continue the infectivity map). Imap and Idiag are stored in full.
+void State::set_window(const unsigned int nwin)
+{
+	nwindow = nwin;
+	pop.clear(); pop.resize(nwin+1,data.narea,model.comp.size(),data.ndemocatpos);
+	transnum.clear(); transnum.resize(nwin+1,data.narea,model.trans.size(),data.ndemocatpos);
+	transmean.clear(); transmean.resize(nwin+1,data.narea,model.trans.size(),data.ndemocatpos);
+}
+
+
+/// Moves the window so that a section starting at ti can be simulated 
+void State::slide_window(const unsigned int ti)
+{
+	pop.slide(ti);
+	if(ti > 0) transnum.slide(ti-1); else transnum.slide(0);
+	transmean.slide(ti);
+}
+
+
 /// Sets up the initial popualtion
 void State::pop_init()
 {
-	for(auto c = 0u; c < data.narea; c++) pop[0][c] = data.area[c].pop_init;
+	auto pop0 = pop[0];
+	for(auto c = 0u; c < data.narea; c++){
+		auto pop0_c = pop0[c];
+		const auto &pop_init = data.area[c].pop_init;
+		for(auto co = 0u; co < model.comp.size(); co++){
+			for(auto dp = 0u; dp < data.ndemocatpos; dp++) pop0_c[co][dp] = pop_init[co][dp];
+		}
+	}
 }
 
 
 /// Sets up the state using a specified set of parameters
+/// Only those derived quantities which depend on parameters that have changed are recalculated
 void State::set_param(const vector <double> &paramv)
 {
 	timer[TIME_SETPARAM].start();
 	
 	paramval = paramv;
 
-	auto paramv_dir = model.dirichlet_correct(paramval);
-
-	transrate = model.create_transrate(paramv_dir);
+	set_inf_dif();
 	
-	disc_spline = model.create_disc_spline(paramv_dir);
+	auto paramv_dir = model.dirichlet_correct(paramval);
 
-	susceptibility = model.create_susceptibility(paramv_dir);   
-	
-	areafactor = model.create_areafactor(paramv_dir);  
+	if(paramv_dir_set.size() != paramv_dir.size()){
+		transrate = model.create_transrate(paramv_dir);
+		
+		disc_spline = model.create_disc_spline(paramv_dir);
 
-	Ntime = model.create_Ntime(disc_spline);
- 
-	beta = model.calculate_beta_from_R(susceptibility,paramv_dir,Ntime,transrate,disc_spline);
+		susceptibility = model.create_susceptibility(paramv_dir);   
 		
+		areafactor = model.create_areafactor(paramv_dir);  
+
+		model.set_Ntime(Ntime,disc_spline);
+	 
+		beta = model.calculate_beta_from_R(susceptibility,paramv_dir,Ntime,transrate,disc_spline);
+	}
+	else set_param_change(paramv_dir);
+	
+	paramv_dir_set = paramv_dir;
+	
+	if(checkon == true) check_param(paramv_dir);
+	
 	//model.eignevector_compare_models(susceptibility,paramv_dir,Ntime,transrate);
 		
 	timer[TIME_SETPARAM].stop();
 }
 
 
+/// Updates the derived quantities which depend on the parameters which have changed since set_param was last called
+void State::set_param_change(const vector <double> &paramv_dir)
+{
+	auto transrate_change = false, sus_change = false, areafactor_change = false, beta_change = false;
+	vector <bool> spline_change(model.spline.size(),false);
+	
+	for(auto th = 0u; th < paramv_dir.size(); th++){
+		if(paramv_dir[th] != paramv_dir_set[th]){
+			const auto &pd = model.param_derived[th];
+			if(pd.transrate == true) transrate_change = true;
+			if(pd.susceptibility == true) sus_change = true;
+			if(pd.areafactor == true) areafactor_change = true;
+			if(pd.beta == true) beta_change = true;
+			for(auto sp : pd.spline) spline_change[sp] = true;
+		}
+	}
+	
+	if(transrate_change == true) transrate = model.create_transrate(paramv_dir);
+	
+	if(sus_change == true) susceptibility = model.create_susceptibility(paramv_dir);
+	
+	if(areafactor_change == true) areafactor = model.create_areafactor(paramv_dir);
+	
+	vector <SettRange> spline_range(model.spline.size());             // The time range over which each spline changes
+	for(auto sp = 0u; sp < model.spline.size(); sp++){
+		auto &ra = spline_range[sp]; ra.ti = 0; ra.tf = 0;
+		if(spline_change[sp] == true){
+			auto ds = model.create_disc_spline(sp,paramv_dir);
+			
+			auto ndivision = details.ndivision;
+			auto &ds_old = disc_spline[sp];
+			auto ti = 0u; while(ti < ndivision && ds[ti] == ds_old[ti]) ti++;
+			if(ti < ndivision){
+				auto tf = ndivision; while(tf > ti && ds[tf-1] == ds_old[tf-1]) tf--;
+				ra.ti = ti; ra.tf = tf;
+				ds_old = ds;
+			}
+		}
+	}
+	
+	auto Ntime_range = model.update_Ntime(Ntime,disc_spline,spline_range);
+	
+	if(transrate_change == true || sus_change == true || beta_change == true){
+		beta = model.calculate_beta_from_R(susceptibility,paramv_dir,Ntime,transrate,disc_spline);
+	}
+	else{
+		model.update_beta_from_R(beta,susceptibility,paramv_dir,Ntime,transrate,disc_spline,spline_range,Ntime_range);
+	}
+}
+
+
+/// Checks that the derived quantities agree with those calculated directly from the parameters
+void State::check_param(const vector <double> &paramv_dir) const
+{
+	if(transrate != model.create_transrate(paramv_dir)) emsgEC("State",55);
+	auto ds = model.create_disc_spline(paramv_dir);
+	if(disc_spline != ds) emsgEC("State",56);
+	auto sus = model.create_susceptibility(paramv_dir);
+	if(susceptibility != sus) emsgEC("State",57);
+	if(areafactor != model.create_areafactor(paramv_dir)) emsgEC("State",58);
+	auto Nt = model.create_Ntime(ds);
+	for(auto sett = 0u; sett < details.ndivision; sett++){              // Matrices may be stored in a different order
+		if(Ntime[sett] != Nt[sett]) emsgEC("State",59);
+	}
+	if(beta != model.calculate_beta_from_R(sus,paramv_dir,Nt,transrate,ds)) emsgEC("State",60);
+}
+
+
 /// Sets the error function (defined to be -2*log(observation model)
 void State::set_EF()
 {
-	EF = -2*obsmodel.calculate(this);
+	EF = obsmodel.calculate_EF(this,obs_value,obs_EF);
 }
 
 
@@ -102,6 +192,51 @@ void State::set_Pr()
 }
 
 
+/// Finds the first time division at which the quantities derived from the parameters differ from another state
+/// (e.g. a proposal only changing late spline knots leaves the dynamics before the knot unchanged)
+unsigned int State::first_param_change(const State *state) const
+{
+	if(transrate != state->transrate || susceptibility != state->susceptibility) return 0;
+	
+	if(inf_dif_tr != state->inf_dif_tr || inf_dif != state->inf_dif) return 0; // Infectivity alters Imap from the start
+	
+	auto ndivision = details.ndivision;
+	for(auto sett = 0u; sett < ndivision; sett++){
+		if(Ntime[sett] != state->Ntime[sett]) return sett;
+		
+		for(auto spl = 0u; spl < disc_spline.size(); spl++){
+			if(disc_spline[spl][sett] != state->disc_spline[spl][sett]) return sett;
+		}
+		
+		auto t = sett/details.division_per_time;
+		if(areafactor[t] != state->areafactor[t]) return sett;
+		
+		for(auto st = 0u; st < beta.size(); st++){
+			for(auto c = 0u; c < beta[st].size(); c++){
+				if(beta[st][c][sett] != state->beta[st][c][sett]) return sett;
+			}
+		}
+	}
+	
+	return ndivision;
+}
+
+
+/// Copies the dynamics from another state from time division sett_begin up to (but not including) sett_end
+/// (pop is also copied at sett_end, because it only depends on earlier transitions) 
+void State::copy_start(const State *state, const unsigned int sett_begin, const unsigned int sett_end)
+{
+	for(auto sett = sett_begin; sett < sett_end; sett++){
+		transnum.copy_sett(sett,state->transnum);
+		transmean.copy_sett(sett,state->transmean);
+		Imap[sett] = state->Imap[sett];
+		Idiag[sett] = state->Idiag[sett];
+		pop.copy_sett(sett,state->pop);
+	}
+	if(sett_end < details.ndivision) pop.copy_sett(sett_end,state->pop);
+}
+
+
 /// For a given time sett, sets Imap by using the Imap from another state and the difference given by dImap
 void State::set_Imap_using_dI(const unsigned int sett, const State *state, const vector < vector <double> > &dImap, const vector < vector <double> > &dIdiag)
 {
@@ -184,43 +319,92 @@ void State::set_Imap_sett(const unsigned int sett)
 
 
 /// Changes a Imap in accordance with transitions in transnum
-void State::update_I_from_transnum(vector < vector <double> > &Ima, vector< vector <double> > &Idia, const vector < vector < vector <double> > > &dtransnum) const
+/// When using threads each thread accumulates its areas separately and these are summed in thread order
+void State::update_I_from_transnum(vector < vector <double> > &Ima, vector< vector <double> > &Idia, const SettView<const double> &dtransnum) const
+{	
+	auto nthread = threadpool.nthread;
+	if(nthread == 1){ update_I_from_transnum_area(Ima,Idia,dtransnum,0,data.narea); return;}
+	
+	if(Ima_thread.size() != nthread){
+		Ima_thread.resize(nthread); Idia_thread.resize(nthread);
+		for(auto th = 0u; th < nthread; th++){
+			Ima_thread[th].resize(data.nstrain); Idia_thread[th].resize(data.nstrain);
+			for(auto st = 0u; st < data.nstrain; st++){
+				Ima_thread[th][st].resize(data.narage); Idia_thread[th][st].resize(data.narage);
+			}
+		}
+	}
+	
+	threadpool.run(data.narea,[&](const unsigned int th, const unsigned int c_start, const unsigned int c_end){
+		auto &Ima_th = Ima_thread[th];
+		auto &Idia_th = Idia_thread[th];
+		for(auto st = 0u; st < data.nstrain; st++){
+			fill(Ima_th[st].begin(),Ima_th[st].end(),0);
+			fill(Idia_th[st].begin(),Idia_th[st].end(),0);
+		}
+		update_I_from_transnum_area(Ima_th,Idia_th,dtransnum,c_start,c_end);
+	});
+	
+	threadpool.run(data.narage,[&](const unsigned int, const unsigned int v_start, const unsigned int v_end){
+		for(auto st = 0u; st < data.nstrain; st++){
+			for(auto th = 0u; th < nthread; th++){
+				const auto &Ima_th = Ima_thread[th][st];
+				const auto &Idia_th = Idia_thread[th][st];
+				for(auto v = v_start; v < v_end; v++){
+					Ima[st][v] += Ima_th[v];
+					Idia[st][v] += Idia_th[v];
+				}
+			}
+		}
+	});
+}
+
+
+/// Adds the change in Imap coming from transitions in areas c_start to c_end
+/// Only transitions which change infectivity are considered, and areas with no change are skipped
+void State::update_I_from_transnum_area(vector < vector <double> > &Ima, vector< vector <double> > &Idia, const SettView<const double> &dtransnum, const unsigned int c_start, const unsigned int c_end) const
 {	
-	auto narea = data.narea;
 	auto nage = data.nage;
 	auto dpmax = data.ndemocatpos_per_strain;
+	const auto &M = model.M_csr;
+	const auto &diag = data.genQ.M.diag;
+	
 	vector <double> dinf(nage);
-
+	auto ninf_dif = inf_dif_tr.size();
+	
 	for(auto st = 0u; st < data.nstrain; st++){
-		auto &Ima_inft = Ima[st];
-		auto &Idia_inft = Idia[st];
+		auto Ima_inft = Ima[st].data();
+		auto Idia_inft = Idia[st].data();
 		
-		for(auto c = 0u; c < narea; c++){
-			for(auto a = 0u; a < nage; a++) dinf[a] = 0;
+		for(auto c = c_start; c < c_end; c++){
+			auto dtransnum_c = dtransnum[c];
 			
-			for(auto tr = 0u; tr < model.trans.size(); tr++){	
-				auto di = model.get_infectivity_dif(tr,paramval); 
-				if(di != 0){
-					auto dpp = st*dpmax;
-					for(auto dp = 0u; dp < dpmax; dp++){
-						auto num = dtransnum[c][tr][dpp];
-						if(num != 0) dinf[data.democatpos[dp][0]] += di*num; 
-						dpp++;
-					}
+			auto flag = false;
+			for(auto a = 0u; a < nage; a++) dinf[a] = 0;
+			for(auto k = 0u; k < ninf_dif; k++){	
+				auto di = inf_dif[k]; 
+				auto num = dtransnum_c[inf_dif_tr[k]] + st*dpmax;
+				for(auto dp = 0u; dp < dpmax; dp++){
+					if(num[dp] != 0){ dinf[data.democatpos[dp][0]] += di*num[dp]; flag = true;}
 				}
 			}
+			if(flag == false) continue;
 			
-			auto diag = data.genQ.M.diag[c];
-			auto &to = data.genQ.M.to[c];
-			auto &val = data.genQ.M.val[c];
-			
-			auto jmax = to.size();
 			auto v = c*nage;
-			for(auto a = 0u; a < nage; a++){
-				auto di = dinf[a];
-				if(di != 0){
-					Idia_inft[v+a] += di*diag;
-					for(auto j = 0u; j < jmax; j++) Ima_inft[to[j]*nage+a] += di*val[j]; 
+			auto dg = diag[c];
+			for(auto a = 0u; a < nage; a++) Idia_inft[v+a] += dinf[a]*dg;
+			
+			auto jmax = M.start[c+1];
+			if(nage == 1){                                            // Faster version when only 1 age group
+				auto di = dinf[0];
+				for(auto j = M.start[c]; j < jmax; j++) Ima_inft[M.col[j]] += di*M.val[j];
+			}
+			else{
+				auto dinf_a = dinf.data();
+				for(auto j = M.start[c]; j < jmax; j++){
+					auto I = Ima_inft + M.col[j];                           // The ages form a contiguous block
+					auto w = M.val[j];
+					for(auto a = 0u; a < nage; a++) I[a] += dinf_a[a]*w; 
 				}
 			}
 		}
@@ -228,30 +412,88 @@ void State::update_I_from_transnum(vector < vector <double> > &Ima, vector< vect
 }
 
 
+/// Sets the transitions which change infectivity (along with the change)
+void State::set_inf_dif()
+{
+	inf_dif_tr.clear(); inf_dif.clear();
+	for(auto tr = 0u; tr < model.trans.size(); tr++){
+		auto di = model.get_infectivity_dif(tr,paramval); 
+		if(di != 0){ inf_dif_tr.push_back(tr); inf_dif.push_back(di);}
+	}
+}
+
+
 /// Initialises the state based on a particle
+/// If the particle is warm its derived state is copied rather than recalculated
 void State::initialise_from_particle(const Particle &part)
+{
+	if(part.transnum_code.empty() == false) part.transnum_code.decode(transnum);
+	else transnum = part.transnum;
+	if(part.warm == true){
+		pop = part.pop; transmean = part.transmean; Imap = part.Imap; Idiag = part.Idiag;
+	}
+	initialise_from_transnum(part.paramval,part.EF,part.warm);
+}
+
+
+/// Initialises the state by taking over the transition numbers of a particle (these are swapped with the buffer
+/// in the state, so nothing is copied). The particle must be given back its buffer with release_particle.
+/// The derived state of a warm particle is taken over in the same way.
+void State::adopt_particle(Particle &part)
+{
+	part.expand();
+	transnum.swap(part.transnum);
+	
+	auto warm = part.warm;
+	if(warm == true){
+		pop.swap(part.pop); transmean.swap(part.transmean); Imap.swap(part.Imap); Idiag.swap(part.Idiag);
+		part.warm = false;
+	}
+	initialise_from_transnum(part.paramval,part.EF,warm);
+}
+
+
+/// Places the state back into a particle (by swapping the transition numbers)
+/// When using warm particles the derived state is also placed in the particle
+void State::release_particle(Particle &part)
+{
+	part.EF = EF;
+	part.paramval = paramval;
+	transnum.swap(part.transnum);
+	
+	if(details.warm_particles == true){
+		if(part.pop.same_shape(pop)) pop.swap(part.pop); else part.pop = pop;    // Buffers are copied the first time
+		if(part.transmean.same_shape(transmean)) transmean.swap(part.transmean); else part.transmean = transmean;
+		if(part.Imap.size() == Imap.size()) Imap.swap(part.Imap); else part.Imap = Imap;
+		if(part.Idiag.size() == Idiag.size()) Idiag.swap(part.Idiag); else part.Idiag = Idiag;
+		part.warm = true;
+	}
+}
+
+
+/// Initialises the state based on transnum and a set of parameter values
+/// If derived_set is true then pop, Imap and transmean are already consistent with these and are not recalculated
+void State::initialise_from_transnum(const vector <double> &paramv, const double EF_, const bool derived_set)
 {
 	timer[TIME_INITFROMPART].start();
 		
-	paramval = part.paramval;
-	EF = part.EF;
-	transnum = part.transnum;
+	EF = EF_;
 		
-	Pr = model.prior(paramval);
+	Pr = model.prior(paramv);
 	
-	set_param(paramval);
-	
-	pop_init();	
-	for(auto sett = 0u; sett < details.ndivision; sett++){
-		democat_change_pop_adjust(sett);
-		if(sett < details.ndivision-1) update_pop(sett);
-	}
+	set_param(paramv);
 	
-	set_Imap(0);
+	if(derived_set == false){
+		pop_init();	
+		for(auto sett = 0u; sett < details.ndivision; sett++){
+			democat_change_pop_adjust(sett);
+			if(sett < details.ndivision-1) update_pop(sett);
+		}
 		
-	for(auto sett = 0u; sett < details.ndivision; sett++){
-		for(auto c = 0u; c < data.narea; c++) set_transmean(sett,c);
-	}			
+		set_Imap(0);
+			
+		for(auto sett = 0u; sett < details.ndivision; sett++) set_transmean(sett,0,data.narea);		
+	}
 	
 	if(checkon == true) check(0);
 	
@@ -260,7 +502,8 @@ void State::initialise_from_particle(const Particle &part)
 
 
 /// Creates a particle from the state
-Particle State::create_particle(const unsigned int run) const
+/// When using warm particles (and keep_derived is set) the particle also stores the derived state
+Particle State::create_particle(const unsigned int run, const bool keep_derived) const
 {
 	Particle part;
 	part.run = run;
@@ -268,46 +511,66 @@ Particle State::create_particle(const unsigned int run) const
 	part.paramval = paramval;
 	part.transnum = transnum;
 	
+	if(details.warm_particles == true && keep_derived == true){
+		part.pop = pop; part.transmean = transmean; part.Imap = Imap; part.Idiag = Idiag;
+		part.warm = true;
+	}
+	
 	return part;
 }
 
 
 /// Adjusts populations so to enforce democat_change 
 void State::democat_change_pop_adjust(const unsigned int sett)
+{
+	for(const auto &dcc : data.democat_change) democat_change_pop_adjust(sett,dcc);
+}
+
+
+/// Adjusts the populations only for demographic changes which include areas that are flagged as changed
+void State::democat_change_pop_adjust(const unsigned int sett, const vector <bool> &area_changed)
 {
 	for(const auto &dcc : data.democat_change){
-		auto ncat = dcc.frac[sett].size();
-	
-		vector <double> pop_cat(ncat);
-		for(auto f = 0u; f < ncat; f++) pop_cat[f] = 0;
-			
-		for(auto c : dcc.area){
-			for(auto g = 0u; g < dcc.dp_group.size(); g++){
-				for(auto co = 0u; co < model.comp.size(); co++){
-					for(auto f = 0u; f < ncat; f++){
-						pop_cat[f] += pop[sett][c][co][dcc.dp_group[g][f]];		
-					}							
-				}				
-			}
+		auto fl = false; for(auto c : dcc.area){ if(area_changed[c] == true) fl = true;}
+		if(fl == true) democat_change_pop_adjust(sett,dcc);
+	}
+}
+
+
+/// Adjusts the populations in the areas of a given demographic change
+void State::democat_change_pop_adjust(const unsigned int sett, const DemocatChange &dcc)
+{
+	auto ncat = dcc.frac[sett].size();
+
+	vector <double> pop_cat(ncat);
+	for(auto f = 0u; f < ncat; f++) pop_cat[f] = 0;
+		
+	for(auto c : dcc.area){
+		for(auto g = 0u; g < dcc.dp_group.size(); g++){
+			for(auto co = 0u; co < model.comp.size(); co++){
+				for(auto f = 0u; f < ncat; f++){
+					pop_cat[f] += pop[sett][c][co][dcc.dp_group[g][f]];		
+				}							
+			}				
 		}
-		auto pop_tot = 0.0;	for(auto f = 0u; f < ncat; f++)	pop_tot += pop_cat[f];
+	}
+	auto pop_tot = 0.0;	for(auto f = 0u; f < ncat; f++)	pop_tot += pop_cat[f];
+
+	vector <double> frac_dif(ncat);
+	for(auto f = 0u; f < ncat; f++) frac_dif[f] = dcc.frac[sett][f] - pop_cat[f]/pop_tot;
 	
-		vector <double> frac_dif(ncat);
-		for(auto f = 0u; f < ncat; f++) frac_dif[f] = dcc.frac[sett][f] - pop_cat[f]/pop_tot;
-		
-		for(auto c : dcc.area){
-			for(auto g = 0u; g < dcc.dp_group.size(); g++){
-				for(auto co = 0u; co < model.comp.size(); co++){
-					auto sum = 0.0;
-					for(auto f = 0u; f < ncat; f++){
-						sum += pop[sett][c][co][dcc.dp_group[g][f]];
-					}
-					
-					for(auto f = 0u; f < ncat; f++){
-						pop[sett][c][co][dcc.dp_group[g][f]] += frac_dif[f]*sum;
-					}							
-				}				
-			}
+	for(auto c : dcc.area){
+		for(auto g = 0u; g < dcc.dp_group.size(); g++){
+			for(auto co = 0u; co < model.comp.size(); co++){
+				auto sum = 0.0;
+				for(auto f = 0u; f < ncat; f++){
+					sum += pop[sett][c][co][dcc.dp_group[g][f]];
+				}
+				
+				for(auto f = 0u; f < ncat; f++){
+					pop[sett][c][co][dcc.dp_group[g][f]] += frac_dif[f]*sum;
+				}							
+			}				
 		}
 	}
 }
@@ -315,75 +578,88 @@ void State::democat_change_pop_adjust(const unsigned int sett)
 
 /// Sets the mean number of transtions at a given time sett and within a given area c
 void State::set_transmean(const unsigned int sett, const unsigned int c)
+{
+	set_transmean(sett,c,c+1);
+}
+
+
+/// Sets the mean number of transtions at a given time sett for areas c_start to c_end
+/// The force of infection for all the areas is calculated together (see set_NMI)
+void State::set_transmean(const unsigned int sett, const unsigned int c_start, const unsigned int c_end)
 {
 	timer[TIME_TRANSMEAN].start();
 	
 	auto dt = double(details.period)/details.ndivision;
-				
-	auto &tmean = transmean[sett][c];
-	auto &p = pop[sett][c];
 	
 	auto dpmax = data.ndemocatpos_per_strain;
+	auto nc = c_end - c_start;
 	
+	static thread_local vector <double> NMI;                        // The force of infection [st][a][c-c_start]
+	auto nblock = nc*data.nage;
+	if(NMI.size() < data.nstrain*nblock) NMI.resize(data.nstrain*nblock);
+	for(auto st = 0u; st < data.nstrain; st++) set_NMI(sett,st,c_start,c_end,NMI.data()+st*nblock);
+		
 	auto tr = model.infection_trans;
 	
-	auto &sus_pop = p[model.trans[tr].from];
-	
-	if(data.nstrain > 1){
-		for(auto dp = 0u; dp < dpmax; dp++){	                                           // Shifts susceptible populations 
-			auto sum = 0.0;
-			for(auto st = 1u; st < data.nstrain; st++){ 
-				auto dpp = dpmax*st + dp; 
-				sum += sus_pop[dpp]; sus_pop[dpp] = 0;
-			}
-			sus_pop[dp] += sum;
-		}
-	}
-	
-	for(auto st = 0u; st < data.nstrain; st++){                                        // Goes over all strains
-		auto NMI = get_NMI(sett,st,c);
-
-		auto be = beta[st][c][sett];
-		be *= areafactor[sett/details.division_per_time][c];
-		
-		auto efoi_info = model.efoispline_info[model.efoi_spl_ref[st][c]];
-		auto et = disc_spline[efoi_info.spline_ref][sett];
+	for(auto c = c_start; c < c_end; c++){
+		auto tmean = transmean[sett][c];
+		auto p = pop[sett][c];
 		
-		if(details.mode == PREDICTION) et *= model.modelmod.efoi_mult[sett][c][st];      // Potential model changes
+		auto sus_pop = p[model.trans[tr].from];
 		
-		vector <double> eta_age(data.nage);
-		const auto &agedist = efoi_info.efoi_agedist;
-	
-		for(auto a = 0u; a < data.nage; a++) eta_age[a] = et*agedist[a];
+		if(data.nstrain > 1){
+			for(auto dp = 0u; dp < dpmax; dp++){	                                         // Shifts susceptible populations 
+				auto sum = 0.0;
+				for(auto st = 1u; st < data.nstrain; st++){ 
+					auto dpp = dpmax*st + dp; 
+					sum += sus_pop[dpp]; sus_pop[dpp] = 0;
+				}
+				sus_pop[dp] += sum;
+			}
+		}
 		
-		auto dpp = st*dpmax;
-		for(auto dp = 0u; dp < dpmax; dp++){	
-			auto popu = sus_pop[dp];
-			if(popu <= 0) tmean[tr][dpp] = 0;
-			else{
-				auto a = data.democatpos[dp][0];
-				tmean[tr][dpp] = dt*popu*susceptibility[dpp]*(be*NMI[a] + eta_age[a]);
+		for(auto st = 0u; st < data.nstrain; st++){                                      // Goes over all strains
+			auto NMI_c = NMI.data() + st*nblock + (c-c_start);                             // The ages have stride nc
+			
+			auto be = beta[st][c][sett];
+			be *= areafactor[sett/details.division_per_time][c];
+			
+			const auto &efoi_info = model.efoispline_info[model.efoi_spl_ref[st][c]];
+			auto et = disc_spline[efoi_info.spline_ref][sett];
+			
+			if(details.mode == PREDICTION) et *= model.modelmod.efoi_mult[sett][c][st];    // Potential model changes
+			
+			const auto &agedist = efoi_info.efoi_agedist;
+			
+			auto tmean_inf = tmean[tr] + st*dpmax;
+			auto sus = susceptibility.data() + st*dpmax;
+			for(auto dp = 0u; dp < dpmax; dp++){	
+				auto popu = sus_pop[dp];
+				if(popu <= 0) tmean_inf[dp] = 0;
+				else{
+					auto a = data.democatpos[dp][0];
+					tmean_inf[dp] = dt*popu*sus[dp]*(be*NMI_c[a*nc] + et*agedist[a]);
+				}
 			}
-			dpp++;
 		}
-	}
-	
-	for(auto tr = 0u; tr < model.trans.size(); tr++){                       // Non-infection transitions
-		if(model.trans[tr].inf == TRANS_NOTINFECTION){
-			auto from = model.trans[tr].from;
-			for(auto dp = 0u; dp < data.ndemocatpos; dp++){	
-				auto popu = p[from][dp];
-				if(popu <= 0) tmean[tr][dp] = 0;
-				else tmean[tr][dp] = dt*popu*transrate[tr][dp];
+		
+		for(auto tr = 0u; tr < model.trans.size(); tr++){                     // Non-infection transitions
+			if(model.trans[tr].inf == TRANS_NOTINFECTION){
+				auto from = model.trans[tr].from;
+				for(auto dp = 0u; dp < data.ndemocatpos; dp++){	
+					auto popu = p[from][dp];
+					if(popu <= 0) tmean[tr][dp] = 0;
+					else tmean[tr][dp] = dt*popu*transrate[tr][dp];
+				}
 			}
 		}
-	}
-	
-	if(details.mode == PREDICTION){                                         // Incorporates model modification
-		auto &tmean_mult = model.modelmod.transmean_mult[sett][c];
-		for(auto tr = 0u; tr < model.trans.size(); tr++){   
-			for(auto dp = 0u; dp < data.ndemocatpos; dp++){	
-				tmean[tr][dp] *= tmean_mult[tr][dp];
+		
+		if(details.mode == PREDICTION){                                       // Incorporates model modification
+			auto &tmean_mult = model.modelmod.transmean_mult[sett][c];
+			for(auto tr = 0u; tr < model.trans.size(); tr++){   
+				for(auto dp = 0u; dp < data.ndemocatpos; dp++){	
+					tmean[tr][dp] *= tmean_mult[tr][dp];
+				}
 			}
 		}
 	}
@@ -397,63 +673,131 @@ void State::update_pop(const unsigned int sett)
 {
 	timer[TIME_UPDATEPOP].start();
 	
-	auto &popnext = pop[sett+1];
-	popnext = pop[sett];
-	for(auto c = 0u; c < data.narea; c++){
-		auto &popnext_c = popnext[c];
-		auto &tnum = transnum[sett][c];
+	for(auto c = 0u; c < data.narea; c++) update_pop_area(sett,c);
+	
+	timer[TIME_UPDATEPOP].stop();
+}
 
-		for(auto tr = 0u; tr < model.trans.size(); tr++){
-			auto from = model.trans[tr].from;
-			auto to = model.trans[tr].to;
-			
-			for(auto dp = 0u; dp < data.ndemocatpos; dp++){	
-				auto num = tnum[tr][dp];				
-				if(num != 0){
-					popnext_c[from][dp] -= num;
-					popnext_c[to][dp] += num; 
-				}
-			}		
+
+/// Updates the population when performing MBPs on state
+/// Areas with the same population and transitions as in state are copied from it (area_changed flags the others)
+void State::update_pop(const unsigned int sett, const State *state, const SettView<const double> &dtransnum, vector <bool> &area_changed)
+{
+	if(data.nstrain > 1){                                       // set_transmean moves susceptibles between strains in pop
+		for(auto c = 0u; c < data.narea; c++) area_changed[c] = true;
+		update_pop(sett);
+		return;
+	}
+	
+	timer[TIME_UPDATEPOP].start();
+	
+	auto n = model.trans.size()*data.ndemocatpos;
+	for(auto c = 0u; c < data.narea; c++){
+		if(area_changed[c] == false){
+			auto dtn = dtransnum[c].p;
+			auto i = 0u; while(i < n && dtn[i] == 0) i++;
+			if(i < n) area_changed[c] = true;
 		}
 	}
 	
+	for(const auto &dcc : data.democat_change){                 // Population adjustment couples areas within a group
+		auto fl = false; for(auto c : dcc.area){ if(area_changed[c] == true) fl = true;}
+		if(fl == true){ for(auto c : dcc.area) area_changed[c] = true;}
+	}
+	
+	for(auto c = 0u; c < data.narea; c++){
+		if(area_changed[c] == true) update_pop_area(sett,c);
+		else pop.copy_area(sett+1,c,state->pop,sett+1);
+	}
+	
 	timer[TIME_UPDATEPOP].stop();
 }
 
 
-/// Gets total infectivity as a function of age group at a given time sett for infection transition inft in an area c
-vector <double> State::get_NMI(const unsigned int sett, const unsigned int st, const unsigned int c)
+/// Updates the population in area c corresponding to transnum
+void State::update_pop_area(const unsigned int sett, const unsigned int c)
+{
+	pop.copy_area(sett+1,c,pop,sett);
+	
+	auto popnext_c = pop[sett+1][c];
+	auto tnum = transnum[sett][c];
+
+	for(auto tr = 0u; tr < model.trans.size(); tr++){
+		auto from = model.trans[tr].from;
+		auto to = model.trans[tr].to;
+		
+		for(auto dp = 0u; dp < data.ndemocatpos; dp++){	
+			auto num = tnum[tr][dp];				
+			if(num != 0){
+				popnext_c[from][dp] -= num;
+				popnext_c[to][dp] += num; 
+			}
+		}		
+	}
+}
+
+
+/// Multiplies the age mixing matrix N by the infectivity of a block of nc areas I to give the force of infection
+/// I and NMI are stored [age][area] so the inner loop runs over areas (allowing vectorisation)
+/// NAGE gives the number of ages at compile time (or zero if this is only known at run time)
+template <unsigned int NAGE>
+static void foi_kernel(const vector < vector <double> > &N, const double *I, double *NMI, const unsigned int nc, const unsigned int nage_run)
+{
+	const auto nage = (NAGE == 0 ? nage_run : NAGE);
+	
+	for(auto a = 0u; a < nage; a++){
+		auto NMI_a = NMI + a*nc;
+		for(auto k = 0u; k < nc; k++) NMI_a[k] = 0;
+		
+		const auto &N_a = N[a];
+		for(auto aa = 0u; aa < nage; aa++){
+			auto n = N_a[aa];
+			auto I_aa = I + aa*nc;
+			for(auto k = 0u; k < nc; k++) NMI_a[k] += n*I_aa[k];
+		}
+		
+		for(auto k = 0u; k < nc; k++){ if(NMI_a[k] < 0) NMI_a[k] = 0;}
+	}
+}
+
+
+/// Calculates the force of infection for strain st for areas c_start to c_end (stored [age][c-c_start] in NMI) 
+void State::set_NMI(const unsigned int sett, const unsigned int st, const unsigned int c_start, const unsigned int c_end, double *NMI) const
 { 
 	auto nage = data.nage;
-	vector <double> NMI(nage);			
+	auto nc = c_end - c_start;
 	double d = disc_spline[model.geo_spline_ref][sett];
 	auto omd = 1-d;
-	auto fac = data.genQ.factor[c];
-
-	if(nage == 1){   // Faster version when only 1 age group
-		double val = Idiag[sett][st][c]*(d+fac*omd) + Imap[sett][st][c]*d;
-		if(val < 0) val = 0;
+	const auto &factor = data.genQ.factor;
+	const auto &Idiag_st = Idiag[sett][st];
+	const auto &Imap_st = Imap[sett][st];
 	
-		NMI[0] = val;
-		return NMI;
+	if(nage == 1){                                                   // Faster version when only 1 age group
+		for(auto c = c_start; c < c_end; c++){
+			double val = Idiag_st[c]*(d+factor[c]*omd) + Imap_st[c]*d;
+			if(val < 0) val = 0;
+			NMI[c-c_start] = val;
+		}
+		return;
 	}
 	
-	vector <double> I(nage);	
-	auto v = c*nage;
-	auto &Idiag_st = Idiag[sett][st];
-	auto &Imap_st = Imap[sett][st];
-	for(auto a = 0u; a < nage; a++){
-		I[a] = (Idiag_st[v+a] + Imap_st[v+a])*d + fac*Idiag_st[v+a]*omd;
+	static thread_local vector <double> I;                           // The infectivity [age][c-c_start]
+	if(I.size() < nc*nage) I.resize(nc*nage);
+	for(auto c = c_start; c < c_end; c++){
+		auto v = c*nage;
+		auto fac = factor[c];
+		for(auto a = 0u; a < nage; a++){
+			I[a*nc+c-c_start] = (Idiag_st[v+a] + Imap_st[v+a])*d + fac*Idiag_st[v+a]*omd;
+		}
 	}
 	
-	for(auto a = 0u; a < nage; a++){
-		auto sum = 0.0;
-		for(auto aa = 0u; aa < nage; aa++) sum += Ntime[sett][a][aa]*I[aa];
-		if(sum < 0) sum = 0;
-		NMI[a] = sum;
+	const auto &N = Ntime[sett];
+	switch(nage){
+		case 4: foi_kernel<4>(N,I.data(),NMI,nc,nage); break;
+		case 9: foi_kernel<9>(N,I.data(),NMI,nc,nage); break;
+		case 16: foi_kernel<16>(N,I.data(),NMI,nc,nage); break;
+		default: foi_kernel<0>(N,I.data(),NMI,nc,nage); break;
 	}
-	
-	return NMI;
 }
 
 
@@ -476,6 +820,11 @@ void State::simulate(const unsigned int ti, const unsigned int tf)
 {
 	timer[TIME_SIMULATE].start();
 
+	if(nwindow != UNSET){                               // Moves the window of stored time divisions
+		if(tf-ti > nwindow) emsgEC("State",61);
+		slide_window(ti);
+	}
+	
 	if(ti == 0) pop_init();
 	
 	auto step = (unsigned int)(details.ndivision/10.0); if(step == 0) step = 1;
@@ -489,34 +838,60 @@ void State::simulate(const unsigned int ti, const unsigned int tf)
 		set_Imap_sett(sett);
 
 		timer[TIME_TRANSNUM].start();
-		double mean;
-		for(auto c = 0u; c < data.narea; c++){
-			auto &prop_tnum = transnum[sett][c];
-			auto &tmean = transmean[sett][c];
-			
-			set_transmean(sett,c);
-			
-			for(auto tr = 0u; tr < model.trans.size(); tr++){
-				for(auto dp = 0u; dp < data.ndemocatpos; dp++){	 
-					mean = tmean[tr][dp];
-			
-					if(mean == 0) prop_tnum[tr][dp] = 0;
-					else{
-						if(details.stochastic == true) prop_tnum[tr][dp] = poisson_sample(mean);		
-						else prop_tnum[tr][dp] = mean;
-					}						
+		threadpool.run(data.narea,[&](const unsigned int, const unsigned int c_start, const unsigned int c_end){
+			auto n = model.trans.size()*data.ndemocatpos;
+			set_transmean(sett,c_start,c_end);
+			for(auto c = c_start; c < c_end; c++){
+				if(rng_particle != UNSET) ran_stream(rng_step,0,rng_particle,sett,c);
+				
+				auto prop_tnum = transnum[sett][c].p;                   // The [tr][dp] blocks are contiguous
+				auto tmean = transmean[sett][c].p;
+				
+				if(details.stochastic == true){
+					if(aux_prop != NULL){                                   // Correlated pseudo-marginal sampling
+						const double *z = NULL; if(aux != NULL) z = (*aux)[sett][c].p;
+						poisson_sample_block_correlated(tmean,prop_tnum,n,z,(*aux_prop)[sett][c].p,aux_rho);
+					}
+					else poisson_sample_block(tmean,prop_tnum,n);
+				}
+				else{
+					for(auto i = 0u; i < n; i++) prop_tnum[i] = tmean[i];
 				}
 			}
-		}
+			if(rng_particle != UNSET) ran_stream_default();
+		});
 		timer[TIME_TRANSNUM].stop();
 			
 		if(sett < details.ndivision-1) update_pop(sett);
 	}
+	rng_step++;
 	
 	timer[TIME_SIMULATE].stop();
 }
 
 
+/// The number of individuals who have been infected by time sett (i.e. those not in a compartment left through 
+/// an infection transition). This summarises the state of a particle (used to order particles when resampling)
+double State::infected_total(const unsigned int sett) const
+{
+	vector <bool> sus(model.comp.size(),false);
+	for(const auto &tr : model.trans){ if(tr.inf == TRANS_INFECTION) sus[tr.from] = true;}
+	
+	auto popt = pop[sett];
+	auto sum = 0.0;
+	for(auto c = 0u; c < data.narea; c++){
+		auto popt_c = popt[c];
+		for(auto co = 0u; co < model.comp.size(); co++){
+			if(sus[co] == false){
+				for(auto dp = 0u; dp < data.ndemocatpos; dp++) sum += popt_c[co][dp];
+			}
+		}
+	}
+	
+	return sum;
+}
+
+
 /// Prints the compartmental populations at a given time sett
 string State::print_populations(const unsigned int sett) const
 {
@@ -645,19 +1020,17 @@ void State::load(const string file, const unsigned int ndivision_post)
 	if(!inp_trans) emsg("Cannot open the file '"+filefull+"'");
 	
 	getline(inp_trans,line);
-	part.transnum.resize(details.ndivision);
+	part.transnum.resize(details.ndivision,data.narea,model.trans.size(),data.ndemocatpos);
 	for(auto sett = 0u; sett < ndivision_post; sett++){
 		getline(inp_trans,line);
 		auto spl = split(line,',');
 	
 		auto num = 1u;
-		part.transnum[sett].resize(data.narea);
+		auto tnum = part.transnum[sett];
 		for(auto c = 0u; c < data.narea; c++){
-			part.transnum[sett][c].resize(model.trans.size());
 			for(auto tr = 0u; tr < model.trans.size(); tr++){
-				part.transnum[sett][c][tr].resize(data.ndemocatpos);
 				for(auto dp = 0u; dp < data.ndemocatpos; dp++){
-					part.transnum[sett][c][tr][dp] = get_double(spl[num],"Problem loading the file '"+filefull+"'");
+					tnum[c][tr][dp] = get_double(spl[num],"Problem loading the file '"+filefull+"'");
 					num++; if(num > spl.size()) emsg("Problem loading the file '"+filefull+"'");
 				}
 			}
@@ -666,18 +1039,5 @@ void State::load(const string file, const unsigned int ndivision_post)
 	}
 	inp_trans >> fr; if(!inp_trans.eof()) emsg("Problem loading the file '"+file+"'");
 	
-	for(auto sett = ndivision_post; sett < details.ndivision; sett++){
-		part.transnum[sett].resize(data.narea);
-		for(auto c = 0u; c < data.narea; c++){
-			part.transnum[sett][c].resize(model.trans.size());
-			for(auto tr = 0u; tr < model.trans.size(); tr++){
-				part.transnum[sett][c][tr].resize(data.ndemocatpos);
-				for(auto dp = 0u; dp < data.ndemocatpos; dp++){
-					part.transnum[sett][c][tr][dp] = 0;
-				}
-			}
-		}
-	}
-	
 	initialise_from_particle(part);
 }
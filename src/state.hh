@@ -16,34 +16,52 @@ class State                                              // Store information ab
 		double EF; 																				   // The error function
 		double Pr; 																		       // The prior probability
 		
+		vector <double> obs_value;                           // The observed quantities (set along with EF)
+		vector <double> obs_EF;                              // The contribution to EF from each observation
+		
+		unsigned int rng_particle;                           // If set, simulations use random streams addressed by this particle
+		unsigned long rng_step;                              // The number of simulations performed (used to address streams)
+		
+		const Tensor *aux;                                   // The current auxiliary normals driving the simulation (if set)
+		Tensor *aux_prop;                                    // If set, simulations are driven by auxiliary normals stored here
+		double aux_rho;                                      // The correlation between current and proposed auxiliary normals
+		
+		unsigned int nwindow;                                // If set, only a window of this many time divisions is stored
+		
 		vector <double> paramval;                            // The parameter values
 	
 		vector < vector< vector <double> > > Imap;           // The infectivity map coming from other areas
 		vector < vector< vector <double> > > Idiag;          // The infectivity coming from within an area
 		
-		vector < vector < vector < vector <double> > > > transmean;// The mean number of transitions (for Poisson distribution)  
+		Tensor transmean;                                    // The mean number of transitions (for Poisson distribution)  
 				
-		vector < vector < vector < vector <double> > > > transnum;// Realised number of transitions [sett][area][tr][dp]  
+		Tensor transnum;                                     // Realised number of transitions [sett][area][tr][dp]  
 		
-		vector < vector < vector < vector <double> > > > pop;// The populations in different compartments [sett][area][comp][dp] 
+		Tensor pop;                                          // The populations in different compartments [sett][area][comp][dp] 
 
 	 	/* The quantities below are all derived from the model parameter values */
 		vector <double> susceptibility;                      // The susceptibility for different demographic categories
 		vector < vector <double> > areafactor;               // The modification due to area effects at a particular time
 		vector < vector <double> > disc_spline;              // A discretisation of the splines	
 		vector < vector <double> > transrate;                // Rates for transitions
-		vector < vector < vector <double> > > Ntime;         // Time variation in age matrix
+		NtimeTable Ntime;                                    // Time variation in age matrix
 		vector < vector < vector <double> > > beta;          // The transmission rate
 	
 		void set_param(const vector <double> &paramv);
 		void democat_change_pop_adjust(const unsigned int sett);
+		void democat_change_pop_adjust(const unsigned int sett, const vector <bool> &area_changed);
 		void set_transmean(const unsigned int sett, const unsigned int c);
+		void set_transmean(const unsigned int sett, const unsigned int c_start, const unsigned int c_end);
 		void set_EF();
 		void set_Pr();
 		void initialise_from_particle(const Particle &part);
-		Particle create_particle(const unsigned int run) const;
+		void adopt_particle(Particle &part);
+		void release_particle(Particle &part);
+		Particle create_particle(const unsigned int run, const bool keep_derived = true) const;
 		void simulate(const vector <double> &paramval);
 		void simulate(const unsigned int ti, const unsigned int tf);
+		void set_window(const unsigned int nwin);
+		double infected_total(const unsigned int sett) const;
 		Sample create_sample() const;
 		ParamSample create_param_sample(const unsigned int run) const;
 		void save(const string file) const;
@@ -53,15 +71,34 @@ class State                                              // Store information ab
 		// START These functions are used for MBPs //
 		void set_Imap_sett(const unsigned int sett);
 		void set_Imap_using_dI(const unsigned int sett, const State *state, const vector< vector <double> > &dImap, const vector < vector <double> > &dIdiag);
-		void update_I_from_transnum(vector < vector <double> > &Ima, vector < vector <double> > &Idia, const vector < vector < vector <double> > > &dtransnum) const;
+		void update_I_from_transnum(vector < vector <double> > &Ima, vector < vector <double> > &Idia, const SettView<const double> &dtransnum) const;
+		void update_I_from_transnum_area(vector < vector <double> > &Ima, vector < vector <double> > &Idia, const SettView<const double> &dtransnum, const unsigned int c_start, const unsigned int c_end) const;
 		void update_pop(const unsigned int sett);
+		void update_pop(const unsigned int sett, const State *state, const SettView<const double> &dtransnum, vector <bool> &area_changed);
 		void pop_init();
+		unsigned int first_param_change(const State *state) const;
+		void copy_start(const State *state, const unsigned int sett_begin, const unsigned int sett_end);
 		// END //
 		
 	private:
 		void set_Imap(unsigned int check);
-		vector <double> get_NMI(const unsigned int sett, const unsigned int inft, const unsigned int c);
+		void democat_change_pop_adjust(const unsigned int sett, const DemocatChange &dcc);
+		void update_pop_area(const unsigned int sett, const unsigned int c);
+		void initialise_from_transnum(const vector <double> &paramv, const double EF_, const bool derived_set);
+		void set_NMI(const unsigned int sett, const unsigned int st, const unsigned int c_start, const unsigned int c_end, double *NMI) const;
 		string print_populations(const unsigned int sett) const;
+		void set_param_change(const vector <double> &paramv_dir);
+		void check_param(const vector <double> &paramv_dir) const;
+		void set_inf_dif();
+		void slide_window(const unsigned int ti);
+		
+		vector <double> paramv_dir_set;                      // The (Dirichlet corrected) parameters used to set the derived quantities
+		
+		vector <unsigned int> inf_dif_tr;                    // The transitions which change infectivity
+		vector <double> inf_dif;                             // The change in infectivity for these transitions
+		
+		mutable vector < vector < vector <double> > > Ima_thread;  // Per-thread accumulators used in update_I_from_transnum
+		mutable vector < vector < vector <double> > > Idia_thread;
 		
 		const vector <Compartment> &comp;
 		const vector <Transition> &trans;
@@ -34,15 +34,15 @@ void State::check(const unsigned int checknum)
 		}
 	}		
 	
+	auto popst = pop;                                              // Takes a copy of pop (a view would be overwritten)
 	for(auto sett = 0u; sett < details.ndivision-1; sett++){       // Checks pop is correct
-		auto popst = pop[sett+1];
 		update_pop(sett);
 		democat_change_pop_adjust(sett+1);
 			
 		for(auto c = 0u; c < data.narea; c++){
 			for(auto co = 0u; co < model.comp.size(); co++){
 				for(auto dp = 0u; dp < data.ndemocatpos; dp++){
-					if(popst[c][co][dp] != pop[sett+1][c][co][dp]){
+					if(popst[sett+1][c][co][dp] != pop[sett+1][c][co][dp]){
 						emsgEC("State_check",1);
 					}
 				}
@@ -8,6 +8,7 @@
 using namespace std;
 
 #include "consts.hh"
+#include "tensor.hh"
 
 class Details;                              // Makes prototypes for the main classes
 class Data;
@@ -63,6 +64,28 @@ struct ParamSplineRef{                     // References any splines the paramet
 	unsigned int i;
 };
 
+struct ParamDerived{                       // The derived quantities which depend on a parameter (see Model::set_param_derived)
+	bool transrate;                          // Set if the transition rates depend on the parameter
+	bool susceptibility;                     // Set if the susceptibility depends on the parameter
+	bool areafactor;                         // Set if the area factors depend on the parameter
+	bool beta;                               // Set if beta depends on the parameter at all times (e.g. infectivity)
+	vector <unsigned int> spline;            // The splines which depend on the parameter
+};
+
+struct SettRange{                          // A range of time divisions [ti,tf) (empty if ti >= tf)
+	unsigned int ti;
+	unsigned int tf;
+};
+
+struct NtimeTable{                         // The time variation in the age mixing matrix
+	vector < vector < vector <double> > > mat;// The distinct mixing matrices
+	vector < vector <double> > fac;          // The spline factors used to generate each matrix
+	vector <unsigned int> nuse;              // The number of time divisions using each matrix (zero if free)
+	vector <unsigned int> ref;               // The matrix used in each time division
+	
+	const vector < vector <double> > &operator[](const unsigned int sett) const { return mat[ref[sett]]; }
+};
+
 struct ParamSpec {                         // Gives the specification for a parameter and/or a prior
 	string name;
 	string value;
@@ -148,15 +171,39 @@ struct SplineInfo{                         // Provides information about R_splin
 struct Particle
 {
 	vector <double> paramval;                // The parameter values for the particle
-	vector <vector < vector < vector <double> > > > transnum; // Transition numbers 
+	Tensor transnum;                         // Transition numbers [sett][area][tr][dp]
+	CompactTensor transnum_code;             // Encoded transition numbers (used instead of transnum when compacted)
 	double EF;                               // The value of the error function
 	unsigned int run;                        // The run the particle belongs to 
+	
+	bool warm = false;                       // Set if the derived state below is consistent with paramval and transnum
+	Tensor pop;                              // Populations [sett][area][comp][dp] (only kept for warm particles)
+	Tensor transmean;                        // Mean number of transitions [sett][area][tr][dp]
+	vector < vector < vector <double> > > Imap;  // The infectivity map [sett][strain][area-age]
+	vector < vector < vector <double> > > Idiag; // The infectivity from within an area [sett][strain][area-age]
 
 	ParamSample create_param_samp() const
 	{
 		ParamSample ps; ps.paramval = paramval; ps.run = run; ps.EF = EF;
 		return ps;
 	}
+	
+	void compact()                           // Encodes transnum and drops any derived state to reduce memory
+	{                                        // (used for stored particles, which are not reloaded)
+		if(warm == true){
+			pop.clear(); transmean.clear(); 
+			vector < vector < vector <double> > > ().swap(Imap); vector < vector < vector <double> > > ().swap(Idiag);
+			warm = false;
+		}
+		if(transnum_code.empty() == false) return;
+		transnum_code.encode(transnum); transnum.clear();
+	}
+	
+	void expand()                            // Decodes transnum 
+	{
+		if(transnum_code.empty() == true) return;
+		transnum_code.decode(transnum); transnum_code.clear();
+	}
 };
 
 struct Generation                          // Stores inforamtion about a generation when doing ABC methods
@@ -197,6 +244,12 @@ struct SparseMatrix {                      // Loads a matrix
 	vector < vector <double> > val;          // The the non-diagonal elements of the matrix
 };
 
+struct SparseMatrixCSR {                   // A sparse matrix in compressed sparse row format
+	vector <unsigned int> start;             // The start of each row in col and val (size N+1)
+	vector <unsigned int> col;               // The column of each element multiplied by the block size
+	vector <double> val;                     // The value of each element
+};
+
 struct MatrixModification {                // Used to modify the mixing matrix
 	MatModType type;	                       // The type of modification
 	string name;                             // The name of the modification
@@ -310,6 +363,21 @@ struct Observation {                       // A single observation made on the s
 	double shape;                            // Shape paremeter (used for negative binomial).
 };
 
+struct ObsCell {                           // A state element [c][tr or co][dp] which is linked to observations
+	unsigned int c;                          // The area
+	unsigned int i;                          // The transition or compartment
+	unsigned int dp;                         // The demographic possibility
+};
+
+struct ObsIndex {                          // A compressed sparse (CSR) index from state elements to observations
+	vector <unsigned int> sett_start;        // The first cell for each time division (size ndivision+1)
+	vector <ObsCell> cell;                   // The cells which have at least one observation
+	vector <unsigned int> cell_start;        // The first link for each cell (size ncell+1)
+	vector <unsigned int> obs;               // The observation for each link
+	vector <double> factor;                  // The factor multiplying each link
+	vector <unsigned int> factor_spline;     // The spline multiplying each link (UNSET if none)
+};
+
 struct GraphPoint {                        // Details of a point on a graph
 	double xi;                               // The x position at the start of the observation
 	double xf;                               // The x position at the end of the observation
@@ -489,6 +557,7 @@ struct Chain{                              // Stores information about an MCMC c
 	double invT;                             // The inverse temperature
 	vector <ParamSample> param_samp;         // Parameter samples for tuning proposals
 	vector <double> EF_samp;                 // Parameter samples for calculating model evidence
+	vector <unsigned int> EF_samp_num;       // The chain number (i.e. temperature) at which each EF sample was taken
 
 	unsigned int nproposal;                  // The number of proposals
 	
@@ -496,6 +565,15 @@ struct Chain{                              // Stores information about an MCMC c
 	unsigned int nac;                        // The number of times a swap is accepted
 };
 
+enum RoundTripEnd { RT_NONE, RT_POST, RT_PRIOR };
+
+struct RoundTrip{                          // Tracks a state moving between the posterior and prior chains (used in MC3)
+	RoundTripEnd last;                       // The last end of the temperature ladder that was visited
+	unsigned int t_start;                    // The sample at which the current round trip started
+	unsigned int ntrip;                      // The number of completed round trips
+	double time_sum;                         // The total number of samples taken by these round trips
+};
+
 struct AreaPlot {                          // Stores information about plotting areas
 	string boundfile;                        // A files which specifies boundaries
 	string xcol, ycol;                       // Defines columns which specify the location ofr an area
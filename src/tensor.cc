@@ -0,0 +1,274 @@
+/// Implements the Tensor class used to store the state (populations, transition numbers and means)
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+#include "tensor.hh"
+#include "utils.hh"
+
+/// Initialises an empty tensor
+Tensor::Tensor()
+{
+	resize(0,0,0,0);
+}
+
+
+/// Initialises a tensor with a given size (all elements set to zero)
+Tensor::Tensor(const unsigned int n0, const unsigned int n1, const unsigned int n2, const unsigned int n3, const TensorOrder ord)
+{
+	resize(n0,n1,n2,n3,ord);
+}
+
+
+/// Sets the size of the tensor (all elements set to zero)
+void Tensor::resize(const unsigned int n0, const unsigned int n1, const unsigned int n2, const unsigned int n3, const TensorOrder ord_)
+{
+	n[0] = n0; n[1] = n1; n[2] = n2; n[3] = n3;
+	ord = ord_;
+	base = 0;
+
+	s2 = n3;                                          // The last two axes are always contiguous
+	switch(ord){
+		case TIME_MAJOR: s1 = size_t(n2)*n3; s0 = s1*n1; break;
+		case AREA_MAJOR: s0 = size_t(n2)*n3; s1 = s0*n0; break;
+	}
+
+	ele.assign(size_t(n0)*n1*n2*n3,0);
+}
+
+
+/// Sets all the elements to zero
+void Tensor::set_zero()
+{
+	fill(ele.begin(),ele.end(),0);
+}
+
+
+/// Empties the tensor (releasing the memory used by the elements)
+void Tensor::clear()
+{
+	for(auto i = 0u; i < 4; i++) n[i] = 0;
+	s0 = 0; s1 = 0; s2 = 0;
+	base = 0;
+	vector <double> ().swap(ele);
+}
+
+
+/// Copies the slab at i0 from another tensor with the same shape
+void Tensor::copy_sett(const unsigned int i0, const Tensor &from)
+{
+	copy_sett(i0,from,i0);
+}
+
+
+/// Copies the slab i0_from in another tensor into slab i0
+void Tensor::copy_sett(const unsigned int i0, const Tensor &from, const unsigned int i0_from)
+{
+	if(from.n[1] != n[1] || from.n[2] != n[2] || from.n[3] != n[3] || from.ord != ord) emsgEC("Tensor",1);
+
+	switch(ord){
+		case TIME_MAJOR:                                // The slab is contiguous
+			copy(from.ele.begin()+(i0_from-from.base)*s0,from.ele.begin()+(i0_from-from.base+1)*s0,ele.begin()+(i0-base)*s0);
+			break;
+
+		case AREA_MAJOR:                                // Each area block is contiguous
+			for(auto i1 = 0u; i1 < n[1]; i1++){
+				auto st = from.ele.begin()+(i0_from-from.base)*s0+i1*s1;
+				copy(st,st+s0,ele.begin()+(i0-base)*s0+i1*s1);
+			}
+			break;
+	}
+}
+
+
+/// Copies the [i2][i3] block at (i0_from,i1) in another tensor into the block at (i0,i1)
+void Tensor::copy_area(const unsigned int i0, const unsigned int i1, const Tensor &from, const unsigned int i0_from)
+{
+	if(from.n[1] != n[1] || from.n[2] != n[2] || from.n[3] != n[3] || from.ord != ord) emsgEC("Tensor",2);
+	
+	auto st = from.ele.begin()+(i0_from-from.base)*from.s0+i1*from.s1;
+	copy(st,st+size_t(n[2])*n[3],ele.begin()+(i0-base)*s0+i1*s1);
+}
+
+
+/// Determines if two tensors have the same shape
+bool Tensor::same_shape(const Tensor &ten) const
+{
+	for(auto i = 0u; i < 4; i++){ if(n[i] != ten.n[i]) return false;}
+	if(ord != ten.ord) return false;
+	return true;
+}
+
+
+/// Swaps the contents of two tensors (without copying the elements)
+void Tensor::swap(Tensor &ten)
+{
+	for(auto i = 0u; i < 4; i++) std::swap(n[i],ten.n[i]);
+	std::swap(s0,ten.s0); std::swap(s1,ten.s1); std::swap(s2,ten.s2);
+	std::swap(ord,ten.ord);
+	std::swap(base,ten.base);
+	ele.swap(ten.ele);
+}
+
+
+/// Moves a window along the first axis so it starts at base_new (slabs in both windows keep their values)
+/// This allows a tensor to store only a window of time divisions
+void Tensor::slide(const unsigned int base_new)
+{
+	if(ord != TIME_MAJOR) emsgEC("Tensor",9);
+	
+	if(base_new > base){
+		for(auto i0 = base_new; i0 < base+n[0]; i0++){
+			copy(ele.begin()+(i0-base)*s0,ele.begin()+(i0-base+1)*s0,ele.begin()+(i0-base_new)*s0);
+		}
+	}
+	else{
+		if(base_new < base){
+			auto end = base_new+n[0];
+			for(auto i0 = end; i0 > base; i0--){
+				copy(ele.begin()+(i0-1-base)*s0,ele.begin()+(i0-base)*s0,ele.begin()+(i0-1-base_new)*s0);
+			}
+		}
+	}
+	base = base_new;
+}
+
+
+const uint16_t COMPACT_MAXVAL = 0x7fff;           // Values up to this are stored directly in a word
+const uint16_t COMPACT_RUN = 0x8000;              // Flags a run of zeros (the length is given by the lower bits)
+const uint16_t COMPACT_MAXRUN = 0x3fff;           // The maximum length of a run of zeros
+const uint16_t COMPACT_ESCAPE = 0xc000;           // Followed by the four words of a double which cannot be stored directly
+
+/// Initialises an empty compact tensor
+CompactTensor::CompactTensor()
+{
+	clear();
+}
+
+
+/// Encodes a tensor
+void CompactTensor::encode(const Tensor &ten)
+{
+	for(auto i = 0u; i < 4; i++) n[i] = ten.size(i);
+	ord = ten.order();
+	code.clear();
+	compact_encode(ten.data(),ten.nelement(),code);
+	code.shrink_to_fit();
+	stored = true;
+}
+
+
+/// Decodes into a tensor (which is resized)
+void CompactTensor::decode(Tensor &ten) const
+{
+	if(stored == false) emsgEC("Tensor",3);
+	
+	ten.resize(n[0],n[1],n[2],n[3],ord);
+	auto nw = compact_decode(code.data(),code.size(),ten.data(),ten.nelement());
+	if(nw != code.size()) emsgEC("Tensor",4);
+}
+
+
+/// Sets the shape of the tensor (used when the words are set directly)
+void CompactTensor::set_shape(const unsigned int *n_, const TensorOrder ord_)
+{
+	for(auto i = 0u; i < 4; i++) n[i] = n_[i];
+	ord = ord_;
+	code.clear();
+	stored = true;
+}
+
+
+/// Removes any encoded tensor
+void CompactTensor::clear()
+{
+	for(auto i = 0u; i < 4; i++) n[i] = 0;
+	ord = TIME_MAJOR;
+	vector <uint16_t> ().swap(code);
+	stored = false;
+}
+
+
+/// Appends the encoding of num elements to code
+void compact_encode(const double *x, const size_t num, vector <uint16_t> &code)
+{
+	size_t i = 0;
+	while(i < num){
+		auto v = x[i];
+		if(v == 0){                                   // Run of zeros
+			auto j = i+1; while(j < num && j-i < COMPACT_MAXRUN && x[j] == 0) j++;
+			code.push_back(uint16_t(COMPACT_RUN | (j-i)));
+			i = j;
+		}
+		else{
+			if(v > 0 && v <= COMPACT_MAXVAL && v == double(uint16_t(v))) code.push_back(uint16_t(v));
+			else{                                       // Large or non-integer values are stored in full
+				uint16_t w[4]; memcpy(w,&v,sizeof(double));
+				code.push_back(COMPACT_ESCAPE); code.insert(code.end(),w,w+4);
+			}
+			i++;
+		}
+	}
+}
+
+
+/// Decodes num elements from code (of length ncode) and returns the number of words used
+size_t compact_decode(const uint16_t *code, const size_t ncode, double *x, const size_t num)
+{
+	size_t i = 0, w = 0;
+	while(i < num){
+		if(w >= ncode) emsgEC("Tensor",5);
+		auto c = code[w]; w++;
+		if(c <= COMPACT_MAXVAL){ x[i] = c; i++;}
+		else{
+			if(c == COMPACT_ESCAPE){
+				if(w+4 > ncode) emsgEC("Tensor",6);
+				memcpy(x+i,code+w,sizeof(double)); w += 4; i++;
+			}
+			else{
+				if((c & COMPACT_ESCAPE) != COMPACT_RUN) emsgEC("Tensor",7);
+				size_t r = c & COMPACT_MAXRUN;
+				if(r == 0 || i+r > num) emsgEC("Tensor",8);
+				fill(x+i,x+i+r,0.0); i += r;
+			}
+		}
+	}
+	return w;
+}
+
+
+/// Appends words to a buffer of doubles (the number of words followed by four words in each double)
+/// Returns the number of doubles added
+size_t compact_pack_words(const vector <uint16_t> &code, vector <double> &buffer)
+{
+	auto nw = code.size();
+	auto k = buffer.size();
+	buffer.push_back(nw); k++;
+	
+	auto nd = (nw+3)/4;
+	buffer.resize(k+nd);
+	if(nw > 0){
+		buffer[k+nd-1] = 0;
+		memcpy(&buffer[k],code.data(),nw*sizeof(uint16_t));
+	}
+	
+	return nd+1;
+}
+
+
+/// Reads words packed by compact_pack_words from a buffer of nbuf doubles
+/// Returns the number of doubles used
+size_t compact_unpack_words(const double *buffer, const size_t nbuf, vector <uint16_t> &code)
+{
+	if(nbuf == 0) emsgEC("Tensor",10);
+	size_t nw = buffer[0];
+	
+	auto nd = (nw+3)/4;
+	if(1+nd > nbuf) emsgEC("Tensor",11);
+	code.resize(nw);
+	if(nw > 0) memcpy(code.data(),buffer+1,nw*sizeof(uint16_t));
+	
+	return nd+1;
+}
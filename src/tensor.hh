@@ -0,0 +1,107 @@
+/// Stores four-dimensional arrays (e.g. [sett][area][tr][dp]) in a single contiguous allocation
+
+#ifndef BEEPMBP__TENSOR_HH
+#define BEEPMBP__TENSOR_HH
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+#include "consts.hh"
+
+template <class T>
+struct AreaView                                      // A view of the [i2][i3] block for a fixed sett and area
+{
+	AreaView(T *p_, const size_t s2_) : p(p_), s2(s2_) {}
+	template <class U>
+	AreaView(const AreaView<U> &v) : p(v.p), s2(v.s2) {}
+
+	T* operator[](const unsigned int i2) const { return p + i2*s2; }
+
+	T *p;                                              // Points to element [0][0] of the block
+	size_t s2;                                         // The stride of the third axis (the last axis is contiguous)
+};
+
+template <class T>
+struct SettView                                      // A view of the [i1][i2][i3] slab for a fixed sett
+{
+	SettView(T *p_, const size_t s1_, const size_t s2_) : p(p_), s1(s1_), s2(s2_) {}
+	template <class U>
+	SettView(const SettView<U> &v) : p(v.p), s1(v.s1), s2(v.s2) {}
+
+	AreaView<T> operator[](const unsigned int i1) const { return AreaView<T>(p + i1*s1, s2); }
+
+	T *p;                                              // Points to element [0][0][0] of the slab
+	size_t s1, s2;                                     // The strides of the second and third axes
+};
+
+class Tensor
+{
+	public:
+		Tensor();
+		Tensor(const unsigned int n0, const unsigned int n1, const unsigned int n2, const unsigned int n3, const TensorOrder ord = TIME_MAJOR);
+
+		void resize(const unsigned int n0, const unsigned int n1, const unsigned int n2, const unsigned int n3, const TensorOrder ord = TIME_MAJOR);
+		void set_zero();
+		void clear();
+		void copy_sett(const unsigned int i0, const Tensor &from);
+		void copy_sett(const unsigned int i0, const Tensor &from, const unsigned int i0_from);
+		void copy_area(const unsigned int i0, const unsigned int i1, const Tensor &from, const unsigned int i0_from);
+		bool same_shape(const Tensor &ten) const;
+		void swap(Tensor &ten);
+		void slide(const unsigned int base_new);
+
+		SettView<double> operator[](const unsigned int i0){ return SettView<double>(ele.data() + (i0-base)*s0, s1, s2); }
+		SettView<const double> operator[](const unsigned int i0) const { return SettView<const double>(ele.data() + (i0-base)*s0, s1, s2); }
+
+		double& operator()(const unsigned int i0, const unsigned int i1, const unsigned int i2, const unsigned int i3){ return ele[(i0-base)*s0 + i1*s1 + i2*s2 + i3]; }
+		double operator()(const unsigned int i0, const unsigned int i1, const unsigned int i2, const unsigned int i3) const { return ele[(i0-base)*s0 + i1*s1 + i2*s2 + i3]; }
+
+		unsigned int size(const unsigned int axis) const { return n[axis]; }
+		size_t nelement() const { return ele.size(); }
+		bool empty() const { return ele.size() == 0; }
+		TensorOrder order() const { return ord; }
+		unsigned int first() const { return base; }
+
+		double* data(){ return ele.data(); }
+		const double* data() const { return ele.data(); }
+
+	private:
+		unsigned int n[4];                               // The size of each of the axes
+		size_t s0, s1, s2;                               // The strides of the first three axes
+		TensorOrder ord;                                 // Whether the sett or area axis is outermost
+		unsigned int base;                               // The first index of the first axis stored (non-zero for a window)
+		vector <double> ele;                             // The elements
+};
+
+/// A compressed copy of a tensor whose elements are mostly small non-negative integers, many of them zero
+/// (e.g. transition numbers). Elements are encoded as 16 bit words: a value below 2^15, a run of
+/// zeros, or an escape followed by the four words of the raw double (so the encoding is lossless)
+class CompactTensor
+{
+	public:
+		CompactTensor();
+		
+		void encode(const Tensor &ten);
+		void decode(Tensor &ten) const;
+		void set_shape(const unsigned int *n_, const TensorOrder ord_);
+		void clear();
+		bool empty() const { return stored == false; }
+		size_t nword() const { return code.size(); }
+		
+		unsigned int n[4];                               // The size of each of the axes
+		TensorOrder ord;                                 // The order of the encoded tensor
+		vector <uint16_t> code;                          // The encoded elements
+		
+	private:
+		bool stored;                                     // Set if a tensor has been encoded
+};
+
+void compact_encode(const double *x, const size_t num, vector <uint16_t> &code);
+size_t compact_decode(const uint16_t *code, const size_t ncode, double *x, const size_t num);
+size_t compact_pack_words(const vector <uint16_t> &code, vector <double> &buffer);
+size_t compact_unpack_words(const double *buffer, const size_t nbuf, vector <uint16_t> &code);
+
+#endif
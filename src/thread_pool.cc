@@ -0,0 +1,117 @@
+/// Implements the thread pool
+/// Items are split into contiguous blocks (one per thread) so the partition, and hence the
+/// results, only depend on the number of threads and not on the thread scheduling
+
+using namespace std;
+
+#include "thread_pool.hh"
+#include "utils.hh"
+
+ThreadPool threadpool;
+
+thread_local unsigned int thread_num = 0;
+
+
+/// Initially only the main thread is used
+ThreadPool::ThreadPool()
+{
+	nthread = 1;
+	job_ptr = NULL;
+	njob = 0;
+	generation = 0;
+	nrunning = 0;
+	stop = false;
+}
+
+
+/// Terminates the worker threads
+ThreadPool::~ThreadPool()
+{
+	finish();
+}
+
+
+/// Starts the worker threads (each of which has its own random number generator)
+void ThreadPool::initialise(const unsigned int nthread_, const int seed)
+{
+	if(nthread_ == 0) emsgEC("ThreadPool",1);
+
+	finish();
+
+	nthread = nthread_;
+	stop = false;
+	for(auto th = 1u; th < nthread; th++) workers.push_back(thread(&ThreadPool::worker,this,th,seed,generation));
+}
+
+
+/// Terminates the worker threads
+void ThreadPool::finish()
+{
+	{
+		lock_guard<mutex> lock(mtx);
+		stop = true;
+	}
+	cv_job.notify_all();
+
+	for(auto &wo : workers) wo.join();
+	workers.clear();
+	nthread = 1;
+}
+
+
+/// The first item in the block for thread th
+unsigned int ThreadPool::block_start(const unsigned int n, const unsigned int th) const
+{
+	return (unsigned int)((unsigned long)(n)*th/nthread);
+}
+
+
+/// Runs a job over n items, split into blocks across the threads, and waits for it to complete
+void ThreadPool::run(const unsigned int n, const ThreadJob &job)
+{
+	if(thread_num != 0) emsgEC("ThreadPool",2);                    // Jobs cannot be nested
+	if(nthread == 1){ job(0,0,n); return;}
+
+	{
+		lock_guard<mutex> lock(mtx);
+		job_ptr = &job;
+		njob = n;
+		nrunning = nthread-1;
+		generation++;
+	}
+	cv_job.notify_all();
+
+	job(0,block_start(n,0),block_start(n,1));                      // The main thread does the first block
+
+	unique_lock<mutex> lock(mtx);
+	cv_done.wait(lock,[this]{ return nrunning == 0;});
+	job_ptr = NULL;
+}
+
+
+/// The loop run by each of the worker threads
+void ThreadPool::worker(const unsigned int th, const int seed, const unsigned long gen_start)
+{
+	thread_num = th;
+	sran(seed+th);
+
+	unsigned long gen = gen_start;
+	while(true){
+		const ThreadJob *job;
+		unsigned int n;
+		{
+			unique_lock<mutex> lock(mtx);
+			cv_job.wait(lock,[this,gen]{ return stop == true || generation != gen;});
+			if(stop == true) return;
+			gen = generation; job = job_ptr; n = njob;
+		}
+
+		(*job)(th,block_start(n,th),block_start(n,th+1));
+
+		{
+			lock_guard<mutex> lock(mtx);
+			nrunning--;
+			if(nrunning == 0) cv_done.notify_one();
+		}
+	}
+}
@@ -0,0 +1,47 @@
+/// A pool of threads used to split work (e.g. the areas within a time division) across the cores of a node
+
+#ifndef BEEPMBP__THREAD_POOL_HH
+#define BEEPMBP__THREAD_POOL_HH
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+typedef function<void(const unsigned int th, const unsigned int i_start, const unsigned int i_end)> ThreadJob;
+
+class ThreadPool
+{
+	public:
+		ThreadPool();
+		~ThreadPool();
+
+		void initialise(const unsigned int nthread_, const int seed);
+		void run(const unsigned int n, const ThreadJob &job);
+		unsigned int block_start(const unsigned int n, const unsigned int th) const;
+
+		unsigned int nthread;                                // The number of threads (including the main thread)
+
+	private:
+		void worker(const unsigned int th, const int seed, const unsigned long gen_start);
+		void finish();
+
+		vector <thread> workers;                             // The worker threads (thread 0 is the main thread)
+
+		mutex mtx;                                           // Protects the variables below
+		condition_variable cv_job, cv_done;                  // Used to signal a new job and the job being completed
+		const ThreadJob *job_ptr;                            // The current job
+		unsigned int njob;                                   // The number of items in the current job
+		unsigned long generation;                            // Incremented every time a new job is set
+		unsigned int nrunning;                               // The number of worker threads still running the job
+		bool stop;                                           // Set to true to terminate the worker threads
+};
+
+extern ThreadPool threadpool;
+
+extern thread_local unsigned int thread_num;           // The thread number (0 for the main thread)
+
+#endif
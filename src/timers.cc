@@ -1,23 +1,36 @@
-// Stores the CPU clock times for different parts of the algorithm 
+// Stores the wall-clock times for different parts of the algorithm 
 
 #include <fstream>
 #include <sstream>
+#include <chrono>
 
 using namespace std;
 
 #include "timers.hh"
 #include "mpi.hh"
+#include "thread_pool.hh"
 
 vector <Timer> timer;
+vector <long> counter;
+
+/// The elapsed wall-clock time (in units of CLOCKS_PER_SEC, so it can be used in place of clock())
+/// CPU time is not used because it sums over threads and does not include time spent blocked
+long wall_clock()
+{
+	auto t = chrono::steady_clock::now().time_since_epoch();
+	return long(chrono::duration_cast<chrono::microseconds>(t).count()*(double(CLOCKS_PER_SEC)/1000000));
+}
 
 void Timer::start()
 {
-	val -= clock();
+	if(thread_num != 0) return;                          // Only the main thread is timed
+	val -= wall_clock();
 }
 
 void Timer::stop()
 {
-	val += clock();
+	if(thread_num != 0) return;
+	val += wall_clock();
 }
 
 void timersinit()
@@ -25,15 +38,24 @@ void timersinit()
 	timer.resize(TIMERMAX);
 	
 	for(auto &ti : timer) ti.val = 0;
+	
+	counter.resize(COUNTERMAX);
+	for(auto &co : counter) co = 0;
 }
 
 
-///Outputs CPU timing information to a file
+///Outputs timing information to a file
 void output_timers(string file, Mpi &mpi)
 {
 	vector <double> time_av(TIMERMAX);
 	for(auto i = 0u; i < TIMERMAX; i++) time_av[i] = mpi.average(timer[i].val);
 	
+	auto hit = mpi.average(counter[COUNT_RRATIO_HIT]), miss = mpi.average(counter[COUNT_RRATIO_MISS]);
+	
+	auto wait_frac = 0.0;                                    // The fraction of the time this core spends waiting
+	if(timer[TIME_ALG].val > 0) wait_frac = double(timer[TIME_WAIT].val)/timer[TIME_ALG].val;
+	auto wait_frac_max = mpi.max(wait_frac);
+	
 	if(mpi.core == 0){
 		ofstream dia(file); if(!dia) emsg("Cannot open the file '"+file+"'");
 	
@@ -59,8 +81,14 @@ void output_timers(string file, Mpi &mpi)
 		if(time_av[TIME_CREATEN] > 0) dia << per(time_av[TIME_CREATEN]/time_av[TIME_ALG]) << " Create N " << endl;
 		if(time_av[TIME_BETA_FROM_R] > 0) dia << per(time_av[TIME_BETA_FROM_R]/time_av[TIME_ALG]) << " Beta from R " << endl;
 		
+		if(hit+miss > 0) dia << per(hit/(hit+miss)) << " NGM ratio cache hit rate" << endl;
+		
 		if(time_av[TIME_RESULTS] > 0) dia << per(time_av[TIME_RESULTS]/time_av[TIME_ALG]) << " Generating final results " << endl;
 		if(time_av[TIME_WAIT] > 0) dia << per(time_av[TIME_WAIT]/time_av[TIME_ALG]) << " MPI Waiting" << endl;
+		if(time_av[TIME_WAIT] > 0){
+			dia << per(1-time_av[TIME_WAIT]/time_av[TIME_ALG]) << " Core utilisation (wall-clock time not waiting)" << endl;
+			dia << per(1-wait_frac_max) << " Core utilisation on the least utilised core" << endl;
+		}
 		
 		
 		if(time_av[TIME_MVN] > 0){
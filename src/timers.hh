@@ -18,7 +18,9 @@ struct Timer {
 };
 
 extern vector <Timer> timer;
+extern vector <long> counter;
 
+long wall_clock();
 void timersinit();
 void output_timers(string file, Mpi &mpi);
 #endif
@@ -20,24 +20,70 @@ const bool debug = false;
 
 #include "utils.hh"
 #include "consts.hh"
+#include "rng.hh"
 
-static std::mt19937 mt(0);
+static thread_local RngStream rng_default;                 // Each thread has its own default stream (see ThreadPool)
+static thread_local RngStream rng_address;                 // A stream addressed by (step, run, particle, sett, area)
+static thread_local RngStream rng_outer;                   // An addressed stream which ran_stream_default returns to
+static thread_local RngStream *rng_return = &rng_default;  // The stream returned to by ran_stream_default
+static thread_local RngStream *rng = &rng_default;         // The stream currently being used
 
-default_random_engine generator;
+static uint64_t ran_stream_seed_base = 0;                  // The seed used for addressed streams (same on all cores)
 
 
 /// Sets the seed for the random number generator
 void sran(const int seed)
 {
-	generator.seed(seed);
+	rng_default.set(rng_key(seed,UNSET,UNSET),UNSET,UNSET,UNSET);
+	rng_return = &rng_default;
+	rng = &rng_default;
 #ifdef OLD_RAND
 	srand(seed);
-#else
-	mt = std::mt19937(seed);
 #endif
 }
 
 
+/// Sets the seed for addressed streams (this should not depend on the core)
+void ran_stream_seed(const int seed)
+{
+	ran_stream_seed_base = seed;
+}
+
+
+/// Draws subsequent random numbers from the stream addressed by a step (e.g. a proposal number), run, 
+/// particle, time division and area (the numbers do not depend on which core or thread draws them) 
+void ran_stream(const unsigned long step, const unsigned int run, const unsigned int particle, const unsigned int sett, const unsigned int area)
+{
+	rng_address.set(rng_key(ran_stream_seed_base,step,run),particle,sett,area);
+	rng = &rng_address;
+}
+
+
+/// Returns to drawing random numbers from the default stream for the thread (or the outer stream if set)
+void ran_stream_default()
+{
+	rng = rng_return;
+}
+
+
+/// Draws subsequent random numbers from an outer stream addressed by a step and run and particle (e.g. for 
+/// the parameter proposal and acceptance of an MBP). Streams set by ran_stream return to this stream.
+void ran_stream_outer(const unsigned long step, const unsigned int run, const unsigned int particle)
+{
+	rng_outer.set(rng_key(ran_stream_seed_base,step,run),particle,UNSET,UNSET);
+	rng = &rng_outer;
+	rng_return = &rng_outer;
+}
+
+
+/// Stops using the outer stream (random numbers are drawn from the default stream for the thread)
+void ran_stream_outer_end()
+{
+	rng_return = &rng_default;
+	rng = &rng_default;
+}
+
+
 /// Draws a random number between 0 and 1
 double ran()
 {
@@ -56,7 +102,7 @@ double ran()
 	}
 #else
 	std::uniform_real_distribution<> dist(0.0000000001,0.999999999);
-	return dist(mt);
+	return dist(*rng);
 #endif
 }
 
@@ -65,7 +111,7 @@ double ran()
 double normal_sample(const double mu, const double sd)
 {
 	normal_distribution<double> distribution(mu,sd);
-	return distribution(generator);
+	return distribution(*rng);
 }
 
 
@@ -77,7 +123,7 @@ double exp_sample(const double rate)
 		return LARGE;
 	}
 	exponential_distribution<double> distribution(rate);
-	return distribution(generator);
+	return distribution(*rng);
 }
 
 
@@ -92,7 +138,7 @@ double exp_sample_time(double time)
 double gamma_sample(const double a, const double b)
 {
 	gamma_distribution<double> distribution(a,1.0/b);
-	return distribution(generator);
+	return distribution(*rng);
 }
 
 /// The log of the probability from the normal distribution
@@ -136,12 +182,158 @@ double lognormal_sample(double mean, double sd)
 }
 
 
+/// Draws a uniform random number in (0,1) using a single 32 bit integer (used by the samplers below)
+static inline double ran_u32()
+{
+	return ((*rng)()+0.5)*2.3283064365386963e-10;
+}
+
+
+/// Samples from the Poisson distribution using inversion (efficient for small means)
+static int poisson_inversion(const double lam)
+{
+	auto u = ran_u32();
+	auto p = exp(-lam);
+	auto x = 0;
+	while(u > p){
+		u -= p; x++; p *= lam/x;
+		if(p == 0) return x;                                          // Accounts for rounding error
+	}
+	return x;
+}
+
+
+/// Samples from the Poisson distribution using the transformed rejection method PTRS (Hormann 1993)
+static int poisson_ptrs(const double lam)
+{
+	auto slam = sqrt(lam), loglam = log(lam);
+	auto b = 0.931 + 2.53*slam;
+	auto a = -0.059 + 0.02483*b;
+	auto invalpha = 1.1239 + 1.1328/(b-3.4);
+	auto vr = 0.9277 - 3.6224/(b-2);
+	
+	while(true){
+		auto U = ran_u32() - 0.5;
+		auto V = ran_u32();
+		auto us = 0.5 - fabs(U);
+		auto k = floor((2*a/us + b)*U + lam + 0.43);
+		if(us >= 0.07 && V <= vr) return int(k);
+		if(k < 0 || (us < 0.013 && V > us)) continue;
+		if(log(V) + log(invalpha) - log(a/(us*us)+b) <= -lam + k*loglam - lgamma(k+1)) return int(k);
+	}
+}
+
+
 /// Generates a sample from the Poisson distribution
 int poisson_sample(const double lam)
 {
 	if(lam > LARGE) emsgEC("Utils",6);
-  poisson_distribution<int> distribution(lam);
-	return distribution(generator);
+	if(lam <= 0) return 0;
+	if(lam < 10) return poisson_inversion(lam);
+	return poisson_ptrs(lam);
+}
+
+
+/// Fills a block of n elements with Poisson samples (e.g. the [tr][dp] block for an area)
+void poisson_sample_block(const double *lam, double *num, const unsigned int n)
+{
+	for(auto i = 0u; i < n; i++){
+		auto la = lam[i];
+		if(la <= 0) num[i] = 0;
+		else{
+			if(la < 10) num[i] = poisson_inversion(la);
+			else{
+				if(la > LARGE) emsgEC("Utils",6);
+				num[i] = poisson_ptrs(la);
+			}
+		}
+	}
+}
+
+
+/// The regularised upper incomplete gamma function Q(a,x) (using a series or a continued fraction)
+static double gamma_q(const double a, const double x)
+{
+	if(x <= 0) return 1;
+	auto lfac = a*log(x) - x - lgamma(a);
+	
+	if(x < a+1){                                                     // Series for the lower function P(a,x)
+		auto ap = a, del = 1.0/a, sum = del;
+		for(auto n = 0u; n < 100000; n++){
+			ap++; del *= x/ap; sum += del;
+			if(fabs(del) < fabs(sum)*1E-15) break;
+		}
+		return 1-sum*exp(lfac);
+	}
+	
+	auto b = x+1-a, c = 1.0/1E-300, d = 1.0/b, h = d;               // Continued fraction (modified Lentz)
+	for(auto n = 1u; n < 100000; n++){
+		auto an = -(n*(n-a));
+		b += 2;
+		d = an*d+b; if(fabs(d) < 1E-300) d = 1E-300;
+		c = b+an/c; if(fabs(c) < 1E-300) c = 1E-300;
+		d = 1.0/d;
+		auto del = d*c;
+		h *= del;
+		if(fabs(del-1) < 1E-15) break;
+	}
+	return exp(lfac)*h;
+}
+
+
+/// Samples from the Poisson distribution by inverting its distribution function at the standard normal z
+/// The sample is a monotonic function of z (as required by the correlated pseudo-marginal method)
+int poisson_sample_normal(const double lam, const double z)
+{
+	if(lam <= 0) return 0;
+	if(lam > LARGE) emsgEC("Utils",10);
+	
+	auto u = 0.5*erfc(-z*M_SQRT1_2);                                 // The uniform corresponding to z
+	
+	if(lam < 10){                                                    // Inversion from zero
+		auto p = exp(-lam), F = p;
+		auto x = 0;
+		while(u > F){
+			x++; p *= lam/x; F += p;
+			if(p == 0) break;                                            // Accounts for rounding error
+		}
+		return x;
+	}
+	
+	auto k = floor(lam + sqrt(lam)*z + (z*z-1)/6 + 0.5);             // A Cornish-Fisher first guess 
+	if(k < 0) k = 0;
+	
+	auto p = exp(k*log(lam) - lam - lgamma(k+1));                    // The probability of k
+	auto F = gamma_q(k+1,lam);                                       // The distribution function at k
+	
+	if(F < u){                                                       // Searches upwards
+		while(F < u){
+			k++; p *= lam/k; F += p;
+			if(p == 0) break;
+		}
+	}
+	else{                                                            // Searches downwards
+		while(k > 0 && F-p >= u){
+			F -= p; p *= k/lam; k--;
+			if(p == 0) break;
+		}
+	}
+	return int(k);
+}
+
+
+/// Fills a block of n elements with Poisson samples driven by auxiliary standard normals
+/// The normals used are z_prop = rho*z + sqrt(1-rho^2)*eps (a Crank-Nicolson move from the current normals z)
+/// or are drawn afresh if z is not set
+void poisson_sample_block_correlated(const double *lam, double *num, const unsigned int n, const double *z, double *z_prop, const double rho)
+{
+	auto fac = sqrt(1-rho*rho);
+	for(auto i = 0u; i < n; i++){
+		auto zp = normal_sample(0,1);                                  // A normal is used for every element so the 
+		if(z != NULL) zp = rho*z[i] + fac*zp;                          // stream does not depend on the means
+		z_prop[i] = zp;
+		num[i] = poisson_sample_normal(lam[i],zp);
+	}
 }
 
 
@@ -162,13 +354,127 @@ double poisson_probability(const int i, const double lam)
 }
 
 
+/// Samples from the binomial distribution using inversion (efficient when n*p is small and p <= 0.5)
+static unsigned int binomial_inversion(const double p, const unsigned int n)
+{
+	auto q = 1-p;
+	auto s = p/q;
+	auto a = (n+1)*s;
+	auto r0 = pow(q,n);
+	
+	while(true){
+		auto r = r0;
+		auto u = ran_u32();
+		auto x = 0u;
+		while(u > r){
+			u -= r; x++;
+			if(x > n) break;                                              // Restarts because of rounding error
+			r *= a/x - s;
+		}
+		if(x <= n) return x;
+	}
+}
+
+
+/// Samples from the binomial distribution using the transformed rejection method BTRS (Hormann 1993) for p <= 0.5
+static unsigned int binomial_btrs(const double p, const unsigned int n)
+{
+	auto q = 1-p;
+	auto spq = sqrt(n*p*q);
+	auto b = 1.15 + 2.53*spq;
+	auto a = -0.0873 + 0.0248*b + 0.01*p;
+	auto c = n*p + 0.5;
+	auto alpha = (2.83 + 5.1/b)*spq;
+	auto vr = 0.92 - 4.2/b;
+	auto m = floor((n+1)*p);
+	auto lpq = log(p/q);
+	auto h = lgamma(m+1) + lgamma(n-m+1);
+	
+	while(true){
+		auto u = ran_u32() - 0.5;
+		auto v = ran_u32();
+		auto us = 0.5 - fabs(u);
+		auto k = floor((2*a/us + b)*u + c);
+		if(k < 0 || k > n) continue;
+		if(us >= 0.07 && v <= vr) return (unsigned int)(k);
+		
+		v = log(v*alpha/(a/(us*us) + b));
+		if(v <= h - lgamma(k+1) - lgamma(n-k+1) + (k-m)*lpq) return (unsigned int)(k);
+	}
+}
+
+
 /// A sample from the binomial distribution
 unsigned int binomial_sample(const double p, const unsigned int n)
 {
-	if(n == 0) return 0;
+	if(n == 0 || p <= 0) return 0;
+	if(p >= 1) return n;
+	
+	if(p > 0.5) return n - binomial_sample(1-p,n);                    // Fast when thinning with p close to one
+	
+	if(n*p < 10) return binomial_inversion(p,n);
+	return binomial_btrs(p,n);
+}
+
+
+/// Performs MBPs on a block of n elements: the new number num_p is sampled given the initial number num_i
+/// and the initial and proposed rates (additional events are added or events are thinned)
+void mbp_sample_block(const double *rate_i, const double *rate_p, const double *num_i, double *num_p, const unsigned int n)
+{
+	for(auto i = 0u; i < n; i++){
+		auto ra_p = rate_p[i];
+		if(ra_p == 0) num_p[i] = 0;
+		else{
+			auto ra_i = rate_i[i], ni = num_i[i];
+			if(ra_p == ra_i) num_p[i] = ni;
+			else{
+				if(ra_p > ra_i) num_p[i] = ni + poisson_sample(ra_p-ra_i);
+				else{
+					if(ni == 0) num_p[i] = 0;
+					else num_p[i] = binomial_sample(ra_p/ra_i,(unsigned int)(ni));
+				}
+			}
+		}
+	}
+}
+
+
+/// Compares the speed of the samplers with those from the standard library
+void sampler_benchmark()
+{
+	const auto loopmax = 10000000u;
+	
+	for(auto lam : {0.01, 1.0, 5.0, 20.0, 1000.0}){
+		auto t = clock();
+		auto sum = 0.0;
+		for(auto loop = 0u; loop < loopmax; loop++){ poisson_distribution<int> dist(lam); sum += dist(*rng);}
+		auto t_std = double(clock()-t)/CLOCKS_PER_SEC;
 		
-	binomial_distribution<int> distribution(n,p);
-	return distribution(generator);
+		t = clock();
+		auto sum2 = 0.0;
+		for(auto loop = 0u; loop < loopmax; loop++) sum2 += poisson_sample(lam);
+		auto t_new = double(clock()-t)/CLOCKS_PER_SEC;
+		
+		cout << "Poisson lam=" << lam << "  std: " << loopmax/t_std << " samples/s (mean " << sum/loopmax << ")"
+		     << "  new: " << loopmax/t_new << " samples/s (mean " << sum2/loopmax << ")" << endl;
+	}
+	
+	for(auto p : {0.01, 0.3, 0.9, 0.999}){
+		for(auto n : {10u, 1000u}){
+			auto t = clock();
+			auto sum = 0.0;
+			for(auto loop = 0u; loop < loopmax; loop++){ binomial_distribution<int> dist(n,p); sum += dist(*rng);}
+			auto t_std = double(clock()-t)/CLOCKS_PER_SEC;
+			
+			t = clock();
+			auto sum2 = 0.0;
+			for(auto loop = 0u; loop < loopmax; loop++) sum2 += binomial_sample(p,n);
+			auto t_new = double(clock()-t)/CLOCKS_PER_SEC;
+			
+			cout << "Binomial p=" << p << " n=" << n << "  std: " << loopmax/t_std << " samples/s (mean " << sum/loopmax << ")"
+			     << "  new: " << loopmax/t_new << " samples/s (mean " << sum2/loopmax << ")" << endl;
+		}
+	}
 }
 
 
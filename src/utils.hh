@@ -29,6 +29,11 @@ void warning(const string &msg);
 
 double ran();
 void sran(const int seed);
+void ran_stream_seed(const int seed);
+void ran_stream(const unsigned long step, const unsigned int run, const unsigned int particle, const unsigned int sett, const unsigned int area);
+void ran_stream_default();
+void ran_stream_outer(const unsigned long step, const unsigned int run, const unsigned int particle);
+void ran_stream_outer_end();
 double normal_sample(const double mu, const double sd);
 double normal_probability(const double x, const double mean, const double var);
 double lognormal_sample(const double mean, const double sd);
@@ -39,10 +44,15 @@ double negative_binomial_probability(const unsigned int val, const double m, con
 double exp_sample(const double rate);
 double exp_sample_time(const double rate);
 int poisson_sample(const double lam);
+void poisson_sample_block(const double *lam, double *num, const unsigned int n);
+int poisson_sample_normal(const double lam, const double z);
+void poisson_sample_block_correlated(const double *lam, double *num, const unsigned int n, const double *z, double *z_prop, const double rho);
 double poisson_probability(const int i, const double lam);
 unsigned int binomial_sample(const double ratio, const unsigned int nn);
 double binomial_probability(const double ratio, const unsigned int nn, const unsigned int dn);
 void binomial_check();
+void mbp_sample_block(const double *rate_i, const double *rate_p, const double *num_i, double *num_p, const unsigned int n);
+void sampler_benchmark();
 void strip(string &line);
 void rem_pagebreak(string &line);
 string toLower(string st);